@@ -4,9 +4,19 @@
 #include <cstdlib>
 #include "solver.h"
 #include "dataimporter.h"
+#include "forecast.h"
+#include "mixture.h"
+#include "importpipeline.h"
+#include "boundedqueue.h"
+#include "memorytracker.h"
+#include <thread>
+#include <exception>
+#include <cstdio>
 
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
 #include <boost/serialization/export.hpp>
 #include <boost/serialization/vector.hpp>
 
@@ -20,87 +30,208 @@
 #include <numeric>
 #include <string>
 
-struct AnalyzeSet
-{
-  Eigen::VectorXd params;
-  std::string name;
-  Eigen::VectorXd delta;
-  template <typename Archive>  
-  void serialize(Archive &ar, const unsigned int version)
-  {
-    ar & params;
-    ar & name;
-    ar & delta;
-  }
-};
-
 void load(std::vector<AnalyzeSet> & results)
 {
+  MemoryTracker::Scope scope(MemoryTracker::results);
   std::ifstream ifs("file.txt", std::ofstream::binary);
   boost::archive::text_iarchive ia(ifs);
   ia>>results;
 }
 
-void calcAndSave(TaskData taskDataOrig, std::vector<AnalyzeSet> & results)
+/// Result of one model, saved as soon as the model is fitted.
+/// Task size and params count identify the task
+struct ModelResult
 {
-  std::vector<std::string> names{"QOil1", "QOil2", "QOil4", "QWater1", "QWater2"};
-  std::vector<std::unique_ptr<IRegressionModel>> models;
+  AnalyzeSet result;
+  size_t taskSize = 0;
+  size_t nParams = 0;
   
-  models.push_back(std::make_unique<RegressionModelLn1>(taskDataOrig));
-  models.push_back(std::make_unique<RegressionModelLn3>(taskDataOrig));
-  models.push_back(std::make_unique<RegressionModelLn4>(taskDataOrig));
-  TaskDataHelper::SwapOilWater(taskDataOrig);
-  models.push_back(std::make_unique<RegressionModelLn1>(taskDataOrig));
-  models.push_back(std::make_unique<RegressionModelLn2>(taskDataOrig));
+  template <typename Archive>
+  void serialize(Archive &ar, const unsigned int)
+  {
+    ar & result;
+    ar & taskSize;
+    ar & nParams;
+  }
+};
+
+std::string modelResultFile(const std::string & name)
+{
+  return name + "_result.bin";
+}
+
+bool loadModelResult(const std::string & name, const IRegressionModel & model, AnalyzeSet & result)
+{
+  std::ifstream ifs(modelResultFile(name), std::ifstream::binary);
+  if(!ifs)
+    return false;
+  MemoryTracker::Scope scope(MemoryTracker::results);
+  ModelResult saved;
+  boost::archive::binary_iarchive ia(ifs);
+  ia>>saved;
+  if(saved.result.name != name)
+    return false;
+  if(saved.taskSize != model.GetTaskSize() || saved.nParams != model.GetParamsCount()
+    || size_t(saved.result.params.size()) != saved.nParams)
+    throw std::invalid_argument("Result does not match task: " + modelResultFile(name));
+  result = std::move(saved.result);
+  return true;
+}
+
+void saveModelResult(const AnalyzeSet & result, const IRegressionModel & model)
+{
+  ModelResult saved;
+  saved.result = result;
+  saved.taskSize = model.GetTaskSize();
+  saved.nParams = model.GetParamsCount();
+  std::ofstream ofs(modelResultFile(result.name), std::ofstream::binary);
+  boost::archive::binary_oarchive oa(ofs);
+  oa<<saved;
+}
+
+/// Model of own copies of task data, accounted to their categories
+std::unique_ptr<IRegressionModel> makeModel(const ModelFamily & family, const TaskData & taskData, const OptimizedTaskData & oTD)
+{
+  TaskData taskDataCopy;
+  OptimizedTaskData oTDCopy;
+  {
+    MemoryTracker::Scope scope(MemoryTracker::taskData);
+    taskDataCopy = taskData;
+  }
+  {
+    MemoryTracker::Scope scope(MemoryTracker::optimizedTaskData);
+    oTDCopy = oTD;
+  }
+  return family.makeModel(std::move(taskDataCopy), std::move(oTDCopy));
+}
+
+std::vector<AnalyzeSet> Analyzer::Calc(const ImportedData & data, const std::vector<ModelSpec> & specs, bool isResume, const FittedFunc & onFitted) const
+{
+  std::vector<AnalyzeSet> results;
+  // models are set up from already optimized task data by separate thread,
+  // next model is ready when previous one is fitted
+  BoundedQueue<std::unique_ptr<IRegressionModel>> models(1);
+  std::exception_ptr setupError;
+  std::thread setup([&data, &specs, &models, &setupError]()
+  {
+    try
+    {
+      // water task data is made for the first water model only
+      TaskData taskDataWater;
+      bool isWaterReady = false;
+      for(const ModelSpec & spec: specs)
+      {
+        const ModelFamily & family = ModelRegistry::GetFamily(spec.family);
+        if(spec.isWater && !isWaterReady)
+        {
+          MemoryTracker::Scope scope(MemoryTracker::taskData);
+          taskDataWater = data.taskData;
+          TaskDataHelper::SwapOilWater(taskDataWater);
+          isWaterReady = true;
+        }
+        if(spec.isWater)
+          models.Push(makeModel(family, taskDataWater, data.water));
+        else
+          models.Push(makeModel(family, data.taskData, data.oil));
+      }
+    }
+    catch(...)
+    {
+      setupError = std::current_exception();
+    }
+    models.Close();
+  });
   
   Solver::SolverParams sp;
   sp.verbose = 2;
   sp.enableNormalizer = true;
   sp.nMaxIter = 25;
+  sp.checkpointInterval = 5;
+  auto workspace = std::make_shared<SolverWorkspace>();
   try
   {
-    for(size_t i=0; i<models.size(); ++i)
+    std::unique_ptr<IRegressionModel> model;
+    for(size_t i=0; models.Pop(model); ++i)
     {
       std::cout<<i<<std::endl;
-      Solver solver(std::move(models[i]));
-      solver.SolverInit(sp);
+      AnalyzeSet result;
+      if(isResume && loadModelResult(specs[i].name, *model, result))
+      {
+        std::cout<<"loaded "<<specs[i].name<<std::endl;
+        MemoryTracker::Scope scope(MemoryTracker::results);
+        results.push_back(result);
+        if(onFitted)
+          onFitted(results.back());
+        continue;
+      }
+      Solver solver(std::move(model), workspace);
+      sp.checkpointFile = specs[i].name + "_checkpoint.bin";
+      sp.nBreakpointCandidates = specs[i].nBreakpointCandidates;
+      if(isResume)
+        solver.SolverResume(sp);
+      else
+        solver.SolverInit(sp);
       if(!solver.Solve())
         //throw std::logic_error("Can' solve");
         std::cout<<"not solved"<<std::endl;
-      results.push_back({solver.GetResult(), names[i], solver.GetWorkingSet().yMinusF});
+      {
+        MemoryTracker::Scope scope(MemoryTracker::results);
+        results.push_back({solver.GetResult(), specs[i].name, solver.GetYMinusF()});
+      }
+      saveModelResult(results.back(), solver.GetModel());
+      MemoryTracker::Report(std::cout, specs[i].name);
+      MemoryTracker::ResetPeaks();
+      if(onFitted)
+        onFitted(results.back());
     }
   }
-  catch(std::logic_error &e)
+  catch(...)
   {
-    std::cout<<e.what()<<std::endl;
+    // unblock setup thread before rethrow
+    models.Close();
+    setup.join();
+    throw;
   }
+  models.Close();
+  setup.join();
+  // models after failed one are missing
+  if(setupError)
+    std::rethrow_exception(setupError);
   
   std::cout<<"Analyze calculation is finished"<<std::endl;
+  return results;
+}
+
+void save(const std::vector<AnalyzeSet> & results)
+{
+  std::cout<<"Writing data to file"<<std::endl;//TODO: read data Q(t)
   
-  {
-    std::cout<<"Writing data to file"<<std::endl;//TODO: read data Q(t)
-    
-    std::ofstream ofs("file.txt", std::ofstream::binary);
-    boost::archive::text_oarchive oa(ofs);
-    oa<<results;
-  }
+  std::ofstream ofs("file.txt", std::ofstream::binary);
+  boost::archive::text_oarchive oa(ofs);
+  oa<<results;
 }
 
 typedef std::vector<double> dvec;
 
-void Analyzer::Analyze(const std::string & filename)
+void Analyzer::Analyze(const std::string & filename, const std::vector<ModelSpec> & models, bool isResume)
 {
   
-  CSVDataImporter dataImporter;
-  TaskData taskDataOrig = dataImporter.read(filename);
-  OptimizedTaskData oTD(taskDataOrig);
+  // holes are grouped and optimized while the file is being read
+  const ImportedData data = ImportPipeline().Import(filename);
+  MemoryTracker::Report(std::cout, "import");
+  MemoryTracker::ResetPeaks();
+  const TaskData & taskDataOrig = data.taskData;
+  const OptimizedTaskData & oTD = data.oil;
 
   std::vector<AnalyzeSet> results;
   bool isSuccessffullRead = false;
   try
   {
     load(results);
-    isSuccessffullRead = true;
+    // saved results are of the same models
+    isSuccessffullRead = results.size() == models.size();
+    for(size_t i = 0; i<results.size() && isSuccessffullRead; ++i)
+      isSuccessffullRead = results[i].name == models[i].name;
   }
   catch(std::exception &e)
   {
@@ -108,7 +239,11 @@ void Analyzer::Analyze(const std::string & filename)
   }
   if(!isSuccessffullRead)
   {
-    calcAndSave(taskDataOrig, results);
+    results = Calc(data, models, isResume);
+    save(results);
+    // results of models are needed by resume of interrupted Calc only
+    for(const ModelSpec & model: models)
+      std::remove(modelResultFile(model.name).c_str());
   }
 
   // get timeVec and maxT
@@ -124,31 +259,47 @@ void Analyzer::Analyze(const std::string & filename)
     time.push_back(i*tStep);
   
   
-  auto drawFunc = [&time](auto func, Eigen::VectorXd params,  std::string name){
+  auto drawFunc = [&time](const ModelFamily & family, Eigen::VectorXd params,  std::string name){
     std::cout<<params.transpose()<<std::endl;
     Gnuplot gp;
     gp<<"set terminal postscript eps enhanced color font 'Helvetica,10'"<<std::endl;
     gp<<"set output '"<<name<<".ps'"<<std::endl;
     dvec val;
     for(size_t i=0; i<time.size(); ++i)
-      val.push_back(func(params, time[i]));
+      val.push_back(family.calcFT(params, time[i]));
     gp << "plot '-' tit '"<<name<<"'"<<std::endl;
     gp.send1d(boost::make_tuple(time, val));
   };
 
-  drawFunc(Function1::CalcFT, results[0].params.tail(Function1::nParams), std::string("func_")+results[0].name);
-  drawFunc(Function2::CalcFT, results[1].params.tail(Function2::nParams), std::string("func_")+results[1].name);
-  drawFunc(Function4::CalcFT, results[2].params.tail(Function4::nParams), std::string("func_")+results[2].name);
-  drawFunc(Function1::CalcFT, results[3].params.tail(Function1::nParams), std::string("func_")+results[3].name);
-  drawFunc(Function2::CalcFT, results[4].params.tail(Function2::nParams), std::string("func_")+results[4].name);
+  for(size_t i = 0; i<results.size(); ++i)
+  {
+    const ModelFamily & family = ModelRegistry::GetFamily(models[i].family);
+    drawFunc(family, results[i].params.tail(family.nFuncParams), std::string("func_")+results[i].name);
+  }
 
   auto saveToCSV = [](const auto & arr, std::string name){
     std::ofstream ofs(name);
-    for(size_t i = 0; i< arr.size(); ++i)
+    for(size_t i = 0; i< size_t(arr.size()); ++i)
       ofs<<arr[i]<<","<<std::endl;
   };
   
 
+  // forecast for 10 years of full time work
+  std::vector<double> tEnds;
+  std::vector<std::string> holeNames;
+  for(const HoleData & hole: taskDataOrig.holes)
+  {
+    tEnds.push_back(std::accumulate(hole.ts.begin(), hole.ts.end(), 0.0));
+    holeNames.push_back(hole.name);
+  }
+  const Eigen::VectorXd horizon = MonthlyHorizon(120);
+  for(size_t i = 0; i<results.size(); ++i)
+  {
+    Forecast forecast;
+    ModelRegistry::GetFamily(models[i].family).calcForecast(results[i].params, tEnds, horizon, forecast);
+    WriteForecast(forecast, holeNames, results[i].name + "_forecast.bin");
+  }
+
   for(const AnalyzeSet & result: results)
   {
     std::ofstream ofs(result.name + "_params.txt");
@@ -156,5 +307,19 @@ void Analyzer::Analyze(const std::string & filename)
     saveToCSV(result.delta, std::string("delta_") + result.name +".csv");
   }
   
-  
+  // residual distributions: sums of two distributions with weights.
+  // Rows excluded from fit have exactly zero residual and are skipped
+  const MixtureFitter mixtureFitter;
+  for(const AnalyzeSet & result: results)
+  {
+    std::vector<double> delta;
+    for(Eigen::Index i = 0; i<result.delta.size(); ++i)
+      if(result.delta[i] != 0.0)
+        delta.push_back(result.delta[i]);
+    const Eigen::Map<const Eigen::VectorXd> deltaVec(delta.data(), delta.size());
+    std::ofstream ofs(result.name + "_mixture.txt");
+    mixtureFitter.Fit(deltaVec, 2, Mixture::Gaussian).Write(ofs);
+    mixtureFitter.Fit(deltaVec, 2, Mixture::Logistic).Write(ofs);
+  }
+  MemoryTracker::Report(std::cout, "output");
 };
\ No newline at end of file
@@ -1,11 +1,44 @@
 #ifndef ANALYZE_H
 #define ANALYZE_H
 #include <string>
+#include <vector>
+#include <functional>
+#include <Eigen/Dense>
+#include "modelregistry.h"
+
+struct ImportedData;
+
+/// Fitted model: params and y-f of all rows
+struct AnalyzeSet
+{
+  Eigen::VectorXd params;
+  std::string name;
+  Eigen::VectorXd delta;
+  template <typename Archive>
+  void serialize(Archive &ar, const unsigned int)
+  {
+    ar & params;
+    ar & name;
+    ar & delta;
+  }
+};
 
 class Analyzer
 {
 public:
-  void Analyze(const std::string & filename);
+  typedef std::function<void(const AnalyzeSet &)> FittedFunc;
+
+  /// Fits, plots and forecasts models.
+  /// With isResume models fitted by previous run are loaded and
+  /// interrupted fits continue from their checkpoints
+  void Analyze(const std::string & filename, const std::vector<ModelSpec> & models = ModelRegistry::GetDefaultModels(), bool isResume = false);
+
+  /// Fits models in their order.
+  /// Each result is saved to <name>_result.bin as soon as it is fitted
+  /// and passed to onFitted. Resume loads these files and throws
+  /// invalid_argument if one is of other task. Analyze removes them when
+  /// all results are saved
+  std::vector<AnalyzeSet> Calc(const ImportedData & data, const std::vector<ModelSpec> & models = ModelRegistry::GetDefaultModels(), bool isResume = false, const FittedFunc & onFitted = FittedFunc()) const;
 };
 
 #endif // ANALYZE_H
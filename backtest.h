@@ -0,0 +1,114 @@
+#ifndef BACKTEST_H
+#define BACKTEST_H
+
+#include "rollingwindow.h"
+#include <cmath>
+#include <limits>
+
+/// Hindcast: model is fitted on first cutoff months of every hole and
+/// its forecast is scored on next horizonRows months
+struct BacktestParams
+{
+  BacktestParams()
+  : firstCutoff(12)
+  , stepCutoff(12)
+  , horizonRows(12)
+  , nChains(0)
+  {
+    sp.variableProjection = true;
+    sp.keepYMinusF = false;
+    sp.nMaxIter = 100;
+    // short fits of Function3 and Function4 diverge from default params
+    sp.nStartCandidates = 16;
+  }
+  size_t firstCutoff;
+  size_t stepCutoff;
+  size_t horizonRows;
+  /// 0 - number of OpenMP threads
+  size_t nChains;
+  Solver::SolverParams sp;
+};
+
+struct BacktestResult
+{
+  /// Fitted months of every cutoff
+  std::vector<size_t> cutoffs;
+  std::vector<bool> isConverged;
+  /// Scored rows are nonzero rows of holes with nonzero fitted rows
+  std::vector<size_t> nScoredRows;
+  /// RMSE of forecast of ln(q/t) of every cutoff
+  std::vector<double> rmse;
+  /// Mean of ln(q/t) minus its forecast, positive when forecast is low
+  std::vector<double> bias;
+  /// RMSE over scored rows of all converged cutoffs
+  double totalRmse = 0.0;
+};
+
+/// Backtest of model of TFunc over all cutoffs below the longest hole.
+/// Cutoffs are fitted by parallel chains with warm starts
+template<class TFunc>
+BacktestResult Backtest(const TaskDataView& view, const BacktestParams& bp)
+{
+  if(bp.firstCutoff == 0 || bp.stepCutoff == 0 || bp.horizonRows == 0)
+    throw std::invalid_argument("Empty backtest window");
+  typedef HoleKernels<TFunc, HandDiff<TFunc>> Kernels;
+  BacktestResult result;
+  std::vector<TaskDataView> fits;
+  for(size_t cutoff = bp.firstCutoff; cutoff<view.GetMaxRows(); cutoff += bp.stepCutoff)
+  {
+    result.cutoffs.push_back(cutoff);
+    fits.push_back(view.Window(0, cutoff));
+  }
+  const size_t nCutoffs = result.cutoffs.size();
+  std::vector<char> isConverged(nCutoffs);
+  std::vector<double> sumSq(nCutoffs, 0.0);
+  std::vector<double> sum(nCutoffs, 0.0);
+  result.nScoredRows.assign(nCutoffs, 0);
+  
+  FitViewChains<TFunc>(fits, bp.sp, bp.nChains,
+    [&](size_t k, const Eigen::VectorXd& params, bool isConvergedK)
+    {
+      isConverged[k] = isConvergedK;
+      if(!isConvergedK)
+        return;
+      const TaskDataView horizon = view.Window(result.cutoffs[k], bp.horizonRows);
+      const typename TFunc::VParams funcParams = params.tail(TFunc::nParams);
+      std::vector<double> yMinusF;
+      for(size_t i = 0; i<horizon.GetHolesCount(); ++i)
+      {
+        const HoleView fitted = fits[k].GetHole(i);
+        bool isFitted = false;
+        for(size_t j = 0; j<fitted.qDivT.size() && !isFitted; ++j)
+          isFitted = std::abs(fitted.qDivT[j]) > 0;
+        const HoleView hole = horizon.GetHole(i);
+        if(!isFitted || hole.qDivT.empty())
+          continue;
+        yMinusF.resize(hole.qDivT.size());
+        Kernels::CalcResidual(hole, params[i], funcParams, yMinusF.data());
+        for(size_t j = 0; j<yMinusF.size(); ++j)
+        {
+          if(!(std::abs(hole.qDivT[j]) > 0))
+            continue;
+          sum[k] += yMinusF[j];
+          sumSq[k] += yMinusF[j]*yMinusF[j];
+          ++result.nScoredRows[k];
+        }
+      }
+    });
+  
+  double totalSumSq = 0.0;
+  size_t nTotalRows = 0;
+  for(size_t k = 0; k<nCutoffs; ++k)
+  {
+    const size_t n = result.nScoredRows[k];
+    result.rmse.push_back(n > 0 ? std::sqrt(sumSq[k]/n) : std::numeric_limits<double>::quiet_NaN());
+    result.bias.push_back(n > 0 ? sum[k]/n : std::numeric_limits<double>::quiet_NaN());
+    totalSumSq += sumSq[k];
+    nTotalRows += n;
+  }
+  result.totalRmse = nTotalRows > 0 ? std::sqrt(totalSumSq/nTotalRows) : std::numeric_limits<double>::quiet_NaN();
+  result.isConverged.assign(isConverged.begin(), isConverged.end());
+  return result;
+}
+
+#endif // BACKTEST_H
@@ -0,0 +1,123 @@
+#include "bootstrap.h"
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <exception>
+
+Bootstrap::BootstrapResult Bootstrap::Run(const Solver& solver, const Bootstrap::BootstrapParams& bp)
+{
+  const IRegressionModel& model = solver.GetModel();
+  const Eigen::VectorXd params = solver.GetResult();
+  Eigen::VectorXd yMinusF = solver.GetYMinusF();
+  if(yMinusF.size() == 0)
+    model.CalcResidual(params, yMinusF);
+  const Eigen::VectorXd lnY = model.GetTarget();
+  if(lnY.size() != yMinusF.size())
+    throw std::invalid_argument("Residuals do not match task size");
+  // residuals of fitted rows are resampled, fitted values stay
+  std::vector<double> residuals;
+  for(Eigen::Index i = 0; i<lnY.size(); ++i)
+    if(!std::isnan(lnY[i]))
+      residuals.push_back(yMinusF[i]);
+  if(residuals.empty())
+    throw std::invalid_argument("Empty task data");
+  const Eigen::VectorXd lnYFitted = lnY - yMinusF;
+  
+  // replicates start from converged params, so their linear systems have
+  // the same sizes as the converged one and reuse its buffers
+  const SolverWorkspace& converged = solver.GetWorkspace();
+  SolverWorkspace seed;
+  if(bp.sp.matrixFree || bp.sp.variableProjection)
+  {
+    seed.ne = converged.ne;
+    seed.S = converged.S;
+    seed.r = converged.r;
+    seed.deltaF = converged.deltaF;
+  }
+  else
+  {
+    seed.A = converged.A;
+    seed.b = converged.b;
+    seed.jBlock = converged.jBlock;
+    seed.yBlock = converged.yBlock;
+  }
+  seed.ldlt = converged.ldlt;
+  seed.delta = converged.delta;
+  
+  const size_t nParams = params.size();
+  Eigen::MatrixXd replicates(nParams, bp.nReplicates);
+  std::vector<char> isConverged(bp.nReplicates, 0);
+  std::exception_ptr error;
+  #pragma omp parallel
+  {
+    // model copy shares task data, so thread owns only its target,
+    // working set and workspace
+    std::unique_ptr<Solver> threadSolver;
+    IRegressionModel* threadModel = nullptr;
+    Eigen::VectorXd lnYReplicate;
+    std::uniform_int_distribution<size_t> iResidual(0, residuals.size()-1);
+    #pragma omp for schedule(dynamic)
+    for(size_t r = 0; r<bp.nReplicates; ++r)
+    {
+      try
+      {
+        if(!threadSolver)
+        {
+          std::unique_ptr<IRegressionModel> threadModelPtr = model.Clone();
+          threadModel = threadModelPtr.get();
+          threadSolver = std::make_unique<Solver>(std::move(threadModelPtr), std::make_shared<SolverWorkspace>(seed));
+          lnYReplicate.resize(lnY.size());
+        }
+        std::seed_seq seq{bp.seed, static_cast<unsigned int>(r)};
+        std::mt19937 gen(seq);
+        for(Eigen::Index i = 0; i<lnY.size(); ++i)
+          lnYReplicate[i] = std::isnan(lnY[i]) ? lnY[i] : lnYFitted[i] + residuals[iResidual(gen)];
+        threadModel->SetTarget(lnYReplicate);
+        threadSolver->SolverInit(bp.sp, params);
+        isConverged[r] = threadSolver->Solve() && threadSolver->GetResult().allFinite();
+        replicates.col(r) = threadSolver->GetResult();
+      }
+      catch(...)
+      {
+        #pragma omp critical
+        error = std::current_exception();
+      }
+    }
+  }
+  if(error)
+    std::rethrow_exception(error);
+  
+  BootstrapResult result;
+  const size_t nConverged = std::count(isConverged.begin(), isConverged.end(), 1);
+  result.replicates.resize(nParams, nConverged);
+  for(size_t r = 0, iCol = 0; r<bp.nReplicates; ++r)
+    if(isConverged[r])
+      result.replicates.col(iCol++) = replicates.col(r);
+  
+  result.lower.resize(nParams);
+  result.upper.resize(nParams);
+  if(nConverged == 0)
+  {
+    result.lower.setConstant(std::numeric_limits<double>::quiet_NaN());
+    result.upper.setConstant(std::numeric_limits<double>::quiet_NaN());
+    return result;
+  }
+  // percentiles with linear interpolation between order statistics
+  auto percentile = [nConverged](const std::vector<double>& sorted, double p)
+  {
+    const double pos = p*(nConverged-1);
+    const size_t iLow = std::floor(pos);
+    const size_t iHigh = std::min(iLow+1, nConverged-1);
+    return sorted[iLow] + (pos-iLow)*(sorted[iHigh]-sorted[iLow]);
+  };
+  std::vector<double> vals(nConverged);
+  for(size_t iParam = 0; iParam<nParams; ++iParam)
+  {
+    for(size_t r = 0; r<nConverged; ++r)
+      vals[r] = result.replicates(iParam, r);
+    std::sort(vals.begin(), vals.end());
+    result.lower[iParam] = percentile(vals, (1.0-bp.confidence)/2);
+    result.upper[iParam] = percentile(vals, (1.0+bp.confidence)/2);
+  }
+  return result;
+}
@@ -0,0 +1,48 @@
+#ifndef BOOTSTRAP_H
+#define BOOTSTRAP_H
+
+#include "solver.h"
+
+/// Residual bootstrap of fitted regression model.
+/// Every replicate refits the model on fitted values plus residuals
+/// resampled with replacement, starting from the converged params
+class Bootstrap
+{
+public:
+  struct BootstrapParams
+  {
+    BootstrapParams()
+    : nReplicates(200)
+    , confidence(0.9)
+    , seed(12345)
+    {
+      sp.matrixFree = true;
+      sp.keepYMinusF = false;
+    }
+    size_t nReplicates;
+    /// Probability covered by percentile intervals
+    double confidence;
+    /// Replicate r draws from its own stream seeded by (seed, r),
+    /// so result does not depend on number of threads
+    unsigned int seed;
+    /// Params of replicate solves
+    Solver::SolverParams sp;
+  };
+  
+  struct BootstrapResult
+  {
+    /// Percentile interval of every param
+    Eigen::VectorXd lower;
+    Eigen::VectorXd upper;
+    /// Params of every converged replicate by columns
+    Eigen::MatrixXd replicates;
+  };
+  
+  /// Bootstrap of converged solve of solver. Replicates run in parallel,
+  /// every thread has a model copy sharing task data with own target only
+  /// and a workspace seeded by buffers of the converged solve, both reused
+  /// by all its replicates. Error of any replicate is rethrown
+  static BootstrapResult Run(const Solver & solver, const BootstrapParams & bp = BootstrapParams());
+};
+
+#endif // BOOTSTRAP_H
@@ -0,0 +1,61 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/// Queue between pipeline stages. Push blocks while queue is full,
+/// so fast producer can't run ahead of consumer by more than capacity
+template<class T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(size_t capacity)
+  : _capacity(capacity > 0 ? capacity : 1)
+  {
+  }
+  
+  void Push(T val)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _notFull.wait(lock, [this](){return _queue.size() < _capacity || _isClosed;});
+    if(_isClosed)
+      return;
+    _queue.push_back(std::move(val));
+    _notEmpty.notify_one();
+  }
+  
+  /// Waits for value. Returns false if queue is closed and empty
+  bool Pop(T & val)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _notEmpty.wait(lock, [this](){return !_queue.empty() || _isClosed;});
+    if(_queue.empty())
+      return false;
+    val = std::move(_queue.front());
+    _queue.pop_front();
+    _notFull.notify_one();
+    return true;
+  }
+  
+  /// No more values: consumer gets the rest, then Pop returns false.
+  /// Values pushed after close are dropped
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _isClosed = true;
+    _notEmpty.notify_all();
+    _notFull.notify_all();
+  }
+  
+private:
+  const size_t _capacity;
+  bool _isClosed = false;
+  std::deque<T> _queue;
+  std::mutex _mutex;
+  std::condition_variable _notEmpty;
+  std::condition_variable _notFull;
+};
+
+#endif // BOUNDEDQUEUE_H
@@ -0,0 +1,293 @@
+#include "compacttaskdata.h"
+#include "memorytracker.h"
+#include "dataimporter.h"
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+static const char compactFileMagic[8] = {'G', 'P', 'C', 'M', 'P', 'C', 'T', '1'};
+
+template<class T>
+static void writeValue(std::ostream & os, const T & val)
+{
+  os.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template<class T>
+static void readValue(std::istream & is, T & val)
+{
+  is.read(reinterpret_cast<char*>(&val), sizeof(T));
+}
+
+PackedColumn PackedColumn::Pack(const std::vector<double>& values, std::vector<uint64_t>& words)
+{
+  PackedColumn column;
+  column.iFirstWord = words.size();
+  if(values.empty())
+    return column;
+  // packed values are integers below 2^32 above base
+  const double maxPacked = 4294967295.0;
+  const double maxBase = 9007199254740992.0;
+  const size_t n = values.size();
+  const auto minMax = std::minmax_element(values.begin(), values.end());
+  const double vMin = *minMax.first;
+  const double vMax = *minMax.second;
+  bool isPacked = std::abs(vMin) < maxBase && vMax - vMin <= maxPacked;
+  for(size_t j = 0; j<n && isPacked; ++j)
+    isPacked = values[j] == std::floor(values[j]);
+  if(!isPacked)
+  {
+    column.width = 64;
+    words.resize(column.iFirstWord + n);
+    std::memcpy(&words[column.iFirstWord], values.data(), n*sizeof(double));
+    return column;
+  }
+  column.base = int64_t(vMin);
+  const uint64_t range = uint64_t(vMax - vMin);
+  while((range>>column.width) > 0)
+    ++column.width;
+  if(column.width == 0)
+    return column;
+  words.resize(column.iFirstWord + (n*column.width + 63)/64, 0);
+  uint64_t* packed = &words[column.iFirstWord];
+  for(size_t j = 0; j<n; ++j)
+  {
+    const uint64_t val = uint64_t(int64_t(values[j]) - column.base);
+    const size_t bit = j*column.width;
+    const size_t iWord = bit>>6;
+    const size_t shift = bit&63;
+    packed[iWord] |= val<<shift;
+    if(shift + column.width > 64)
+      packed[iWord+1] |= val>>(64 - shift);
+  }
+  return column;
+}
+
+CompactTaskData::CompactTaskData(const TaskData& taskData)
+{
+  std::vector<int64_t> months;
+  for(const HoleData & hole: taskData.holes)
+  {
+    months.resize(hole.ts.size());
+    for(size_t j = 0; j<months.size(); ++j)
+      months[j] = j;
+    AddHole(hole, months);
+  }
+}
+
+void CompactTaskData::AddHole(const HoleData& hole, const std::vector<int64_t>& months)
+{
+  const size_t n = hole.ts.size();
+  if(months.size() != n || hole.qOils.size() != n || (!hole.qWaters.empty() && hole.qWaters.size() != n))
+    throw std::invalid_argument("Wrong rows of hole " + hole.name);
+  if(n > std::numeric_limits<uint32_t>::max())
+    throw std::invalid_argument("Too many rows of hole " + hole.name);
+  CompactHoleData compact;
+  compact.name = hole.name;
+  compact.nRows = n;
+  std::vector<double> deltas(n);
+  for(size_t j = 0; j<n; ++j)
+    deltas[j] = j > 0 ? double(months[j] - months[j-1]) : 0.0;
+  if(n > 0)
+  {
+    compact.firstMonth = months[0];
+    // the first delta is the same as others, so equal deltas take no bits
+    deltas[0] = n > 1 ? deltas[1] : 1.0;
+  }
+  compact.columns[CompactHoleData::monthDeltas] = PackedColumn::Pack(deltas, compact.words);
+  compact.columns[CompactHoleData::hours] = PackedColumn::Pack(hole.ts, compact.words);
+  compact.columns[CompactHoleData::oil] = PackedColumn::Pack(hole.qOils, compact.words);
+  compact.columns[CompactHoleData::water] = PackedColumn::Pack(hole.qWaters.empty() ? std::vector<double>(n, 0.0) : hole.qWaters, compact.words);
+  compact.words.shrink_to_fit();
+  _holes.push_back(std::move(compact));
+}
+
+HoleData CompactTaskData::GetHole(size_t i) const
+{
+  const CompactHoleData & compact = _holes.at(i);
+  HoleData hole;
+  hole.name = compact.name;
+  compact.Decode(CompactHoleData::hours, hole.ts);
+  compact.Decode(CompactHoleData::oil, hole.qOils);
+  compact.Decode(CompactHoleData::water, hole.qWaters);
+  return hole;
+}
+
+std::vector<int64_t> CompactTaskData::GetMonths(size_t i) const
+{
+  const CompactHoleData & compact = _holes.at(i);
+  std::vector<int64_t> months(compact.nRows);
+  for(size_t j = 0; j<months.size(); ++j)
+    months[j] = j > 0 ? months[j-1] + int64_t(compact.Get(CompactHoleData::monthDeltas, j)) : compact.firstMonth;
+  return months;
+}
+
+TaskData CompactTaskData::ToTaskData() const
+{
+  MemoryTracker::Scope scope(MemoryTracker::taskData);
+  TaskData taskData;
+  taskData.holes.reserve(_holes.size());
+  for(size_t i = 0; i<_holes.size(); ++i)
+    taskData.holes.push_back(GetHole(i));
+  return taskData;
+}
+
+OptimizedTaskData CompactTaskData::ToOptimized(bool isWater) const
+{
+  MemoryTracker::Scope scope(MemoryTracker::optimizedTaskData);
+  OptimizedTaskData oTD;
+  oTD.holes.resize(_holes.size());
+  #pragma omp parallel for schedule(dynamic, 16)
+  for(size_t i = 0; i<_holes.size(); ++i)
+  {
+    const CompactHoleData & compact = _holes[i];
+    const CompactHoleData::Column q = isWater ? CompactHoleData::water : CompactHoleData::oil;
+    OptimizedHoleData & hole = oTD.holes[i];
+    hole.sumT.reserve(compact.nRows);
+    hole.qDivT.reserve(compact.nRows);
+    for(size_t j = 0; j<compact.nRows; ++j)
+      hole.Append(compact.Get(CompactHoleData::hours, j), compact.Get(q, j));
+  }
+  return oTD;
+}
+
+size_t CompactTaskData::GetBytes() const
+{
+  size_t nBytes = _holes.capacity()*sizeof(CompactHoleData);
+  for(const CompactHoleData & hole: _holes)
+  {
+    nBytes += hole.words.capacity()*sizeof(uint64_t);
+    // short names are kept inside of string
+    if(hole.name.capacity() >= sizeof(std::string))
+      nBytes += hole.name.capacity() + 1;
+  }
+  return nBytes;
+}
+
+CompactTaskData CompactTaskData::ReadCSV(const std::string& csvFilename)
+{
+  std::ifstream f(csvFilename);
+  if(!f)
+    throw std::invalid_argument("Can't open " + csvFilename);
+  MemoryTracker::Scope scope(MemoryTracker::taskData);
+  TaskData taskData;
+  std::vector<std::vector<int64_t>> months;
+  std::map<std::string, size_t> holeNamesToIndex;
+  std::string lineStr;
+  CSVDataImporter::LineData lineData;
+  while(std::getline(f, lineStr))
+  {
+    if(!CSVDataImporter::ParseLine(lineStr, lineData))
+      continue;
+    auto it = holeNamesToIndex.find(lineData.holeName);
+    if(it == holeNamesToIndex.end())
+    {
+      it = holeNamesToIndex.emplace(lineData.holeName, taskData.holes.size()).first;
+      taskData.holes.emplace_back();
+      taskData.holes.back().name = lineData.holeName;
+      months.emplace_back();
+    }
+    HoleData & hole = taskData.holes[it->second];
+    hole.ts.push_back(lineData.workHours);
+    hole.qOils.push_back(lineData.oilTons);
+    hole.qWaters.push_back(lineData.waterTons);
+    months[it->second].push_back(lineData.time);
+  }
+  CompactTaskData data;
+  data._holes.reserve(taskData.holes.size());
+  for(size_t i = 0; i<taskData.holes.size(); ++i)
+  {
+    data.AddHole(taskData.holes[i], months[i]);
+    // raw rows are released as soon as they are packed
+    taskData.holes[i] = HoleData();
+    months[i] = std::vector<int64_t>();
+  }
+  return data;
+}
+
+void CompactTaskData::Write(const std::string& filename) const
+{
+  std::ofstream out(filename, std::ios::binary);
+  if(!out)
+    throw std::invalid_argument("Can't create " + filename);
+  out.write(compactFileMagic, sizeof(compactFileMagic));
+  writeValue(out, uint64_t(_holes.size()));
+  for(const CompactHoleData & hole: _holes)
+  {
+    writeValue(out, uint32_t(hole.name.size()));
+    out.write(hole.name.data(), hole.name.size());
+    writeValue(out, hole.firstMonth);
+    writeValue(out, hole.nRows);
+    for(const PackedColumn & column: hole.columns)
+    {
+      writeValue(out, column.base);
+      writeValue(out, column.width);
+    }
+    writeValue(out, uint64_t(hole.words.size()));
+    out.write(reinterpret_cast<const char*>(hole.words.data()), hole.words.size()*sizeof(uint64_t));
+  }
+  if(!out)
+    throw std::runtime_error("Can't write " + filename);
+}
+
+CompactTaskData CompactTaskData::Read(const std::string& filename)
+{
+  std::ifstream f(filename, std::ios::binary | std::ios::ate);
+  if(!f)
+    throw std::invalid_argument("Can't open " + filename);
+  const uint64_t fileSize = f.tellg();
+  f.seekg(0);
+  char magic[sizeof(compactFileMagic)];
+  f.read(magic, sizeof(magic));
+  if(!f || !std::equal(magic, magic + sizeof(magic), compactFileMagic))
+    throw std::invalid_argument("Not a compact task data file: " + filename);
+  // sizes are checked against the rest of file before allocation. Every
+  // hole has name size, first month, rows count, columns and words count
+  const uint64_t holeBytes = sizeof(uint32_t) + sizeof(int64_t) + sizeof(uint32_t)
+    + CompactHoleData::nColumns*(sizeof(int64_t) + sizeof(uint8_t)) + sizeof(uint64_t);
+  auto restBytes = [&f, fileSize]()
+  {
+    return fileSize - uint64_t(f.tellg());
+  };
+  MemoryTracker::Scope scope(MemoryTracker::taskData);
+  CompactTaskData data;
+  uint64_t nHoles = 0;
+  readValue(f, nHoles);
+  if(!f || nHoles > restBytes()/holeBytes)
+    throw std::invalid_argument("Broken compact task data file: " + filename);
+  data._holes.resize(nHoles);
+  for(CompactHoleData & hole: data._holes)
+  {
+    uint32_t nameSize = 0;
+    readValue(f, nameSize);
+    if(!f || nameSize > restBytes())
+      throw std::invalid_argument("Broken compact task data file: " + filename);
+    hole.name.resize(nameSize);
+    f.read(&hole.name[0], nameSize);
+    readValue(f, hole.firstMonth);
+    readValue(f, hole.nRows);
+    // words of columns follow each other
+    uint64_t nWords = 0;
+    for(PackedColumn & column: hole.columns)
+    {
+      readValue(f, column.base);
+      readValue(f, column.width);
+      if(column.width > 32 && column.width != 64)
+        throw std::invalid_argument("Broken compact task data file: " + filename);
+      column.iFirstWord = nWords;
+      nWords += column.width == 64 ? hole.nRows : (uint64_t(hole.nRows)*column.width + 63)/64;
+    }
+    uint64_t nWordsFile = 0;
+    readValue(f, nWordsFile);
+    if(!f || nWordsFile != nWords || nWords > restBytes()/sizeof(uint64_t))
+      throw std::invalid_argument("Broken compact task data file: " + filename);
+    hole.words.resize(nWords);
+    f.read(reinterpret_cast<char*>(hole.words.data()), nWords*sizeof(uint64_t));
+    if(!f)
+      throw std::invalid_argument("Broken compact task data file: " + filename);
+  }
+  return data;
+}
@@ -0,0 +1,114 @@
+#ifndef COMPACTTASKDATA_H
+#define COMPACTTASKDATA_H
+
+#include "regressionmodels.h"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/// Column of values packed by width bits above base into words of hole.
+/// Integer columns take bits of their range only, equal values take
+/// no bits. Columns with fractional or huge values keep raw doubles
+/// (width 64)
+struct PackedColumn
+{
+  int64_t base = 0;
+  uint8_t width = 0;
+  /// First word of column in words of hole
+  uint32_t iFirstWord = 0;
+  
+  /// Packs values to the end of words
+  static PackedColumn Pack(const std::vector<double> & values, std::vector<uint64_t> & words);
+  
+  double Get(const uint64_t * words, size_t j) const
+  {
+    words += iFirstWord;
+    if(width == 64)
+    {
+      double val;
+      std::memcpy(&val, &words[j], sizeof(val));
+      return val;
+    }
+    if(width == 0)
+      return double(base);
+    const size_t bit = j*width;
+    const size_t iWord = bit>>6;
+    const size_t shift = bit&63;
+    uint64_t val = words[iWord]>>shift;
+    if(shift + width > 64)
+      val |= words[iWord+1]<<(64 - shift);
+    return double(base + int64_t(val & ((uint64_t(1)<<width) - 1)));
+  }
+};
+
+/// Hole of CompactTaskData. Months are stored as deltas from previous
+/// month, all columns share words of the hole
+struct CompactHoleData
+{
+  enum Column
+  {
+    monthDeltas,
+    hours,
+    oil,
+    water,
+    nColumns
+  };
+  std::string name;
+  int64_t firstMonth = 0;
+  uint32_t nRows = 0;
+  PackedColumn columns[nColumns];
+  std::vector<uint64_t> words;
+  
+  double Get(Column column, size_t j) const
+  {
+    return columns[column].Get(words.data(), j);
+  }
+  void Decode(Column column, std::vector<double> & values) const
+  {
+    values.resize(nRows);
+    for(size_t j = 0; j<nRows; ++j)
+      values[j] = Get(column, j);
+  }
+};
+
+/// Raw monthly series in packed form, 3-4 times less than TaskData for
+/// integer CSV data. Holes are decoded on the fly to TaskData or
+/// OptimizedTaskData. File format: magic "GPCMPCT1", uint64 number of
+/// holes, then every hole: name (uint32 size and chars), int64 first
+/// month, uint32 rows, int64 base and uint8 width of month deltas, hours,
+/// oil and water, uint64 number of words and words
+class CompactTaskData
+{
+  std::vector<CompactHoleData> _holes;
+public:
+  CompactTaskData(){};
+  /// Task data has no months, they are 0, 1, ... for every hole
+  explicit CompactTaskData(const TaskData & taskData);
+  
+  /// Adds hole with month of every row
+  void AddHole(const HoleData & hole, const std::vector<int64_t> & months);
+  
+  size_t GetHolesCount() const
+  {
+    return _holes.size();
+  }
+  const CompactHoleData & GetCompactHole(size_t i) const
+  {
+    return _holes[i];
+  }
+  HoleData GetHole(size_t i) const;
+  std::vector<int64_t> GetMonths(size_t i) const;
+  TaskData ToTaskData() const;
+  /// Optimized task data of oil or water, rows are decoded hole by hole
+  OptimizedTaskData ToOptimized(bool isWater) const;
+  /// Memory of holes
+  size_t GetBytes() const;
+  
+  /// Reads CSV of CSVDataImporter, rows of every hole are packed at the end
+  static CompactTaskData ReadCSV(const std::string & csvFilename);
+  void Write(const std::string & filename) const;
+  static CompactTaskData Read(const std::string & filename);
+};
+
+#endif // COMPACTTASKDATA_H
@@ -1,30 +1,197 @@
 #include "dataimporter.h"
-TaskData CSVDataImporter::read(std::__cxx11::string filename)
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <glob.h>
+#include <boost/filesystem.hpp>
+#include "memorytracker.h"
+
+namespace
+{
+/// Row of hole without its name
+struct Row
+{
+  unsigned int time;
+  double workHours;
+  double oilTons;
+  double waterTons;
+};
+
+/// Rows of one file grouped by holes in order of their first line
+struct FileHoles
+{
+  std::vector<std::string> names;
+  std::vector<std::vector<Row>> rows;
+};
+
+FileHoles readFileHoles(const std::string & filename)
+{
+  std::ifstream f(filename, std::ifstream::in);
+  if(!f)
+    throw std::invalid_argument("Can't open " + filename);
+  FileHoles file;
+  std::map<std::string, size_t> holeNamesToIndex;
+  std::string lineStr;
+  CSVDataImporter::LineData lineData;
+  while(std::getline(f, lineStr))
   {
-    TaskData data;
+    if(!CSVDataImporter::ParseLine(lineStr, lineData))
+      continue;
+    auto it = holeNamesToIndex.find(lineData.holeName);
+    if(it == holeNamesToIndex.end())
+    {
+      it = holeNamesToIndex.emplace(lineData.holeName, file.names.size()).first;
+      file.names.push_back(lineData.holeName);
+      file.rows.emplace_back();
+    }
+    file.rows[it->second].push_back(Row{lineData.time, lineData.workHours, lineData.oilTons, lineData.waterTons});
+  }
+  return file;
+}
+
+bool isGlobPattern(const std::string & path)
+{
+  return path.find_first_of("*?[") != std::string::npos;
+}
+}
+
+bool CSVDataImporter::ParseLine(const std::string& lineStr, CSVDataImporter::LineData& lineData)
+  {
+    if(lineStr.size()<4)
+      return false;
+    // TODO: escape stringstream overhead
     std::stringstream ss;
     std::string cell;
+    std::stringstream lineStream(lineStr);
+    lineData = LineData{0};
+    std::getline(lineStream, cell, ',');ss = std::stringstream(cell);
+    ss>>lineData.time;
+    std::getline(lineStream, lineData.holeName, ',');
+    std::getline(lineStream, cell, ',');ss = std::stringstream(cell);
+    ss>>lineData.workHours;
+    std::getline(lineStream, cell, ',');ss = std::stringstream(cell);
+    ss>>lineData.oilTons;
+    std::getline(lineStream, cell, ',');ss = std::stringstream(cell);
+    ss>>lineData.waterTons;
+    return true;
+  }
+
+std::vector<std::string> CSVDataImporter::ListFiles(const std::string& path)
+{
+  std::vector<std::string> filenames;
+  if(boost::filesystem::is_directory(path))
+  {
+    for(const boost::filesystem::directory_entry & entry: boost::filesystem::directory_iterator(path))
+      if(boost::filesystem::is_regular_file(entry.status()) && entry.path().extension() == ".csv")
+        filenames.push_back(entry.path().string());
+    if(filenames.empty())
+      throw std::invalid_argument("No csv files in " + path);
+  }
+  else if(!boost::filesystem::exists(path) && isGlobPattern(path))
+  {
+    glob_t matches;
+    const int result = glob(path.c_str(), 0, nullptr, &matches);
+    if(result == 0)
+      for(size_t i = 0; i<matches.gl_pathc; ++i)
+        filenames.push_back(matches.gl_pathv[i]);
+    globfree(&matches);
+    if(filenames.empty())
+      throw std::invalid_argument("No files match " + path);
+  }
+  else
+    return {path};
+  // glob order depends on locale
+  std::sort(filenames.begin(), filenames.end());
+  return filenames;
+}
+
+TaskData CSVDataImporter::ReadFiles(const std::vector<std::string>& filenames, size_t nThreads)
+{
+  if(nThreads == 0)
+    nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  nThreads = std::min(nThreads, filenames.size());
+  std::vector<FileHoles> files(filenames.size());
+  std::atomic<size_t> iNextFile(0);
+  {
+    std::vector<std::future<void>> readers;
+    for(size_t iThread = 0; iThread<nThreads; ++iThread)
+      readers.push_back(std::async(std::launch::async, [&]()
+      {
+        MemoryTracker::Scope scope(MemoryTracker::taskData);
+        for(size_t iFile = iNextFile++; iFile<files.size(); iFile = iNextFile++)
+          files[iFile] = readFileHoles(filenames[iFile]);
+      }));
+    // rethrows the first error after all readers are finished
+    for(std::future<void> & reader: readers)
+      reader.wait();
+    for(std::future<void> & reader: readers)
+      reader.get();
+  }
+  
+  // merge depends on file order only, not on which reader was faster
+  MemoryTracker::Scope scope(MemoryTracker::taskData);
+  std::vector<std::string> names;
+  std::vector<std::vector<Row>> holeRows;
+  std::map<std::string, size_t> holeNamesToIndex;
+  for(FileHoles & file: files)
+  {
+    for(size_t i = 0; i<file.names.size(); ++i)
+    {
+      auto it = holeNamesToIndex.find(file.names[i]);
+      if(it == holeNamesToIndex.end())
+      {
+        it = holeNamesToIndex.emplace(file.names[i], names.size()).first;
+        names.push_back(file.names[i]);
+        holeRows.emplace_back();
+      }
+      std::vector<Row> & rows = holeRows[it->second];
+      rows.insert(rows.end(), file.rows[i].begin(), file.rows[i].end());
+    }
+    file = FileHoles();
+  }
+  TaskData data;
+  data.holes.resize(names.size());
+  for(size_t iHole = 0; iHole<names.size(); ++iHole)
+  {
+    std::vector<Row> & rows = holeRows[iHole];
+    std::stable_sort(rows.begin(), rows.end(), [](const Row & l, const Row & r){return l.time<r.time;});
+    HoleData & hole = data.holes[iHole];
+    hole.name = names[iHole];
+    hole.ts.reserve(rows.size());
+    hole.qOils.reserve(rows.size());
+    hole.qWaters.reserve(rows.size());
+    for(size_t j = 0; j<rows.size(); ++j)
+    {
+      if(j > 0 && rows[j].time == rows[j-1].time)
+        throw std::invalid_argument("Month " + std::to_string(rows[j].time) + " of hole " + hole.name + " is repeated");
+      hole.ts.push_back(rows[j].workHours);
+      hole.qOils.push_back(rows[j].oilTons);
+      hole.qWaters.push_back(rows[j].waterTons);
+    }
+    rows = std::vector<Row>();
+  }
+  return data;
+}
+
+TaskData CSVDataImporter::read(std::string filename)
+  {
+    if(boost::filesystem::is_directory(filename) || (!boost::filesystem::exists(filename) && isGlobPattern(filename)))
+      return ReadFiles(ListFiles(filename));
+    MemoryTracker::Scope scope(MemoryTracker::taskData);
+    TaskData data;
     std::map<std::string, size_t> holeNamesToIndex;
     
     std::ifstream f(filename, std::ifstream::in);
-    while(!f.eof())
+    if(!f)
+      throw std::invalid_argument("Can't open " + filename);
+    std::string lineStr;
+    while(std::getline(f, lineStr))
     {
-      // TODO: escape stringstream overhead
-      std::string lineStr;
-      std::getline(f, lineStr);
-      if(lineStr.size()<4)
+      LineData lineData;
+      if(!ParseLine(lineStr, lineData))
         continue;
-      std::stringstream lineStream(lineStr);
-      LineData lineData{0};
-      std::getline(lineStream, cell, ',');ss = std::stringstream(cell);
-      ss>>lineData.time;
-      std::getline(lineStream, lineData.holeName, ',');
-      std::getline(lineStream, cell, ',');ss = std::stringstream(cell);
-      ss>>lineData.workHours;
-      std::getline(lineStream, cell, ',');ss = std::stringstream(cell);
-      ss>>lineData.oilTons;
-      std::getline(lineStream, cell, ',');ss = std::stringstream(cell);
-      ss>>lineData.waterTons;
 
       if(holeNamesToIndex.find(lineData.holeName) == holeNamesToIndex.end())
       {
@@ -4,6 +4,7 @@
 #include <map>
 #include <fstream>
 #include <sstream>
+#include <vector>
 
 /// Imports data from csv file
 /// CSV file format:
@@ -11,7 +12,7 @@
 /// comma separeted, without header
 class CSVDataImporter
 {
-private:
+public:
   struct LineData
   {
     unsigned int time;
@@ -20,7 +21,20 @@ private:
     double  oilTons;
     double  waterTons;
   };
-public:
+  /// Parses one csv line. Returns false for lines without data
+  static bool ParseLine(const std::string & lineStr, LineData & lineData);
+  
+  /// CSV files of path: the file itself, *.csv files of directory or
+  /// files matching glob pattern, sorted by name
+  static std::vector<std::string> ListFiles(const std::string & path);
+  /// Reads and parses files concurrently by nThreads threads, 0 - by
+  /// hardware threads. Holes are ordered by their first line in files
+  /// taken in given order, rows of every hole are ordered by month.
+  /// Throws invalid_argument if hole has the same month twice
+  static TaskData ReadFiles(const std::vector<std::string> & filenames, size_t nThreads = 0);
+  
+  /// Reads csv file, rows of holes are in file order. Directory or glob
+  /// pattern is read by ReadFiles of its ListFiles
   TaskData read(std::string filename);
 };
 
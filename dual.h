@@ -0,0 +1,161 @@
+#ifndef DUAL_H
+#define DUAL_H
+
+#include <cmath>
+#include <array>
+
+/// Forward-mode dual number: value and gradient by N variables.
+/// Gradient is a fixed-size array, so dual arithmetic stays on the stack
+/// and is fully inlined for small N
+template<size_t N>
+class Dual
+{
+public:
+  typedef std::array<double, N> VGrad;
+
+  double v;
+  VGrad d;
+
+  Dual()
+  : v(0.0)
+  {
+    d.fill(0.0);
+  }
+
+  Dual(const double val)
+  : v(val)
+  {
+    d.fill(0.0);
+  }
+
+  Dual(const double val, const VGrad& grad)
+  : v(val)
+  , d(grad)
+  {
+  }
+
+  /// Independent variable number iVar with value val
+  static Dual Variable(const double val, const size_t iVar)
+  {
+    Dual res(val);
+    res.d[iVar] = 1.0;
+    return res;
+  }
+
+  /// Result of unary function g(v) with derivative dg
+  Dual Chain(const double val, const double dg) const
+  {
+    Dual res(val);
+    for(size_t i = 0; i<N; ++i)
+      res.d[i] = dg*d[i];
+    return res;
+  }
+};
+
+template<size_t N>
+inline Dual<N> operator-(const Dual<N>& x)
+{
+  return x.Chain(-x.v, -1.0);
+}
+
+template<size_t N>
+inline Dual<N> operator+(const Dual<N>& x, const Dual<N>& y)
+{
+  Dual<N> res(x.v+y.v);
+  for(size_t i = 0; i<N; ++i)
+    res.d[i] = x.d[i]+y.d[i];
+  return res;
+}
+
+template<size_t N>
+inline Dual<N> operator-(const Dual<N>& x, const Dual<N>& y)
+{
+  Dual<N> res(x.v-y.v);
+  for(size_t i = 0; i<N; ++i)
+    res.d[i] = x.d[i]-y.d[i];
+  return res;
+}
+
+template<size_t N>
+inline Dual<N> operator*(const Dual<N>& x, const Dual<N>& y)
+{
+  Dual<N> res(x.v*y.v);
+  for(size_t i = 0; i<N; ++i)
+    res.d[i] = x.d[i]*y.v + x.v*y.d[i];
+  return res;
+}
+
+template<size_t N>
+inline Dual<N> operator/(const Dual<N>& x, const Dual<N>& y)
+{
+  const double inv = 1.0/y.v;
+  Dual<N> res(x.v*inv);
+  for(size_t i = 0; i<N; ++i)
+    res.d[i] = (x.d[i] - res.v*y.d[i])*inv;
+  return res;
+}
+
+template<size_t N>
+inline Dual<N> operator+(const Dual<N>& x, const double y) { return x.Chain(x.v+y, 1.0); }
+template<size_t N>
+inline Dual<N> operator+(const double x, const Dual<N>& y) { return y.Chain(x+y.v, 1.0); }
+template<size_t N>
+inline Dual<N> operator-(const Dual<N>& x, const double y) { return x.Chain(x.v-y, 1.0); }
+template<size_t N>
+inline Dual<N> operator-(const double x, const Dual<N>& y) { return y.Chain(x-y.v, -1.0); }
+template<size_t N>
+inline Dual<N> operator*(const Dual<N>& x, const double y) { return x.Chain(x.v*y, y); }
+template<size_t N>
+inline Dual<N> operator*(const double x, const Dual<N>& y) { return y.Chain(x*y.v, x); }
+template<size_t N>
+inline Dual<N> operator/(const Dual<N>& x, const double y) { return x.Chain(x.v/y, 1.0/y); }
+template<size_t N>
+inline Dual<N> operator/(const double x, const Dual<N>& y) { return y.Chain(x/y.v, -x/(y.v*y.v)); }
+
+template<size_t N>
+inline bool operator<(const Dual<N>& x, const double y) { return x.v<y; }
+template<size_t N>
+inline bool operator<(const double x, const Dual<N>& y) { return x<y.v; }
+
+template<size_t N>
+inline Dual<N> exp(const Dual<N>& x)
+{
+  const double e = std::exp(x.v);
+  return x.Chain(e, e);
+}
+
+template<size_t N>
+inline Dual<N> log(const Dual<N>& x)
+{
+  return x.Chain(std::log(x.v), 1.0/x.v);
+}
+
+/// \f$ x^p \f$ for constant p
+template<size_t N>
+inline Dual<N> pow(const Dual<N>& x, const double p)
+{
+  const double xp1 = std::pow(x.v, p-1);
+  return x.Chain(xp1*x.v, p*xp1);
+}
+
+/// \f$ x^p = e^{p ln x} \f$
+template<size_t N>
+inline Dual<N> pow(const Dual<N>& x, const Dual<N>& p)
+{
+  const double lnX = std::log(x.v);
+  const double val = std::pow(x.v, p.v);
+  Dual<N> res(val);
+  for(size_t i = 0; i<N; ++i)
+    res.d[i] = val*(p.d[i]*lnX + p.v*x.d[i]/x.v);
+  return res;
+}
+
+/// \f$ x^p \f$ for constant x
+template<size_t N>
+inline Dual<N> pow(const double x, const Dual<N>& p)
+{
+  const double val = std::pow(x, p.v);
+  return p.Chain(val, val*std::log(x));
+}
+
+#endif // DUAL_H
@@ -0,0 +1,389 @@
+#include "fitserver.h"
+#include "dataimporter.h"
+#include <iostream>
+#include <sstream>
+#include <numeric>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+static sockaddr_un makeAddress(const std::string & socketPath)
+{
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(socketPath.size() >= sizeof(addr.sun_path))
+    throw std::invalid_argument("Socket path is too long: " + socketPath);
+  std::strcpy(addr.sun_path, socketPath.c_str());
+  return addr;
+}
+
+static void sendLine(int fd, const std::string & line)
+{
+  const std::string data = line + "\n";
+  size_t nSent = 0;
+  while(nSent < data.size())
+  {
+    const ssize_t n = send(fd, data.data() + nSent, data.size() - nSent, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      throw std::runtime_error("Connection is broken");
+    nSent += n;
+  }
+}
+
+/// Reads next line to line, buffer keeps data after it.
+/// Returns false on end of connection, throws length_error if line is
+/// longer than maxLength
+static bool recvLine(int fd, std::string & buffer, std::string & line, size_t maxLength = std::string::npos)
+{
+  size_t iEnd = buffer.find('\n');
+  while(iEnd == std::string::npos)
+  {
+    if(buffer.size() > maxLength)
+      throw std::length_error("Request line exceeds " + std::to_string(maxLength) + " bytes");
+    char data[4096];
+    const ssize_t n = recv(fd, data, sizeof(data), 0);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return false;
+    buffer.append(data, n);
+    iEnd = buffer.find('\n');
+  }
+  if(iEnd > maxLength)
+    throw std::length_error("Request line exceeds " + std::to_string(maxLength) + " bytes");
+  line = buffer.substr(0, iEnd);
+  buffer.erase(0, iEnd + 1);
+  return true;
+}
+
+static std::string jsonString(const std::string & str)
+{
+  std::string res = "\"";
+  for(const char c: str)
+  {
+    if(c == '"' || c == '\\')
+      res += std::string("\\") + c;
+    else if(static_cast<unsigned char>(c) < 0x20)
+    {
+      char hex[8];
+      std::snprintf(hex, sizeof(hex), "\\u%04x", c);
+      res += hex;
+    }
+    else
+      res += c;
+  }
+  return res + "\"";
+}
+
+static std::string errorReply(const std::string & error)
+{
+  return "{\"status\":\"error\",\"error\":" + jsonString(error) + "}";
+}
+
+template<class TVector>
+static std::string jsonArray(const TVector & vals, Eigen::Index iFirst, Eigen::Index n)
+{
+  std::ostringstream ss;
+  ss.precision(17);
+  ss<<"[";
+  for(Eigen::Index i = 0; i<n; ++i)
+  {
+    const double val = vals[iFirst + i];
+    if(i>0)
+      ss<<",";
+    if(std::isfinite(val))
+      ss<<val;
+    else
+      ss<<"null";
+  }
+  ss<<"]";
+  return ss.str();
+}
+
+FitServer::FitServer(const std::string& socketPath)
+: _socketPath(socketPath)
+, _workspace(std::make_shared<SolverWorkspace>())
+{
+  const sockaddr_un addr = makeAddress(socketPath);
+  _listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(_listenFd < 0)
+    throw std::runtime_error("Can't create socket");
+  unlink(socketPath.c_str());
+  if(bind(_listenFd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0
+    || listen(_listenFd, 64) != 0)
+  {
+    close(_listenFd);
+    throw std::runtime_error("Can't listen on " + socketPath);
+  }
+}
+
+FitServer::~FitServer()
+{
+  close(_listenFd);
+  unlink(_socketPath.c_str());
+}
+
+void FitServer::Run()
+{
+  std::list<Connection> connections;
+  try
+  {
+    while(!_isStopped)
+    {
+      const int fd = accept4(_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+      if(fd < 0)
+      {
+        // listening socket is shut down by shutdown request
+        if(_isStopped)
+          break;
+        if(errno == EINTR || errno == ECONNABORTED)
+          continue;
+        throw std::runtime_error("Can't accept connection");
+      }
+      joinConnections(connections, false);
+      connections.emplace_back();
+      Connection& connection = connections.back();
+      connection.fd = fd;
+      connection.thread = std::thread([this, &connection]()
+      {
+        try
+        {
+          serveConnection(connection.fd);
+        }
+        catch(std::exception & e)
+        {
+          std::cout<<"Connection error:"<<e.what()<<std::endl;
+        }
+        connection.isDone = true;
+      });
+    }
+  }
+  catch(...)
+  {
+    joinConnections(connections, true);
+    throw;
+  }
+  joinConnections(connections, true);
+}
+
+void FitServer::joinConnections(std::list<FitServer::Connection>& connections, bool isAll)
+{
+  for(auto it = connections.begin(); it != connections.end();)
+  {
+    if(!isAll && !it->isDone)
+    {
+      ++it;
+      continue;
+    }
+    // unblocks waiting for next request
+    if(!it->isDone)
+      shutdown(it->fd, SHUT_RDWR);
+    it->thread.join();
+    close(it->fd);
+    it = connections.erase(it);
+  }
+}
+
+void FitServer::serveConnection(int fd)
+{
+  std::string buffer;
+  std::string line;
+  while(!_isStopped)
+  {
+    try
+    {
+      if(!recvLine(fd, buffer, line, maxRequestLength))
+        return;
+    }
+    catch(std::length_error & e)
+    {
+      // rest of the line can't be told from next request
+      sendLine(fd, errorReply(e.what()));
+      return;
+    }
+    sendLine(fd, HandleRequest(line));
+  }
+  // wakes accept of Run
+  shutdown(_listenFd, SHUT_RDWR);
+}
+
+FitServer::Dataset& FitServer::getDataset(const std::string& name)
+{
+  auto it = _datasets.find(name);
+  if(it == _datasets.end())
+    throw std::invalid_argument("Unknown dataset " + name);
+  return it->second;
+}
+
+FitServer::Fit& FitServer::fit(FitServer::Dataset& dataset, const std::string& target, size_t iFunction, bool isRefit)
+{
+  if(target != "oil" && target != "water")
+    throw std::invalid_argument("Unknown target " + target);
+  Fit& fit = dataset.fits[target + ":" + std::to_string(iFunction)];
+  if(fit.isCurrent && !isRefit)
+    return fit;
+  if(!fit.solver)
+  {
+    TaskData taskData = dataset.taskData;
+    if(target == "water")
+      TaskDataHelper::SwapOilWater(taskData);
+    fit.solver = std::make_unique<Solver>(CreateRegressionModelLn(iFunction, taskData), _workspace);
+  }
+  Solver::SolverParams sp;
+  sp.matrixFree = true;
+  if(fit.params.size() > 0)
+    fit.solver->SolverInit(sp, fit.params);
+  else
+    fit.solver->SolverInit(sp);
+  fit.isConverged = fit.solver->Solve();
+  fit.params = fit.solver->GetResult();
+  fit.isCurrent = true;
+  return fit;
+}
+
+std::string FitServer::HandleRequest(const std::string& request)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  try
+  {
+    boost::property_tree::ptree pt;
+    std::istringstream ss(request);
+    boost::property_tree::read_json(ss, pt);
+    const std::string command = pt.get<std::string>("command");
+    std::ostringstream reply;
+    reply<<"{\"status\":\"ok\"";
+    
+    if(command == "load")
+    {
+      const std::string name = pt.get<std::string>("dataset");
+      CSVDataImporter dataImporter;
+      TaskData taskData = dataImporter.read(pt.get<std::string>("path"));
+      if(taskData.holes.empty())
+        throw std::invalid_argument("Empty task data");
+      Dataset& dataset = _datasets[name];
+      // fitted params stay as warm start if holes are the same
+      bool isSameHoles = dataset.taskData.holes.size() == taskData.holes.size();
+      for(size_t i = 0; isSameHoles && i<taskData.holes.size(); ++i)
+        isSameHoles = dataset.taskData.holes[i].name == taskData.holes[i].name;
+      dataset.taskData = std::move(taskData);
+      for(auto& fitPair: dataset.fits)
+      {
+        fitPair.second.solver.reset();
+        fitPair.second.isCurrent = false;
+        if(!isSameHoles)
+          fitPair.second.params.resize(0);
+      }
+      reply<<",\"holes\":"<<dataset.taskData.holes.size()
+        <<",\"rows\":"<<TaskDataHelper::GetTaskSize(dataset.taskData);
+    }
+    else if(command == "unload")
+    {
+      if(_datasets.erase(pt.get<std::string>("dataset")) == 0)
+        throw std::invalid_argument("Unknown dataset " + pt.get<std::string>("dataset"));
+    }
+    else if(command == "list")
+    {
+      reply<<",\"datasets\":[";
+      bool isFirst = true;
+      for(const auto& datasetPair: _datasets)
+      {
+        reply<<(isFirst ? "" : ",")<<"{\"dataset\":"<<jsonString(datasetPair.first)
+          <<",\"holes\":"<<datasetPair.second.taskData.holes.size()<<",\"fits\":[";
+        bool isFirstFit = true;
+        for(const auto& fitPair: datasetPair.second.fits)
+        {
+          if(!fitPair.second.isCurrent)
+            continue;
+          reply<<(isFirstFit ? "" : ",")<<jsonString(fitPair.first);
+          isFirstFit = false;
+        }
+        reply<<"]}";
+        isFirst = false;
+      }
+      reply<<"]";
+    }
+    else if(command == "fit" || command == "refit" || command == "forecast")
+    {
+      Dataset& dataset = getDataset(pt.get<std::string>("dataset"));
+      const Fit& result = fit(dataset, pt.get<std::string>("target", "oil"), pt.get<size_t>("function", 1), command == "refit");
+      const size_t nQParams = dataset.taskData.holes.size();
+      if(command == "forecast")
+      {
+        // production of future months with given working hours,
+        // time continues from the end of hole history
+        const std::string holeName = pt.get<std::string>("hole");
+        size_t iHole = 0;
+        while(iHole<nQParams && dataset.taskData.holes[iHole].name != holeName)
+          ++iHole;
+        if(iHole == nQParams)
+          throw std::invalid_argument("Unknown hole " + holeName);
+        const std::vector<double>& ts = dataset.taskData.holes[iHole].ts;
+        double t = std::accumulate(ts.begin(), ts.end(), 0.0);
+        std::vector<double> values;
+        for(const auto& hours: pt.get_child("hours"))
+        {
+          const double h = hours.second.get_value<double>();
+          values.push_back(result.params[iHole]*result.solver->GetModel().CalcFT(result.params, t + h/2)*h);
+          t += h;
+        }
+        reply<<",\"values\":"<<jsonArray(values, 0, values.size());
+      }
+      else
+      {
+        reply<<",\"converged\":"<<(result.isConverged ? "true" : "false")<<",\"holes\":[";
+        for(size_t i = 0; i<nQParams; ++i)
+          reply<<(i>0 ? "," : "")<<jsonString(dataset.taskData.holes[i].name);
+        reply<<"],\"q0\":"<<jsonArray(result.params, 0, nQParams)
+          <<",\"funcParams\":"<<jsonArray(result.params, nQParams, result.params.size() - nQParams);
+      }
+    }
+    else if(command == "shutdown")
+    {
+      _isStopped = true;
+    }
+    else
+      throw std::invalid_argument("Unknown command " + command);
+    reply<<"}";
+    return reply.str();
+  }
+  catch(std::exception & e)
+  {
+    return errorReply(e.what());
+  }
+}
+
+std::string FitServer::Query(const std::string& socketPath, const std::string& request)
+{
+  const sockaddr_un addr = makeAddress(socketPath);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0)
+    throw std::runtime_error("Can't create socket");
+  std::string buffer;
+  std::string reply;
+  bool isReplied = false;
+  if(connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0)
+  {
+    try
+    {
+      sendLine(fd, request);
+      isReplied = recvLine(fd, buffer, reply);
+    }
+    catch(std::exception&)
+    {
+    }
+  }
+  close(fd);
+  if(!isReplied)
+    throw std::runtime_error("No reply from " + socketPath);
+  return reply;
+}
@@ -0,0 +1,85 @@
+#ifndef FITSERVER_H
+#define FITSERVER_H
+
+#include "solver.h"
+#include <string>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+/// Fit daemon over unix domain socket.
+/// Keeps loaded datasets, their models with optimized task data and last
+/// fitted params in memory. Every request and reply is one line of JSON:
+///   {"command": "load", "dataset": "d", "path": "taskData.csv"}
+///   {"command": "fit", "dataset": "d", "target": "oil", "function": 1}
+///   {"command": "refit", ...} - solve again, warm started from last params
+///   {"command": "forecast", ..., "hole": "name", "hours": [720, 720]}
+///   {"command": "list"}, {"command": "unload", "dataset": "d"}, {"command": "shutdown"}
+/// Reply has "status": "ok" or "error" with "error" message.
+/// Every connection is served by its own thread, requests are handled
+/// one at a time as they share datasets and solver workspace
+class FitServer
+{
+public:
+  /// Listens on socketPath, existing socket file is replaced
+  explicit FitServer(const std::string & socketPath);
+  ~FitServer();
+  FitServer(const FitServer &) = delete;
+  FitServer & operator=(const FitServer &) = delete;
+  
+  /// Serves connections until shutdown request, then waits for them
+  void Run();
+  /// Reply to one request line
+  std::string HandleRequest(const std::string & request);
+  
+  /// Longer request line gets error reply and its connection is closed
+  size_t maxRequestLength = 1 << 20;
+  
+  /// Client: sends request line to server, returns reply line
+  static std::string Query(const std::string & socketPath, const std::string & request);
+  
+private:
+  struct Fit
+  {
+    std::unique_ptr<Solver> solver;
+    /// Last fitted params, kept when dataset is reloaded with same holes
+    Eigen::VectorXd params;
+    /// Params are fitted on current data
+    bool isCurrent = false;
+    bool isConverged = false;
+  };
+  struct Dataset
+  {
+    TaskData taskData;
+    /// by "<target>:<function>"
+    std::map<std::string, Fit> fits;
+  };
+  
+  /// Connection of Run, its fd is closed by Run after join
+  struct Connection
+  {
+    int fd = -1;
+    std::thread thread;
+    std::atomic<bool> isDone{false};
+  };
+  
+  std::string _socketPath;
+  int _listenFd = -1;
+  std::atomic<bool> _isStopped{false};
+  /// Guards datasets and workspace
+  std::mutex _mutex;
+  std::map<std::string, Dataset> _datasets;
+  std::shared_ptr<SolverWorkspace> _workspace;
+  
+  Dataset & getDataset(const std::string & name);
+  /// Fits model if its params are not current or refit is requested
+  Fit & fit(Dataset & dataset, const std::string & target, size_t iFunction, bool isRefit);
+  void serveConnection(int fd);
+  /// Joins done connections, all of them with isAll
+  static void joinConnections(std::list<Connection> & connections, bool isAll);
+};
+
+#endif // FITSERVER_H
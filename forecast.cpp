@@ -0,0 +1,33 @@
+#include "forecast.h"
+#include <fstream>
+#include <cstdint>
+#include <stdexcept>
+
+Eigen::VectorXd MonthlyHorizon(size_t nMonths, double monthHours)
+{
+  return Eigen::VectorXd::LinSpaced(nMonths, monthHours, nMonths*monthHours);
+}
+
+void WriteForecast(const Forecast& forecast, const std::vector<std::string>& names, const std::string& filename)
+{
+  if(names.size() != size_t(forecast.rates.cols()))
+    throw std::invalid_argument("Wrong number of hole names");
+  std::ofstream out(filename, std::ios::binary);
+  if(!out)
+    throw std::invalid_argument("Can't create " + filename);
+  const char magic[8] = {'G', 'P', 'F', 'C', 'S', 'T', '0', '1'};
+  out.write(magic, sizeof(magic));
+  const uint64_t sizes[2] = {names.size(), uint64_t(forecast.horizon.size())};
+  out.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+  for(const std::string& name: names)
+  {
+    const uint32_t nameSize = name.size();
+    out.write(reinterpret_cast<const char*>(&nameSize), sizeof(nameSize));
+    out.write(name.data(), name.size());
+  }
+  out.write(reinterpret_cast<const char*>(forecast.horizon.data()), forecast.horizon.size()*sizeof(double));
+  out.write(reinterpret_cast<const char*>(forecast.rates.data()), forecast.rates.size()*sizeof(double));
+  out.write(reinterpret_cast<const char*>(forecast.cumulative.data()), forecast.cumulative.size()*sizeof(double));
+  if(!out)
+    throw std::runtime_error("Can't write " + filename);
+}
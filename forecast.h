@@ -0,0 +1,70 @@
+#ifndef FORECAST_H
+#define FORECAST_H
+
+#include "functions.h"
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <Eigen/Dense>
+
+/// Forecast of every hole over common horizon.
+/// Matrices are column major with column per hole, so every hole is
+/// one contiguous column
+struct Forecast
+{
+  /// Hours of work from the end of hole history, ascending
+  Eigen::VectorXd horizon;
+  /// \f$ q_i(t) = q_{0i} f(t) \f$ per hour at horizon times
+  Eigen::MatrixXd rates;
+  /// Production from the end of hole history up to horizon times
+  Eigen::MatrixXd cumulative;
+};
+
+/// Horizon of nMonths months of monthHours working hours each
+Eigen::VectorXd MonthlyHorizon(size_t nMonths, double monthHours = 720.0);
+
+/// Evaluates fitted model params [q0i ; function params] for holes with
+/// tEnds hours of history. Holes are processed in parallel, times of a
+/// hole by vectorized TFunc::CalcFTArray. Cumulative production is
+/// trapezoid integral of rates starting at the end of history
+template<class TFunc>
+void CalcForecast(const Eigen::VectorXd & params, const std::vector<double> & tEnds, const Eigen::VectorXd & horizon, Forecast & forecast)
+{
+  const size_t nHoles = tEnds.size();
+  const Eigen::Index nTimes = horizon.size();
+  if(size_t(params.size()) != nHoles + TFunc::nParams)
+    throw std::invalid_argument("Wrong params size");
+  const typename TFunc::VParams funcParams = params.tail(TFunc::nParams);
+  forecast.horizon = horizon;
+  forecast.rates.resize(nTimes, nHoles);
+  forecast.cumulative.resize(nTimes, nHoles);
+  
+  #pragma omp parallel
+  {
+    // times with the end of history first
+    Eigen::ArrayXd t(nTimes+1);
+    Eigen::ArrayXd ft(nTimes+1);
+    #pragma omp for schedule(static)
+    for(size_t i = 0; i<nHoles; ++i)
+    {
+      t[0] = tEnds[i];
+      t.tail(nTimes) = horizon.array() + tEnds[i];
+      TFunc::CalcFTArray(funcParams, t, ft);
+      ft *= params[i];
+      forecast.rates.col(i) = ft.tail(nTimes).matrix();
+      double cumulative = 0.0;
+      for(Eigen::Index k = 0; k<nTimes; ++k)
+      {
+        cumulative += (ft[k] + ft[k+1])/2*(t[k+1] - t[k]);
+        forecast.cumulative(k, i) = cumulative;
+      }
+    }
+  }
+}
+
+/// Writes forecast in columnar binary format: magic "GPFCST01",
+/// uint64 number of holes and times, hole names (uint32 size and chars),
+/// then double columns: horizon, rates of every hole, cumulative of every hole
+void WriteForecast(const Forecast & forecast, const std::vector<std::string> & names, const std::string & filename);
+
+#endif // FORECAST_H
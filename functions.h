@@ -5,6 +5,7 @@
 #include <limits>
 #include <array>
 #include <Eigen/Dense>
+#include "dual.h"
 
 /// Function for regression model
 /// \f$ f(t) = e^{-Dt} \f$
@@ -15,11 +16,26 @@ public:
   const static size_t nParams = 1;
   typedef Eigen::Matrix<double, nParams ,1> VParams;
   
+  /// \f$ f(t) \f$ for any scalar type T of params and time, e.g. Dual.
+  /// Autodiff needs only this definition
+  template<class T, class TParams, class TTime>
+  inline static T CalcFTT (const TParams & params, const TTime t)
+  {
+    const T& D = params[0];
+    return exp(-D*t);
+  }
+  
   /// \f$ f(t) \f$
   inline static double CalcFT (const VParams & params, const double t)
   {
-    const double& D = params[0];
-    return exp(-D*t);
+    return CalcFTT<double>(params, t);
+  }
+  
+  /// \f$ f(t) \f$ for array of times, vectorized by Eigen
+  inline static void CalcFTArray(const VParams & params, const Eigen::ArrayXd & t, Eigen::ArrayXd & ft)
+  {
+    const double D = params[0];
+    ft = (-D*t).exp();
   }
   
   /// \f$ \frac{df(t)}{d w_i} \f$ where \f$ w_i \f$ - model param
@@ -103,11 +119,25 @@ public:
   const static size_t nParams = 1;
   typedef Eigen::Matrix<double, nParams ,1> VParams;
   
+  /// \f$ f(t) \f$ for any scalar type T of params and time
+  template<class T, class TParams, class TTime>
+  inline static T CalcFTT (const TParams & params, const TTime t)
+  {
+    const T& a = params[0];
+    return pow(1+t,-a);
+  }
+  
   /// \f$ f(t) \f$
   inline static double CalcFT (const VParams & params, const double t)
   {
-    const double& a = params[0];
-    return pow(1+t,-a);
+    return CalcFTT<double>(params, t);
+  }
+  
+  /// \f$ f(t) \f$ for array of times, vectorized by Eigen
+  inline static void CalcFTArray(const VParams & params, const Eigen::ArrayXd & t, Eigen::ArrayXd & ft)
+  {
+    const double a = params[0];
+    ft = (-a*(t+1.0).log()).exp();
   }
   
   /// \f$ \frac{df(t)}{d w_i} \f$ where \f$ w_i \f$ - model param
@@ -160,12 +190,27 @@ public:
   const static size_t nParams = 2;
   typedef Eigen::Matrix<double, nParams ,1> VParams;
   
+  /// \f$ f(t) \f$ for any scalar type T of params and time
+  template<class T, class TParams, class TTime>
+  inline static T CalcFTT (const TParams & params, const TTime t)
+  {
+    const T& D = params[0];
+    const T& b = params[1];
+    return pow(1+b*D*t, -1.0/b);
+  }
+  
   /// \f$ f(t) \f$
   inline static double CalcFT (const VParams & params, const double t)
   {
-    const double& D = params[0];
-    const double& b = params[1];
-    return pow(1+b*D*t, -1.0/b);
+    return CalcFTT<double>(params, t);
+  }
+  
+  /// \f$ f(t) \f$ for array of times, vectorized by Eigen
+  inline static void CalcFTArray(const VParams & params, const Eigen::ArrayXd & t, Eigen::ArrayXd & ft)
+  {
+    const double D = params[0];
+    const double b = params[1];
+    ft = (-1.0/b*(b*D*t+1.0).log()).exp();
   }
   
   /// \f$ \frac{df(t)}{d w_i} \f$ where \f$ w_i \f$ - model param
@@ -231,26 +276,45 @@ public:
   const static size_t nParams = 3;
   typedef Eigen::Matrix<double, nParams ,1> VParams;
   
-  /// \f$ f(t) \f$
-  inline static double CalcFT (const VParams & params, const double t)
+  /// \f$ f(t) \f$ for any scalar type T of params and time
+  template<class T, class TParams, class TTime>
+  inline static T CalcFTT (const TParams & params, const TTime t)
   {
-    const double& b = params[0];
-    const double& a = params[1];
-    const double& tau = params[2];
-    const double D=a*pow(t+1,-a-1);
+    const T& b = params[0];
+    const T& a = params[1];
+    const T& tau = params[2];
+    const T D=a*pow(t+1,-a-1);
 
     if(t<tau)
     {
-      Function2::VParams tmp;
-      tmp[0] = a;
-      return Function2::CalcFT(tmp, t);
+      const std::array<T, 1> tmp{{a}};
+      return Function2::CalcFTT<T>(tmp, t);
     }
     else
     {
-      return Function3::CalcFT({D, b}, t-tau);
+      const std::array<T, 2> tmp{{D, b}};
+      return Function3::CalcFTT<T>(tmp, t-tau);
     }
   }
   
+  /// \f$ f(t) \f$
+  inline static double CalcFT (const VParams & params, const double t)
+  {
+    return CalcFTT<double>(params, t);
+  }
+  
+  /// \f$ f(t) \f$ for array of times, vectorized by Eigen.
+  /// Both branches are evaluated, the right one is selected per element
+  inline static void CalcFTArray(const VParams & params, const Eigen::ArrayXd & t, Eigen::ArrayXd & ft)
+  {
+    const double b = params[0];
+    const double a = params[1];
+    const double tau = params[2];
+    const auto lnT1 = (t+1.0).log();
+    const auto D = a*((-a-1)*lnT1).exp();
+    ft = (t < tau).select((-a*lnT1).exp(), (-1.0/b*(b*D*(t-tau)+1.0).log()).exp());
+  }
+  
   /// \f$ \frac{df(t)}{d w_i} \f$ where \f$ w_i \f$ - model param
   inline static double CalcDFDIParam(size_t iParam, const VParams & params, const double t)
   {
@@ -265,7 +329,7 @@ public:
         if(t<tau)
           return 0;
         else
-          return Function3::CalcDFDIParam(0, {D, b}, t-tau);
+          return Function3::CalcDFDIParam(1, {D, b}, t-tau);
         break;
       case 1:
         if(t<tau)
@@ -275,7 +339,11 @@ public:
           return Function2::CalcDFDIParam(0, tmp, t);
         }
         else
-          return 0;
+        {
+          // right branch depends on a by D only
+          const double dDda = pow(t+1, -a-1)*(1 - a*log(t+1));
+          return Function3::CalcDFDIParam(0, {D, b}, t-tau)*dDda;
+        }
         break;
       case 2:
         if(t<tau)
@@ -287,6 +355,31 @@ public:
     throw std::invalid_argument("Param index exceeds params count");
   }
 
+  /// \f$ ln f(t) \f$ of the right branch as power series of
+  /// \f$ \delta = \tau - \tau_0 \f$ for \f$ \tau_0 \le \tau \le t \f$:
+  /// \f$ -\frac{1}{b} ln w + \sum_{p>0} \frac{x^p}{b p} \delta^p \f$, where
+  /// \f$ w = 1 + b D (t - \tau_0) \f$, \f$ x = b D / w \f$.
+  /// coefs[p] is coefficient of \f$ \delta^p \f$. Returns x, series
+  /// converges for \f$ x \delta < 1 \f$
+  template<size_t nTerms>
+  inline static double CalcRightLnFTSeries(const VParams & params, const double t, const double tau0, std::array<double, nTerms> & coefs)
+  {
+    const double b = params[0];
+    const double a = params[1];
+    const double D = a*pow(t+1, -a-1);
+    const double bDT = b*D*(t - tau0);
+    const double x = b*D/(1.0 + bDT);
+    coefs[0] = -std::log1p(bDT)/b;
+    // x^p/b
+    double xPowDivB = D/(1.0 + bDT);
+    for(size_t p = 1; p<nTerms; ++p)
+    {
+      coefs[p] = xPowDivB/p;
+      xPowDivB *= x;
+    }
+    return x;
+  }
+
   inline static double GetParamLowerLimits(size_t iParam)
   {
     switch(iParam)
@@ -324,5 +417,50 @@ public:
   
 };
 
+/// Index of the param where \f$ f(t) \f$ switches branches.
+/// Equals TFunc::nParams for functions without breakpoint
+template<class TFunc>
+struct BreakpointParam
+{
+  const static size_t value = TFunc::nParams;
+};
+
+/// Function4 switches branches at tau
+template<>
+struct BreakpointParam<Function4>
+{
+  const static size_t value = 2;
+};
+
+/// \f$ f(t) \f$ and its gradient by params from hand-coded CalcDFDIParam
+template<class TFunc>
+struct HandDiff
+{
+  inline static double CalcFTGrad(const typename TFunc::VParams & params, const double t, typename TFunc::VParams & grad)
+  {
+    for(size_t iParam = 0; iParam<TFunc::nParams; ++iParam)
+      grad[iParam] = TFunc::CalcDFDIParam(iParam, params, t);
+    return TFunc::CalcFT(params, t);
+  }
+};
+
+/// \f$ f(t) \f$ and its gradient by params in one forward-mode pass
+/// over TFunc::CalcFTT. New functions need no CalcDFDIParam with it
+template<class TFunc>
+struct AutoDiff
+{
+  typedef Dual<TFunc::nParams> TDual;
+  
+  inline static double CalcFTGrad(const typename TFunc::VParams & params, const double t, typename TFunc::VParams & grad)
+  {
+    std::array<TDual, TFunc::nParams> dualParams;
+    for(size_t iParam = 0; iParam<TFunc::nParams; ++iParam)
+      dualParams[iParam] = TDual::Variable(params[iParam], iParam);
+    const TDual res = TFunc::template CalcFTT<TDual>(dualParams, t);
+    for(size_t iParam = 0; iParam<TFunc::nParams; ++iParam)
+      grad[iParam] = res.d[iParam];
+    return res.v;
+  }
+};
 
 #endif // FUNCTIONS_H
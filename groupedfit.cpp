@@ -0,0 +1,60 @@
+#include "groupedfit.h"
+#include <map>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+HoleGroups makeGroups(const TaskData & taskData, const std::vector<std::string> & holeGroups)
+{
+  std::map<std::string, std::vector<size_t>> groups;
+  for(size_t i = 0; i<taskData.holes.size(); ++i)
+    groups[holeGroups[i]].push_back(i);
+  HoleGroups result;
+  for(auto & group: groups)
+  {
+    result.names.push_back(group.first);
+    result.holes.push_back(std::move(group.second));
+  }
+  return result;
+}
+}
+
+HoleGroups HoleGroups::ByPrefix(const TaskData & taskData, size_t prefixLength)
+{
+  if(prefixLength == 0)
+    throw std::invalid_argument("Empty group prefix");
+  std::vector<std::string> holeGroups;
+  for(const HoleData & hole: taskData.holes)
+    holeGroups.push_back(hole.name.substr(0, prefixLength));
+  return makeGroups(taskData, holeGroups);
+}
+
+HoleGroups HoleGroups::ByFile(const TaskData & taskData, const std::string & filename)
+{
+  std::ifstream f(filename);
+  if(!f)
+    throw std::invalid_argument("Can't open " + filename);
+  std::map<std::string, std::string> mapping;
+  std::string lineStr;
+  while(std::getline(f, lineStr))
+  {
+    if(!lineStr.empty() && lineStr.back() == '\r')
+      lineStr.pop_back();
+    if(lineStr.empty())
+      continue;
+    const size_t iComma = lineStr.find(',');
+    if(iComma == std::string::npos)
+      throw std::invalid_argument("Wrong group mapping line " + lineStr);
+    mapping[lineStr.substr(0, iComma)] = lineStr.substr(iComma + 1);
+  }
+  std::vector<std::string> holeGroups;
+  for(const HoleData & hole: taskData.holes)
+  {
+    const auto it = mapping.find(hole.name);
+    if(it == mapping.end())
+      throw std::invalid_argument("Hole " + hole.name + " has no group");
+    holeGroups.push_back(it->second);
+  }
+  return makeGroups(taskData, holeGroups);
+}
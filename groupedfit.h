@@ -0,0 +1,111 @@
+#ifndef GROUPEDFIT_H
+#define GROUPEDFIT_H
+
+#include "solver.h"
+#include "viewmodel.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <numeric>
+#include <exception>
+
+/// Holes of every group, groups are ordered by name
+struct HoleGroups
+{
+  std::vector<std::string> names;
+  /// Holes of task data of every group
+  std::vector<std::vector<size_t>> holes;
+
+  /// Group is first prefixLength chars of hole name
+  static HoleGroups ByPrefix(const TaskData & taskData, size_t prefixLength);
+  /// Mapping file lines are "hole name,group name". Every hole of task
+  /// data must be mapped, holes of file missing in task data are ignored
+  static HoleGroups ByFile(const TaskData & taskData, const std::string & filename);
+};
+
+struct GroupedFitParams
+{
+  GroupedFitParams()
+  : nRetryCandidates(16)
+  {
+    sp.variableProjection = true;
+    sp.keepYMinusF = false;
+    sp.nMaxIter = 100;
+  }
+  /// Solver params of every group
+  Solver::SolverParams sp;
+  /// Groups not solved from default params are solved again from the
+  /// best of this number of multi-start candidates, 0 - no retry
+  size_t nRetryCandidates;
+};
+
+struct GroupedFitResult
+{
+  /// q0i of every hole
+  Eigen::VectorXd q0;
+  /// Function params of every group by columns
+  Eigen::MatrixXd funcParams;
+  std::vector<bool> isConverged;
+};
+
+/// Fits model of TFunc with own function params of every group of holes
+/// of view. Groups share no params, so normal equations of whole task are
+/// block diagonal by groups and every block is solved by its own solver.
+/// Groups are solved concurrently, the largest first
+template<class TFunc>
+GroupedFitResult FitGroups(const TaskDataView & view, const HoleGroups & groups, const GroupedFitParams & gp)
+{
+  const size_t nGroups = groups.holes.size();
+  GroupedFitResult result;
+  result.q0.setConstant(view.GetHolesCount(), std::numeric_limits<double>::quiet_NaN());
+  result.funcParams.resize(TFunc::nParams, nGroups);
+  std::vector<char> isConverged(nGroups, 0);
+
+  std::vector<size_t> order(nGroups);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&groups](size_t l, size_t r)
+  {
+    return groups.holes[l].size() > groups.holes[r].size();
+  });
+
+  std::exception_ptr error;
+  #pragma omp parallel
+  {
+    auto workspace = std::make_shared<SolverWorkspace>();
+    #pragma omp for schedule(dynamic, 1)
+    for(size_t k = 0; k<nGroups; ++k)
+    {
+      try
+      {
+        const size_t iGroup = order[k];
+        const std::vector<size_t> & holes = groups.holes[iGroup];
+        Solver solver(std::make_unique<ViewRegressionModelLn<TFunc>>(view.Holes(holes)), workspace);
+        solver.SolverInit(gp.sp);
+        bool isConvergedK = solver.Solve() && solver.GetResult().allFinite();
+        if(!isConvergedK && gp.nRetryCandidates > 0)
+        {
+          Solver::SolverParams sp = gp.sp;
+          sp.nStartCandidates = gp.nRetryCandidates;
+          solver.SolverInit(sp);
+          isConvergedK = solver.Solve() && solver.GetResult().allFinite();
+        }
+        const Eigen::VectorXd params = solver.GetResult();
+        for(size_t i = 0; i<holes.size(); ++i)
+          result.q0[holes[i]] = params[i];
+        result.funcParams.col(iGroup) = params.tail(TFunc::nParams);
+        isConverged[iGroup] = isConvergedK;
+      }
+      catch(...)
+      {
+        #pragma omp critical
+        error = std::current_exception();
+      }
+    }
+  }
+  if(error)
+    std::rethrow_exception(error);
+  result.isConverged.assign(isConverged.begin(), isConverged.end());
+  return result;
+}
+
+#endif // GROUPEDFIT_H
@@ -0,0 +1,290 @@
+#include "holefile.h"
+#include "dataimporter.h"
+#include <future>
+#include <map>
+#include <stdexcept>
+#include <algorithm>
+
+static const char holeFileMagic[8] = {'G', 'P', 'H', 'O', 'L', 'E', 'S', '1'};
+/// hours, oil, water
+static const size_t holeFileRowValues = 3;
+
+template<class T>
+static void writeValue(std::ostream & os, const T & val)
+{
+  os.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template<class T>
+static void readValue(std::istream & is, T & val)
+{
+  is.read(reinterpret_cast<char*>(&val), sizeof(T));
+}
+
+void HoleFile::writeIndex(std::ostream& os, const std::vector<HoleIndex>& holes, uint64_t nRows)
+{
+  os.write(holeFileMagic, sizeof(holeFileMagic));
+  writeValue(os, uint64_t(holes.size()));
+  writeValue(os, nRows);
+  for(const HoleIndex & hole: holes)
+  {
+    writeValue(os, hole.offset);
+    writeValue(os, hole.nRows);
+    writeValue(os, uint32_t(hole.name.size()));
+    os.write(hole.name.data(), hole.name.size());
+  }
+}
+
+void HoleFile::ConvertCSV(const std::string& csvFilename, const std::string& filename, size_t bufferBytes)
+{
+  std::vector<HoleIndex> holes;
+  std::map<std::string, size_t> holeNamesToIndex;
+  uint64_t nRows = 0;
+  {
+    std::ifstream f(csvFilename);
+    if(!f)
+      throw std::invalid_argument("Can't open " + csvFilename);
+    std::string lineStr;
+    CSVDataImporter::LineData lineData;
+    while(std::getline(f, lineStr))
+    {
+      if(!CSVDataImporter::ParseLine(lineStr, lineData))
+        continue;
+      auto it = holeNamesToIndex.find(lineData.holeName);
+      if(it == holeNamesToIndex.end())
+      {
+        it = holeNamesToIndex.emplace(lineData.holeName, holes.size()).first;
+        holes.push_back({lineData.holeName, 0, 0});
+      }
+      ++holes[it->second].nRows;
+      ++nRows;
+    }
+  }
+  for(size_t i = 1; i<holes.size(); ++i)
+    holes[i].offset = holes[i-1].offset + holes[i-1].nRows;
+  
+  std::fstream out(filename, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+  if(!out)
+    throw std::invalid_argument("Can't create " + filename);
+  writeIndex(out, holes, nRows);
+  const uint64_t dataOffset = out.tellp();
+  
+  // csv is ordered by months, so rows of a hole are collected in its
+  // buffer and written by one run when it is full
+  const size_t rowBytes = holeFileRowValues*sizeof(double);
+  const size_t bufferRows = std::max<size_t>(bufferBytes/(rowBytes*std::max<size_t>(holes.size(), 1)), 1);
+  std::vector<std::vector<double>> buffers(holes.size());
+  std::vector<uint64_t> nWritten(holes.size(), 0);
+  auto flush = [&](size_t iHole)
+  {
+    std::vector<double>& buffer = buffers[iHole];
+    if(buffer.empty())
+      return;
+    out.seekp(dataOffset + (holes[iHole].offset + nWritten[iHole])*rowBytes);
+    out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size()*sizeof(double));
+    nWritten[iHole] += buffer.size()/holeFileRowValues;
+    buffer.clear();
+  };
+  std::ifstream f(csvFilename);
+  std::string lineStr;
+  CSVDataImporter::LineData lineData;
+  while(std::getline(f, lineStr))
+  {
+    if(!CSVDataImporter::ParseLine(lineStr, lineData))
+      continue;
+    const auto it = holeNamesToIndex.find(lineData.holeName);
+    if(it == holeNamesToIndex.end())
+      throw std::runtime_error("File is changed while converted: " + csvFilename);
+    const size_t iHole = it->second;
+    std::vector<double>& buffer = buffers[iHole];
+    if(nWritten[iHole] + buffer.size()/holeFileRowValues == holes[iHole].nRows)
+      throw std::runtime_error("File is changed while converted: " + csvFilename);
+    if(buffer.empty())
+      buffer.reserve(std::min<uint64_t>(bufferRows, holes[iHole].nRows - nWritten[iHole])*holeFileRowValues);
+    buffer.insert(buffer.end(), {lineData.workHours, lineData.oilTons, lineData.waterTons});
+    if(buffer.size() == bufferRows*holeFileRowValues)
+      flush(iHole);
+  }
+  // tails go in file order
+  for(size_t iHole = 0; iHole<holes.size(); ++iHole)
+  {
+    flush(iHole);
+    std::vector<double>().swap(buffers[iHole]);
+    if(nWritten[iHole] != holes[iHole].nRows)
+      throw std::runtime_error("File is changed while converted: " + csvFilename);
+  }
+  if(!out)
+    throw std::runtime_error("Can't write " + filename);
+}
+
+void HoleFile::Write(const TaskData& taskData, const std::string& filename)
+{
+  std::vector<HoleIndex> holes;
+  uint64_t nRows = 0;
+  for(const HoleData & hole: taskData.holes)
+  {
+    holes.push_back({hole.name, nRows, hole.ts.size()});
+    nRows += hole.ts.size();
+  }
+  std::ofstream out(filename, std::ios::binary);
+  if(!out)
+    throw std::invalid_argument("Can't create " + filename);
+  writeIndex(out, holes, nRows);
+  for(const HoleData & hole: taskData.holes)
+  {
+    for(size_t j = 0; j<hole.ts.size(); ++j)
+    {
+      const double row[holeFileRowValues] = {hole.ts[j], hole.qOils[j], hole.qWaters.size()>j ? hole.qWaters[j] : 0.0};
+      out.write(reinterpret_cast<const char*>(row), sizeof(row));
+    }
+  }
+  if(!out)
+    throw std::runtime_error("Can't write " + filename);
+}
+
+HoleFile::HoleFile(const std::string& filename)
+: _filename(filename)
+{
+  std::ifstream f(filename, std::ios::binary | std::ios::ate);
+  if(!f)
+    throw std::invalid_argument("Can't open " + filename);
+  const uint64_t fileSize = f.tellg();
+  f.seekg(0);
+  char magic[sizeof(holeFileMagic)];
+  f.read(magic, sizeof(magic));
+  if(!f || !std::equal(magic, magic + sizeof(magic), holeFileMagic))
+    throw std::invalid_argument("Not a hole file: " + filename);
+  uint64_t nHoles = 0;
+  uint64_t nRows = 0;
+  readValue(f, nHoles);
+  readValue(f, nRows);
+  // sizes are checked before allocation: every index entry has offset,
+  // rows count and name size
+  const uint64_t indexEntryBytes = 2*sizeof(uint64_t) + sizeof(uint32_t);
+  const uint64_t rowBytes = holeFileRowValues*sizeof(double);
+  const uint64_t headerBytes = sizeof(holeFileMagic) + 2*sizeof(uint64_t);
+  if(!f || nHoles > (fileSize - headerBytes)/indexEntryBytes || nRows > fileSize/rowBytes)
+    throw std::invalid_argument("Broken hole file: " + filename);
+  _holes.resize(nHoles);
+  uint64_t nRowsIndexed = 0;
+  for(HoleIndex & hole: _holes)
+  {
+    uint32_t nameSize = 0;
+    readValue(f, hole.offset);
+    readValue(f, hole.nRows);
+    readValue(f, nameSize);
+    // holes are stored one after another
+    if(!f || hole.offset != nRowsIndexed || hole.nRows > nRows - nRowsIndexed || nameSize > fileSize - uint64_t(f.tellg()))
+      throw std::invalid_argument("Broken hole file: " + filename);
+    nRowsIndexed += hole.nRows;
+    hole.name.resize(nameSize);
+    f.read(&hole.name[0], nameSize);
+  }
+  if(!f || nRowsIndexed != nRows)
+    throw std::invalid_argument("Broken hole file: " + filename);
+  _nRows = nRows;
+  _dataOffset = f.tellg();
+  if(fileSize != _dataOffset + nRows*rowBytes)
+    throw std::invalid_argument("Truncated hole file: " + filename);
+}
+
+const std::vector<HoleFile::HoleIndex>& HoleFile::GetHoles() const
+{
+  return _holes;
+}
+
+size_t HoleFile::GetRowsCount() const
+{
+  return _nRows;
+}
+
+TaskData HoleFile::ReadHoles(size_t iFirst, size_t iLast) const
+{
+  if(iFirst > iLast || iLast > _holes.size())
+    throw std::out_of_range("Wrong holes range");
+  TaskData taskData;
+  taskData.holes.resize(iLast - iFirst);
+  std::ifstream f(_filename, std::ios::binary);
+  if(iFirst < iLast)
+    f.seekg(_dataOffset + _holes[iFirst].offset*holeFileRowValues*sizeof(double));
+  double row[holeFileRowValues];
+  for(size_t i = iFirst; i<iLast; ++i)
+  {
+    HoleData & hole = taskData.holes[i - iFirst];
+    hole.name = _holes[i].name;
+    for(size_t j = 0; j<_holes[i].nRows; ++j)
+    {
+      f.read(reinterpret_cast<char*>(row), sizeof(row));
+      hole.ts.push_back(row[0]);
+      hole.qOils.push_back(row[1]);
+      hole.qWaters.push_back(row[2]);
+    }
+  }
+  if(!f)
+    throw std::runtime_error("Can't read " + _filename);
+  return taskData;
+}
+
+std::vector<OptimizedHoleData> HoleFile::readChunk(std::ifstream& f, size_t iFirst, size_t iLast, bool isWater) const
+{
+  std::vector<OptimizedHoleData> chunk;
+  if(iFirst >= iLast)
+    return chunk;
+  const uint64_t nRows = _holes[iLast-1].offset + _holes[iLast-1].nRows - _holes[iFirst].offset;
+  std::vector<double> rows(nRows*holeFileRowValues);
+  f.seekg(_dataOffset + _holes[iFirst].offset*holeFileRowValues*sizeof(double));
+  f.read(reinterpret_cast<char*>(rows.data()), rows.size()*sizeof(double));
+  if(!f)
+    throw std::runtime_error("Can't read " + _filename);
+  
+  chunk.reserve(iLast - iFirst);
+  std::vector<double> ts;
+  std::vector<double> qs;
+  const double* row = rows.data();
+  for(size_t i = iFirst; i<iLast; ++i)
+  {
+    ts.resize(_holes[i].nRows);
+    qs.resize(_holes[i].nRows);
+    for(size_t j = 0; j<_holes[i].nRows; ++j, row += holeFileRowValues)
+    {
+      ts[j] = row[0];
+      qs[j] = isWater ? row[2] : row[1];
+    }
+    chunk.emplace_back(ts, qs);
+  }
+  return chunk;
+}
+
+void HoleFile::ForEachChunk(bool isWater, size_t chunkRows, const HoleFile::ChunkFunc& func) const
+{
+  std::ifstream f(_filename, std::ios::binary);
+  if(!f)
+    throw std::invalid_argument("Can't open " + _filename);
+  // chunk ends after the hole which fills chunkRows, at least one hole
+  auto chunkEnd = [this, chunkRows](size_t iFirst)
+  {
+    size_t nRows = 0;
+    size_t iLast = iFirst;
+    while(iLast<_holes.size() && (iLast == iFirst || nRows + _holes[iLast].nRows <= chunkRows))
+      nRows += _holes[iLast++].nRows;
+    return iLast;
+  };
+  auto readAsync = [this, &f, isWater](size_t iFirst, size_t iLast)
+  {
+    return std::async(std::launch::async, &HoleFile::readChunk, this, std::ref(f), iFirst, iLast, isWater);
+  };
+  
+  size_t iFirst = 0;
+  size_t iLast = chunkEnd(iFirst);
+  std::future<std::vector<OptimizedHoleData>> next = readAsync(iFirst, iLast);
+  while(iFirst<_holes.size())
+  {
+    const std::vector<OptimizedHoleData> chunk = next.get();
+    const size_t iNextLast = chunkEnd(iLast);
+    if(iLast<_holes.size())
+      next = readAsync(iLast, iNextLast);
+    func(iFirst, chunk);
+    iFirst = iLast;
+    iLast = iNextLast;
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef HOLEFILE_H
+#define HOLEFILE_H
+
+#include "regressionmodels.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <fstream>
+#include <cstdint>
+
+/// Binary hole-major task data for out-of-core fitting.
+/// Layout: header, hole index (rows offset, rows count, name) and rows of
+/// every hole stored contiguously as working hours, oil tons, water tons
+class HoleFile
+{
+public:
+  struct HoleIndex
+  {
+    std::string name;
+    uint64_t offset;
+    uint64_t nRows;
+  };
+  
+  /// Converts CSV in two streaming passes: counts rows of every hole, then
+  /// writes rows to their places. Rows of every hole are buffered and
+  /// written by contiguous runs, hole index and buffers of about
+  /// bufferBytes in total are kept in memory
+  static void ConvertCSV(const std::string & csvFilename, const std::string & filename, size_t bufferBytes = 64 << 20);
+  static void Write(const TaskData & taskData, const std::string & filename);
+  
+  /// Throws invalid_argument if header does not match file size
+  explicit HoleFile(const std::string & filename);
+  
+  const std::vector<HoleIndex> & GetHoles() const;
+  size_t GetRowsCount() const;
+  
+  /// Reads holes [iFirst, iLast) to memory
+  TaskData ReadHoles(size_t iFirst, size_t iLast) const;
+  
+  typedef std::function<void(size_t iFirstHole, const std::vector<OptimizedHoleData> & chunk)> ChunkFunc;
+  /// Reads holes by chunks of about chunkRows rows and calls func for every
+  /// chunk in order. Next chunk is read asynchronously while func works,
+  /// so at most two chunks are in memory
+  void ForEachChunk(bool isWater, size_t chunkRows, const ChunkFunc & func) const;
+  
+private:
+  std::string _filename;
+  std::vector<HoleIndex> _holes;
+  uint64_t _dataOffset = 0;
+  size_t _nRows = 0;
+  
+  static void writeIndex(std::ostream & os, const std::vector<HoleIndex> & holes, uint64_t nRows);
+  /// Reads holes [iFirst, iLast)
+  std::vector<OptimizedHoleData> readChunk(std::ifstream & f, size_t iFirst, size_t iLast, bool isWater) const;
+};
+
+#endif // HOLEFILE_H
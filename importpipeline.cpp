@@ -0,0 +1,112 @@
+#include "importpipeline.h"
+#include "dataimporter.h"
+#include "boundedqueue.h"
+#include "memorytracker.h"
+#include <fstream>
+#include <map>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+
+namespace
+{
+/// Imported data of task data read by CSVDataImporter
+ImportedData fromTaskData(TaskData taskData)
+{
+  ImportedData data;
+  MemoryTracker::Scope scope(MemoryTracker::optimizedTaskData);
+  data.oil = OptimizedTaskData(taskData);
+  data.water.holes.reserve(taskData.holes.size());
+  for(const HoleData& hole: taskData.holes)
+    data.water.holes.emplace_back(hole.ts, hole.qWaters);
+  data.taskData = std::move(taskData);
+  return data;
+}
+}
+
+ImportedData ImportPipeline::Import(const std::string& filename) const
+{
+  // rows of a hole may be split between files, so files are merged by
+  // concurrent ReadFiles before optimized data is built
+  const std::vector<std::string> filenames = CSVDataImporter::ListFiles(filename);
+  if(filenames.size() != 1 || filenames[0] != filename)
+    return fromTaskData(CSVDataImporter::ReadFiles(filenames));
+  
+  std::ifstream f(filename);
+  if(!f)
+    throw std::invalid_argument("Can't open " + filename);
+  
+  typedef std::vector<CSVDataImporter::LineData> Batch;
+  BoundedQueue<Batch> batches(queueBatches);
+  std::exception_ptr readError;
+  std::thread reader([&]()
+  {
+    try
+    {
+      std::string lineStr;
+      Batch batch;
+      batch.reserve(batchLines);
+      CSVDataImporter::LineData lineData;
+      while(std::getline(f, lineStr))
+      {
+        if(!CSVDataImporter::ParseLine(lineStr, lineData))
+          continue;
+        batch.push_back(lineData);
+        if(batch.size() == batchLines)
+        {
+          batches.Push(std::move(batch));
+          batch = Batch();
+          batch.reserve(batchLines);
+        }
+      }
+      if(!batch.empty())
+        batches.Push(std::move(batch));
+    }
+    catch(...)
+    {
+      readError = std::current_exception();
+    }
+    batches.Close();
+  });
+  
+  ImportedData data;
+  MemoryTracker::Scope scope(MemoryTracker::taskData);
+  try
+  {
+    std::map<std::string, size_t> holeNamesToIndex;
+    Batch batch;
+    while(batches.Pop(batch))
+    {
+      for(const CSVDataImporter::LineData& lineData: batch)
+      {
+        auto it = holeNamesToIndex.find(lineData.holeName);
+        if(it == holeNamesToIndex.end())
+        {
+          it = holeNamesToIndex.emplace(lineData.holeName, data.taskData.holes.size()).first;
+          data.taskData.holes.emplace_back();
+          data.taskData.holes.back().name = lineData.holeName;
+          data.oil.holes.emplace_back();
+          data.water.holes.emplace_back();
+        }
+        HoleData& hole = data.taskData.holes[it->second];
+        hole.ts.push_back(lineData.workHours);
+        hole.qOils.push_back(lineData.oilTons);
+        hole.qWaters.push_back(lineData.waterTons);
+        MemoryTracker::Scope scope(MemoryTracker::optimizedTaskData);
+        data.oil.holes[it->second].Append(lineData.workHours, lineData.oilTons);
+        data.water.holes[it->second].Append(lineData.workHours, lineData.waterTons);
+      }
+    }
+  }
+  catch(...)
+  {
+    // unblock reader before rethrow
+    batches.Close();
+    reader.join();
+    throw;
+  }
+  reader.join();
+  if(readError)
+    std::rethrow_exception(readError);
+  return data;
+}
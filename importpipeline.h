@@ -0,0 +1,36 @@
+#ifndef IMPORTPIPELINE_H
+#define IMPORTPIPELINE_H
+
+#include "regressionmodels.h"
+#include <string>
+
+/// Task data with optimized task data of oil and water models
+struct ImportedData
+{
+  TaskData taskData;
+  OptimizedTaskData oil;
+  OptimizedTaskData water;
+};
+
+/// CSV import by overlapping stages connected by bounded queues:
+/// reader thread reads and parses batches of lines, while this thread
+/// groups them by holes and appends them to optimized task data.
+/// Result is the same as of CSVDataImporter::read and OptimizedTaskData.
+/// Directory or glob pattern is read by CSVDataImporter::ReadFiles
+class ImportPipeline
+{
+public:
+  ImportPipeline()
+  : batchLines(4096)
+  , queueBatches(8)
+  {
+  }
+  /// Lines parsed per batch
+  size_t batchLines;
+  /// Capacity of queue of parsed batches
+  size_t queueBatches;
+  
+  ImportedData Import(const std::string & filename) const;
+};
+
+#endif // IMPORTPIPELINE_H
@@ -3,56 +3,427 @@
 #include "dataimporter.h"
 #include "tester.h"
 #include "analyze.h"
+#include "outofcoremodel.h"
+#include "shardedsolver.h"
+#include "fitserver.h"
+#include "bootstrap.h"
+#include "backtest.h"
+#include "memorytracker.h"
+#include "perfcounters.h"
+#include "modelregistry.h"
+#include "compacttaskdata.h"
 #include <boost/program_options.hpp>
 
 int main(int argc, char **argv) 
 {
   std::string filename;
   bool isTest;
+  std::string goldenDir;
   bool isAnalyze;
   bool isSolve;
+  std::string modelList;
+  size_t nStartCandidates;
+  size_t nBreakpointCandidates = 0;
+  bool isMixedPrecision;
+  bool isMatrixFree;
+  bool isVarPro;
+  std::string holeFilename;
+  std::string compactFilename;
+  bool isConvert;
+  size_t chunkRows;
+  size_t nShards;
+  std::string socketPath;
+  bool isServe;
+  std::string query;
+  size_t nBootstrap;
+  size_t windowRows;
+  size_t windowStep;
+  bool isBacktest;
+  size_t groupPrefix;
+  std::string groupFilename;
+  size_t backtestHorizon;
+  std::string checkpointFile;
+  bool isResume;
+  bool isMemoryReport;
+  bool isPerfCounters;
+  bool isShardWorker;
+  std::string shardFamily;
+  size_t shardFirst;
+  size_t shardLast;
+  bool isShardWater;
   
   boost::program_options::options_description desc("General options");
   desc.add_options()
   ("help,h", "Show help")
-  ("filepath,f", boost::program_options::value<std::string>(&filename)->default_value("../taskData.csv"), "filename")
+  ("filepath,f", boost::program_options::value<std::string>(&filename)->default_value("../taskData.csv"), "csv file, directory of csv files or glob pattern of csv files, e.g. 'exports/*_2020-*.csv'. Several files are read concurrently")
   ("test,t"    , boost::program_options::bool_switch(&isTest)->default_value(false), "run test")
+  ("golden"    , boost::program_options::value<std::string>(&goldenDir)->default_value(""), "rerun analyze of filepath and compare with results of this directory")
   ("analyze,a" , boost::program_options::bool_switch(&isAnalyze)->default_value(true), "run analyze")
   ("solve,s"   , boost::program_options::bool_switch(&isSolve)->default_value(false), "run solve")
+  ("models"    , boost::program_options::value<std::string>(&modelList)->default_value(""), "models of analyze and solve as <target>:<family> list, e.g. QOil:F3,QWater:F1. Default: all analyzed models, solve - QOil:F1")
+  ("starts"    , boost::program_options::value<size_t>(&nStartCandidates)->default_value(0), "number of multi-start candidates for solve, 0 - disabled")
+  ("breakpoint-candidates", boost::program_options::value<size_t>(&nBreakpointCandidates), "tau candidates of breakpoint sweep after every step of analyze, solve and backtest, 0 - no sweep. Default: 64 for F4, functions without breakpoint are not swept")
+  ("mixed-precision", boost::program_options::bool_switch(&isMixedPrecision)->default_value(false), "store jacobi matrix in float for solve")
+  ("matrix-free", boost::program_options::bool_switch(&isMatrixFree)->default_value(false), "solve without jacobi matrix")
+  ("varpro"    , boost::program_options::bool_switch(&isVarPro)->default_value(false), "solve by variable projection: q0i are eliminated, iterations are over function params only")
+  ("hole-file" , boost::program_options::value<std::string>(&holeFilename)->default_value(""), "binary hole file, solve reads it by chunks without loading task to memory")
+  ("compact-file", boost::program_options::value<std::string>(&compactFilename)->default_value(""), "compact task data file, solve and backtest read task data from it instead of csv")
+  ("convert"   , boost::program_options::bool_switch(&isConvert)->default_value(false), "convert csv file to hole file and compact file")
+  ("chunk-rows", boost::program_options::value<size_t>(&chunkRows)->default_value(1<<20), "rows per chunk of hole file")
+  ("shards"    , boost::program_options::value<size_t>(&nShards)->default_value(0), "solve hole file by this number of worker processes, 0 - in this process")
+  ("bootstrap" , boost::program_options::value<size_t>(&nBootstrap)->default_value(0), "number of residual bootstrap replicates after solve, 0 - disabled")
+  ("rolling-window", boost::program_options::value<size_t>(&windowRows)->default_value(0), "solve every window of this number of months, 0 - whole data")
+  ("rolling-step", boost::program_options::value<size_t>(&windowStep)->default_value(6), "months between rolling windows")
+  ("group-prefix", boost::program_options::value<size_t>(&groupPrefix)->default_value(0), "solve with own function params of every group of holes with the same first chars of name, 0 - no groups")
+  ("group-file", boost::program_options::value<std::string>(&groupFilename)->default_value(""), "solve with own function params of every group of holes from file of hole,group lines")
+  ("backtest"  , boost::program_options::bool_switch(&isBacktest)->default_value(false), "fit every function on first months of holes and score forecast of next months")
+  ("backtest-horizon", boost::program_options::value<size_t>(&backtestHorizon)->default_value(12), "scored months after every backtest cutoff")
+  ("checkpoint", boost::program_options::value<std::string>(&checkpointFile)->default_value(""), "checkpoint file of solve")
+  ("resume"    , boost::program_options::bool_switch(&isResume)->default_value(false), "continue solve or analyze from checkpoints")
+  ("memory-report", boost::program_options::bool_switch(&isMemoryReport)->default_value(false), "print current and peak memory by category after each phase")
+  ("perf-counters", boost::program_options::bool_switch(&isPerfCounters)->default_value(false), "print hardware counters of solve phases of every model and every step")
+  ("socket"    , boost::program_options::value<std::string>(&socketPath)->default_value("/tmp/gptesttask.sock"), "unix socket of fit server")
+  ("serve"     , boost::program_options::bool_switch(&isServe)->default_value(false), "run fit server")
+  ("query"     , boost::program_options::value<std::string>(&query)->default_value(""), "send JSON request to fit server and print reply")
   ;
   
+  // options of worker processes started by ShardedSolver
+  boost::program_options::options_description workerDesc("Shard worker options");
+  workerDesc.add_options()
+  ("shard-worker"  , boost::program_options::bool_switch(&isShardWorker)->default_value(false), "run shard worker")
+  ("shard-family"  , boost::program_options::value<std::string>(&shardFamily)->default_value("F1"), "model function family")
+  ("shard-first"   , boost::program_options::value<size_t>(&shardFirst)->default_value(0), "first hole")
+  ("shard-last"    , boost::program_options::value<size_t>(&shardLast)->default_value(0), "last hole")
+  ("shard-water"   , boost::program_options::bool_switch(&isShardWater)->default_value(false), "fit water")
+  ;
+  boost::program_options::options_description allDesc;
+  allDesc.add(desc).add(workerDesc);
+  
   boost::program_options::variables_map vm;
-  boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+  boost::program_options::store(boost::program_options::parse_command_line(argc, argv, allDesc), vm);
   boost::program_options::notify(vm);    
   if (vm.count("help")) {
     std::cout << desc << "\n";
     return 0;
   }
+  
+  if(isMemoryReport)
+    MemoryTracker::Enable();
+  if(isPerfCounters && !PerfCounters::Enable())
+    std::cout<<"Hardware counters are unavailable: "<<PerfCounters::GetError()<<std::endl;
+  
+  if(isShardWorker)
+  {
+    try
+    {
+      return ShardedSolver::RunWorker(holeFilename, shardFamily, shardFirst, shardLast, isShardWater, 0);
+    }
+    catch(std::exception &e)
+    {
+      std::cerr<<"Shard worker exception:"<<e.what()<<std::endl;
+      return 1;
+    }
+  }
 
+  if(isServe)
+  {
+    try
+    {
+      FitServer server(socketPath);
+      server.Run();
+    }
+    catch(std::exception &e)
+    {
+      std::cout<<"Exception:"<<e.what()<<std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  
+  if(!query.empty())
+  {
+    try
+    {
+      std::cout<<FitServer::Query(socketPath, query)<<std::endl;
+    }
+    catch(std::exception &e)
+    {
+      std::cout<<"Exception:"<<e.what()<<std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  // task data of csv or of compact file
+  auto readTaskData = [&filename, &compactFilename]()
+  {
+    return compactFilename.empty() ? CSVDataImporter().read(filename) : CompactTaskData::Read(compactFilename).ToTaskData();
+  };
+  auto readOptimizedTaskData = [&filename, &compactFilename](bool isWater)
+  {
+    if(!compactFilename.empty())
+      return std::make_shared<const OptimizedTaskData>(CompactTaskData::Read(compactFilename).ToOptimized(isWater));
+    TaskData taskData = CSVDataImporter().read(filename);
+    if(isWater)
+      TaskDataHelper::SwapOilWater(taskData);
+    return std::make_shared<const OptimizedTaskData>(taskData);
+  };
+  
+  if(isBacktest)
+  {
+    try
+    {
+      const TaskDataView view(readOptimizedTaskData(false));
+      BacktestParams bp;
+      bp.horizonRows = backtestHorizon;
+      auto report = [](const std::string & name, const BacktestResult & result)
+      {
+        std::cout<<name<<" total RMSE "<<result.totalRmse<<std::endl;
+        for(size_t k = 0; k<result.cutoffs.size(); ++k)
+          std::cout<<"  cutoff "<<result.cutoffs[k]<<(result.isConverged[k] ? "" : " not solved")
+            <<" rows "<<result.nScoredRows[k]<<" RMSE "<<result.rmse[k]<<" bias "<<result.bias[k]<<std::endl;
+      };
+      // cutoffs are fitted with breakpoint sweep of the family like analyze
+      // fits, --breakpoint-candidates replaces it
+      auto familyParams = [&bp, &vm, nBreakpointCandidates](const std::string & family)
+      {
+        BacktestParams familyBp = bp;
+        familyBp.sp.nBreakpointCandidates = vm.count("breakpoint-candidates") ? nBreakpointCandidates : ModelRegistry::GetFamily(family).nBreakpointCandidates;
+        return familyBp;
+      };
+      report("Function1", Backtest<Function1>(view, familyParams("F1")));
+      report("Function2", Backtest<Function2>(view, familyParams("F2")));
+      report("Function3", Backtest<Function3>(view, familyParams("F3")));
+      report("Function4", Backtest<Function4>(view, familyParams("F4")));
+    }
+    catch(std::exception &e)
+    {
+      std::cout<<"Exception:"<<e.what()<<std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  
   if(isTest)
+  {
+    Tester tester(filename);
+    return tester.Test() ? 0 : 1;
+  }
+  
+  if(!goldenDir.empty())
   {
     Tester tester;
-    tester.Test();
+    return tester.TestGolden(filename, goldenDir) ? 0 : 1;
+  }
+  
+  std::vector<ModelSpec> models;
+  try
+  {
+    if(!modelList.empty())
+      models = ModelRegistry::Parse(modelList);
+  }
+  catch(std::exception &e)
+  {
+    std::cout<<"Exception:"<<e.what()<<std::endl;
+    return 1;
   }
+  // explicit number of breakpoint candidates replaces defaults of families
+  auto setBreakpointCandidates = [&vm, nBreakpointCandidates](std::vector<ModelSpec> specs)
+  {
+    if(vm.count("breakpoint-candidates"))
+      for(ModelSpec & spec: specs)
+        spec.nBreakpointCandidates = nBreakpointCandidates;
+    return specs;
+  };
   
-  if(isAnalyze)
+  if(isConvert)
+  {
+    try
+    {
+      if(holeFilename.empty() && compactFilename.empty())
+        throw std::invalid_argument("hole-file or compact-file is not set");
+      if(!holeFilename.empty())
+        HoleFile::ConvertCSV(filename, holeFilename);
+      if(!compactFilename.empty())
+      {
+        const CompactTaskData compact = CompactTaskData::ReadCSV(filename);
+        compact.Write(compactFilename);
+        std::cout<<"Compact task data: "<<compact.GetBytes()<<" bytes"<<std::endl;
+      }
+    }
+    catch(std::exception &e)
+    {
+      std::cout<<"Exception:"<<e.what()<<std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  
+  if(isSolve && !holeFilename.empty() && nShards > 0)
+  {
+    try
+    {
+      if(models.empty())
+        models = ModelRegistry::Parse("QOil:F1");
+      for(const ModelSpec & spec: models)
+      {
+        ShardedSolver solver(holeFilename, spec, nShards);
+        solver.SolverInit();
+        if(!solver.Solve())
+        {
+          std::cout<<"Solution not found"<<std::endl;
+        }
+        std::cout<<spec.name<<": Result model params"<<solver.GetResult().transpose()<<std::endl;
+      }
+    }
+    catch(std::exception &e)
+    {
+      std::cout<<"Exception:"<<e.what()<<std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  
+  if(isSolve && !holeFilename.empty())
+  {
+    try
+    {
+      auto holeFile = std::make_shared<const HoleFile>(holeFilename);
+      if(models.empty())
+        models = ModelRegistry::Parse("QOil:F1");
+      for(const ModelSpec & spec: models)
+      {
+        Solver solver(ModelRegistry::GetFamily(spec.family).makeOutOfCoreModel(holeFile, spec.isWater, chunkRows));
+        Solver::SolverParams sp;
+        sp.matrixFree = true;
+        sp.keepYMinusF = false;
+        sp.variableProjection = isVarPro;
+        solver.SolverInit(sp);
+        if(!solver.Solve())
+        {
+          std::cout<<spec.name<<": Solution not found"<<std::endl;
+        }
+        std::cout<<spec.name<<": Result model params"<<solver.GetResult().transpose()<<std::endl;
+      }
+    }
+    catch(std::exception &e)
+    {
+      std::cout<<"Exception:"<<e.what()<<std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  
+  // analyze loads whole csv, so modes of files larger than memory return
+  // before it and solves of compact file skip it
+  if(isAnalyze && !(isSolve && !compactFilename.empty()))
   {
     Analyzer an;
-    an.Analyze(filename);
+    an.Analyze(filename, setBreakpointCandidates(models.empty() ? ModelRegistry::GetDefaultModels() : models), isResume);
+  }
+  
+  if(isSolve && windowRows > 0)
+  {
+    try
+    {
+      RollingWindowParams rp;
+      rp.windowRows = windowRows;
+      rp.stepRows = windowStep;
+      if(models.empty())
+        models = ModelRegistry::Parse("QOil:F1");
+      for(const ModelSpec & spec: models)
+      {
+        const TaskDataView view(readOptimizedTaskData(spec.isWater));
+        const RollingWindowResult result = ModelRegistry::GetFamily(spec.family).fitRollingWindows(view, rp);
+        std::cout<<spec.name<<": "<<result.iFirstRows.size()<<" windows"<<std::endl;
+        for(size_t k = 0; k<result.iFirstRows.size(); ++k)
+          std::cout<<"  window from "<<result.iFirstRows[k]<<(result.isConverged[k] ? "" : " not solved")
+            <<" function params "<<result.funcParams.col(k).transpose()<<std::endl;
+      }
+    }
+    catch(std::exception &e)
+    {
+      std::cout<<"Exception:"<<e.what()<<std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  
+  if(isSolve && (groupPrefix > 0 || !groupFilename.empty()))
+  {
+    try
+    {
+      const TaskData taskData = readTaskData();
+      const HoleGroups groups = groupFilename.empty() ? HoleGroups::ByPrefix(taskData, groupPrefix) : HoleGroups::ByFile(taskData, groupFilename);
+      if(models.empty())
+        models = ModelRegistry::Parse("QOil:F1");
+      models = setBreakpointCandidates(models);
+      for(const ModelSpec & spec: models)
+      {
+        TaskData taskDataModel = taskData;
+        if(spec.isWater)
+          TaskDataHelper::SwapOilWater(taskDataModel);
+        const TaskDataView view(std::make_shared<const OptimizedTaskData>(taskDataModel));
+        const GroupedFitResult result = ModelRegistry::GetFamily(spec.family).fitGroups(view, groups, GroupedFitParams());
+        std::cout<<spec.name<<": "<<groups.names.size()<<" groups"<<std::endl;
+        for(size_t k = 0; k<groups.names.size(); ++k)
+          std::cout<<"  group "<<groups.names[k]<<" holes "<<groups.holes[k].size()<<(result.isConverged[k] ? "" : " not solved")
+            <<" function params "<<result.funcParams.col(k).transpose()<<std::endl;
+      }
+    }
+    catch(std::exception &e)
+    {
+      std::cout<<"Exception:"<<e.what()<<std::endl;
+      return 1;
+    }
+    return 0;
   }
   
   if(isSolve)
   {
     try
     {
-      CSVDataImporter dataImporter;
-      Solver solver(std::make_unique<RegressionModelLn1>(dataImporter.read(filename)));
-      solver.SolverInit();
-      if(!solver.Solve())
+      const TaskData taskData = readTaskData();
+      if(models.empty())
+        models = ModelRegistry::Parse("QOil:F1");
+      for(const ModelSpec & spec: models)
       {
-        std::cout<<"Solution not found"<<std::endl;
+        Solver solver(ModelRegistry::MakeModel(spec, taskData));
+        Solver::SolverParams sp;
+        sp.nStartCandidates = nStartCandidates;
+        sp.mixedPrecision = isMixedPrecision;
+        sp.matrixFree = isMatrixFree;
+        sp.variableProjection = isVarPro;
+        sp.nBreakpointCandidates = spec.nBreakpointCandidates;
+        // counters of every step are printed after step line
+        sp.verbose = PerfCounters::IsEnabled() ? 1 : 0;
+        // every model has its own checkpoint
+        if(!checkpointFile.empty() && models.size() > 1)
+          sp.checkpointFile = spec.name + "_" + checkpointFile;
+        else
+          sp.checkpointFile = checkpointFile;
+        const PerfCounters::Snapshot counters = PerfCounters::GetSnapshot();
+        if(isResume)
+          solver.SolverResume(sp);
+        else
+          solver.SolverInit(sp);
+        if(!solver.Solve())
+        {
+          std::cout<<spec.name<<": Solution not found"<<std::endl;
+        }
+        std::cout<<spec.name<<": Result model params"<<solver.GetResult().transpose()<<std::endl;
+        MemoryTracker::Report(std::cout, "solve " + spec.name);
+        PerfCounters::Report(std::cout, "solve " + spec.name, counters);
+        if(nBootstrap > 0)
+        {
+          Bootstrap::BootstrapParams bp;
+          bp.nReplicates = nBootstrap;
+          const Bootstrap::BootstrapResult bootstrap = Bootstrap::Run(solver, bp);
+          std::cout<<"Bootstrap: "<<bootstrap.replicates.cols()<<" of "<<nBootstrap<<" replicates converged"<<std::endl;
+          std::cout<<"Lower "<<bp.confidence<<" bound"<<bootstrap.lower.transpose()<<std::endl;
+          std::cout<<"Upper "<<bp.confidence<<" bound"<<bootstrap.upper.transpose()<<std::endl;
+        }
       }
-      std::cout<<"Result model params"<<solver.GetResult().transpose()<<std::endl;
     }
     catch(std::exception &e)
     {
@@ -0,0 +1,252 @@
+#include "memorytracker.h"
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <iomanip>
+#include <algorithm>
+
+static std::atomic<size_t> allocationCount(0);
+
+namespace
+{
+std::atomic<bool> isAccounting(false);
+thread_local MemoryTracker::Category currentCategory = MemoryTracker::other;
+
+/// Accounted live block
+struct Block
+{
+  void* p;
+  size_t bytes;
+  MemoryTracker::Category category;
+};
+
+/// Live blocks by open addressing without allocations of its own.
+/// Blocks over the load limit aren't accounted
+const size_t tableBits = 18;
+const size_t tableSize = size_t(1)<<tableBits;
+const size_t tableMask = tableSize - 1;
+const size_t maxBlocks = tableSize/4*3;
+
+/// Accounting state, guarded by accountingMutex
+struct Accounting
+{
+  Block blocks[tableSize];
+  size_t nBlocks;
+  size_t nSkipped;
+  size_t current[MemoryTracker::nCategories];
+  size_t peak[MemoryTracker::nCategories];
+  size_t totalCurrent;
+  size_t totalPeak;
+};
+Accounting accounting;
+std::mutex accountingMutex;
+
+size_t slot(const void* p)
+{
+  return (uint64_t(uintptr_t(p))*0x9E3779B97F4A7C15ull)>>(64 - tableBits);
+}
+
+void addBlock(void* p, size_t bytes, MemoryTracker::Category category)
+{
+  if(accounting.nBlocks >= maxBlocks)
+  {
+    ++accounting.nSkipped;
+    return;
+  }
+  size_t i = slot(p);
+  while(accounting.blocks[i].p)
+    i = (i + 1)&tableMask;
+  accounting.blocks[i] = Block{p, bytes, category};
+  ++accounting.nBlocks;
+  size_t& current = accounting.current[category];
+  current += bytes;
+  if(current > accounting.peak[category])
+    accounting.peak[category] = current;
+  accounting.totalCurrent += bytes;
+  if(accounting.totalCurrent > accounting.totalPeak)
+    accounting.totalPeak = accounting.totalCurrent;
+}
+
+/// Backward shift deletion keeps probe chains without tombstones
+void removeBlock(void* p)
+{
+  size_t i = slot(p);
+  while(accounting.blocks[i].p != p)
+  {
+    if(!accounting.blocks[i].p)
+      return;
+    i = (i + 1)&tableMask;
+  }
+  const Block& block = accounting.blocks[i];
+  accounting.current[block.category] -= block.bytes;
+  accounting.totalCurrent -= block.bytes;
+  --accounting.nBlocks;
+  for(size_t j = (i + 1)&tableMask; accounting.blocks[j].p; j = (j + 1)&tableMask)
+  {
+    const size_t k = slot(accounting.blocks[j].p);
+    const bool isInPlace = i<=j ? (i<k && k<=j) : (i<k || k<=j);
+    if(isInPlace)
+      continue;
+    accounting.blocks[i] = accounting.blocks[j];
+    i = j;
+  }
+  accounting.blocks[i].p = nullptr;
+}
+}
+
+MemoryTracker::Scope::Scope(MemoryTracker::Category category)
+: _prevCategory(currentCategory)
+{
+  currentCategory = category;
+}
+
+MemoryTracker::Scope::~Scope()
+{
+  currentCategory = _prevCategory;
+}
+
+size_t MemoryTracker::GetAllocationCount()
+{
+  return allocationCount.load(std::memory_order_relaxed);
+}
+
+void MemoryTracker::Enable()
+{
+#ifdef __GLIBC__
+  isAccounting.store(true);
+#endif
+}
+
+bool MemoryTracker::IsEnabled()
+{
+  return isAccounting.load(std::memory_order_relaxed);
+}
+
+size_t MemoryTracker::GetCurrentBytes(MemoryTracker::Category category)
+{
+  std::lock_guard<std::mutex> lock(accountingMutex);
+  return accounting.current[category];
+}
+
+size_t MemoryTracker::GetPeakBytes(MemoryTracker::Category category)
+{
+  std::lock_guard<std::mutex> lock(accountingMutex);
+  return accounting.peak[category];
+}
+
+size_t MemoryTracker::GetTotalPeakBytes()
+{
+  std::lock_guard<std::mutex> lock(accountingMutex);
+  return accounting.totalPeak;
+}
+
+void MemoryTracker::ResetPeaks()
+{
+  std::lock_guard<std::mutex> lock(accountingMutex);
+  for(size_t i = 0; i<nCategories; ++i)
+    accounting.peak[i] = accounting.current[i];
+  accounting.totalPeak = accounting.totalCurrent;
+}
+
+const char* MemoryTracker::GetCategoryName(MemoryTracker::Category category)
+{
+  static const char* names[nCategories] = {"other", "taskData", "optimizedTaskData", "workingSet", "normalEquations", "results"};
+  return names[category];
+}
+
+void MemoryTracker::Report(std::ostream& os, const std::string& phase)
+{
+  if(!IsEnabled())
+    return;
+  // printing may allocate, so counters are copied under lock first
+  size_t current[nCategories];
+  size_t peak[nCategories];
+  size_t totalCurrent, totalPeak, nSkipped;
+  {
+    std::lock_guard<std::mutex> lock(accountingMutex);
+    std::copy(accounting.current, accounting.current + nCategories, current);
+    std::copy(accounting.peak, accounting.peak + nCategories, peak);
+    totalCurrent = accounting.totalCurrent;
+    totalPeak = accounting.totalPeak;
+    nSkipped = accounting.nSkipped;
+  }
+  const double mb = 1024.0*1024.0;
+  const auto flags = os.flags();
+  os<<"Memory after "<<phase<<", MB:"<<std::endl;
+  os<<std::setw(20)<<std::left<<"  category"<<std::right<<std::setw(12)<<"current"<<std::setw(12)<<"peak"<<std::endl;
+  os<<std::fixed<<std::setprecision(1);
+  for(size_t i = 0; i<nCategories; ++i)
+    os<<"  "<<std::setw(18)<<std::left<<GetCategoryName(Category(i))<<std::right
+      <<std::setw(12)<<current[i]/mb<<std::setw(12)<<peak[i]/mb<<std::endl;
+  os<<"  "<<std::setw(18)<<std::left<<"total"<<std::right
+    <<std::setw(12)<<totalCurrent/mb<<std::setw(12)<<totalPeak/mb<<std::endl;
+  if(nSkipped > 0)
+    os<<"  "<<nSkipped<<" blocks not accounted: too many live blocks"<<std::endl;
+  os.flags(flags);
+}
+
+#ifdef __GLIBC__
+#include <malloc.h>
+
+// glibc exports its allocator under __libc_ names, so malloc of the
+// program can be wrapped without own allocator implementation.
+// Blocks of posix_memalign and aligned_alloc aren't accounted
+extern "C"
+{
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t n, size_t size);
+  void* __libc_realloc(void* p, size_t size);
+  void __libc_free(void* p);
+
+  void* malloc(size_t size) noexcept
+  {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* p = __libc_malloc(size);
+    if(p && isAccounting.load(std::memory_order_relaxed))
+    {
+      std::lock_guard<std::mutex> lock(accountingMutex);
+      addBlock(p, malloc_usable_size(p), currentCategory);
+    }
+    return p;
+  }
+
+  void* calloc(size_t n, size_t size) noexcept
+  {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* p = __libc_calloc(n, size);
+    if(p && isAccounting.load(std::memory_order_relaxed))
+    {
+      std::lock_guard<std::mutex> lock(accountingMutex);
+      addBlock(p, malloc_usable_size(p), currentCategory);
+    }
+    return p;
+  }
+
+  void* realloc(void* p, size_t size) noexcept
+  {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if(!isAccounting.load(std::memory_order_relaxed))
+      return __libc_realloc(p, size);
+    // lock is held over realloc, so freed p can't be reused by other thread
+    // before its block is removed
+    std::lock_guard<std::mutex> lock(accountingMutex);
+    void* pNew = __libc_realloc(p, size);
+    if(p && (pNew || size == 0))
+      removeBlock(p);
+    if(pNew)
+      addBlock(pNew, malloc_usable_size(pNew), currentCategory);
+    return pNew;
+  }
+
+  void free(void* p) noexcept
+  {
+    // block is removed before p can be reused by other thread
+    if(p && isAccounting.load(std::memory_order_relaxed))
+    {
+      std::lock_guard<std::mutex> lock(accountingMutex);
+      removeBlock(p);
+    }
+    __libc_free(p);
+  }
+}
+#endif
@@ -0,0 +1,62 @@
+#ifndef MEMORYTRACKER_H
+#define MEMORYTRACKER_H
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+/// Heap allocation statistics of the whole program.
+/// malloc family is wrapped (glibc only), so Eigen, STL and OpenMP
+/// allocations are all counted
+class MemoryTracker
+{
+public:
+  /// Categories of accounted bytes. Allocation is accounted to the category
+  /// of allocating thread, free returns bytes to the category of the block
+  enum Category
+  {
+    other,
+    taskData,
+    optimizedTaskData,
+    /// Jacobi matrix and y-f of WorkingSet
+    workingSet,
+    /// J^T J, Schur complement and their solver temporaries
+    normalEquations,
+    /// Fitted params and deltas of AnalyzeSet
+    results,
+    nCategories
+  };
+
+  /// Sets category of allocations of this thread while it exists.
+  /// OpenMP threads don't inherit it, their allocations are other
+  class Scope
+  {
+    Category _prevCategory;
+  public:
+    explicit Scope(Category category);
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+  };
+
+  /// Number of malloc, calloc and realloc calls since program start
+  static size_t GetAllocationCount();
+
+  /// Starts byte accounting of blocks allocated from now on, it can't be stopped.
+  /// Blocks allocated before are never accounted. When accounting is off
+  /// malloc wrapper only checks a flag
+  static void Enable();
+  static bool IsEnabled();
+  /// Usable bytes of live blocks of category
+  static size_t GetCurrentBytes(Category category);
+  /// Max of current bytes of category since Enable or ResetPeaks
+  static size_t GetPeakBytes(Category category);
+  /// Max of current bytes of all categories together
+  static size_t GetTotalPeakBytes();
+  /// Peaks restart from current bytes, so the next report shows peaks of a phase
+  static void ResetPeaks();
+  static const char* GetCategoryName(Category category);
+  /// Prints current and peak megabytes by category after phase
+  static void Report(std::ostream& os, const std::string& phase);
+};
+
+#endif // MEMORYTRACKER_H
@@ -0,0 +1,120 @@
+#include "mixture.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+void Mixture::Write(std::ostream& os) const
+{
+  os<<(kind == Gaussian ? "gaussian" : "logistic")<<std::endl;
+  os<<"weights: "<<weights.transpose()<<std::endl;
+  os<<"means: "<<means.transpose()<<std::endl;
+  os<<"scales: "<<scales.transpose()<<std::endl;
+  os<<"log likelihood: "<<logLikelihood<<", iterations: "<<nIter<<std::endl;
+}
+
+void MixtureFitter::calcLogDensity(const Mixture& mixture, const Eigen::Ref<const Eigen::ArrayXd>& x, Eigen::ArrayXXd& logP)
+{
+  const Eigen::Index nComponents = mixture.weights.size();
+  logP.resize(x.size(), nComponents);
+  for(Eigen::Index k = 0; k<nComponents; ++k)
+  {
+    const double invScale = 1.0/mixture.scales[k];
+    const double logNorm = log(mixture.weights[k]*invScale);
+    if(mixture.kind == Mixture::Gaussian)
+      logP.col(k) = logNorm - 0.5*log(2*M_PI) - 0.5*((x - mixture.means[k])*invScale).square();
+    else
+    {
+      // symmetric form of -z - 2 ln(1+e^{-z}) without overflow
+      const auto absZ = ((x - mixture.means[k])*invScale).abs();
+      logP.col(k) = logNorm - absZ - 2*(-absZ).exp().log1p();
+    }
+  }
+}
+
+Mixture MixtureFitter::Fit(const Eigen::VectorXd& xIn, size_t nComponents, Mixture::Kind kind) const
+{
+  const Eigen::Index n = xIn.size();
+  if(nComponents == 0 || n < Eigen::Index(nComponents))
+    throw std::invalid_argument("Too few points for mixture");
+  const Eigen::ArrayXd x = xIn.array();
+  
+  Mixture mixture;
+  mixture.kind = kind;
+  std::vector<double> sorted(x.data(), x.data() + n);
+  std::sort(sorted.begin(), sorted.end());
+  const double mean = x.mean();
+  const double sigma = std::sqrt((x - mean).square().mean());
+  mixture.weights.setConstant(nComponents, 1.0/nComponents);
+  mixture.means.resize(nComponents);
+  for(size_t k = 0; k<nComponents; ++k)
+    mixture.means[k] = sorted[size_t((k + 0.5)/nComponents*(n-1))];
+  mixture.scales.setConstant(nComponents, std::max(sigma, 1e-12));
+  if(kind == Mixture::Logistic)
+    mixture.scales *= std::sqrt(3.0)/M_PI;
+  
+  const Eigen::Index blockSize = 4096;
+  const Eigen::Index nBlocks = (n + blockSize - 1)/blockSize;
+  // per block: sums of responsibilities, r*(x-c), r*(x-c)^2 by components,
+  // log likelihood. Shift c is current mean of component, so variance has
+  // no cancellation of E[x^2] - m^2
+  Eigen::ArrayXXd blockSums(3*nComponents + 1, nBlocks);
+  // E-step for mixture, returns sums of blocks
+  auto calcSums = [&]()
+  {
+    #pragma omp parallel
+    {
+      Eigen::ArrayXXd logP;
+      Eigen::ArrayXd logSum;
+      Eigen::ArrayXd shifted;
+      #pragma omp for schedule(static)
+      for(Eigen::Index iBlock = 0; iBlock<nBlocks; ++iBlock)
+      {
+        const Eigen::Index iFirst = iBlock*blockSize;
+        const Eigen::Index nRows = std::min(blockSize, n - iFirst);
+        const auto xBlock = x.segment(iFirst, nRows);
+        calcLogDensity(mixture, xBlock, logP);
+        // log-sum-exp by components, then responsibilities in place
+        const Eigen::ArrayXd maxLogP = logP.rowwise().maxCoeff();
+        logP.colwise() -= maxLogP;
+        logP = logP.exp();
+        logSum = logP.rowwise().sum();
+        logP.colwise() /= logSum;
+        for(size_t k = 0; k<nComponents; ++k)
+        {
+          shifted = xBlock - mixture.means[k];
+          blockSums(k, iBlock) = logP.col(k).sum();
+          blockSums(nComponents + k, iBlock) = (logP.col(k)*shifted).sum();
+          blockSums(2*nComponents + k, iBlock) = (logP.col(k)*shifted.square()).sum();
+        }
+        blockSums(3*nComponents, iBlock) = (maxLogP + logSum.log()).sum();
+      }
+    }
+    return Eigen::ArrayXd(blockSums.rowwise().sum());
+  };
+  double logLikelihoodPrev = -std::numeric_limits<double>::infinity();
+  for(mixture.nIter = 0; mixture.nIter<nMaxIter; ++mixture.nIter)
+  {
+    const Eigen::ArrayXd sums = calcSums();
+    mixture.logLikelihood = sums[3*nComponents];
+    
+    for(size_t k = 0; k<nComponents; ++k)
+    {
+      const double r = sums[k];
+      if(!(r > 0))
+        continue;
+      const double meanShift = sums[nComponents + k]/r;
+      mixture.weights[k] = r/n;
+      mixture.means[k] += meanShift;
+      const double variance = std::max(sums[2*nComponents + k]/r - meanShift*meanShift, 1e-24);
+      mixture.scales[k] = std::sqrt(variance)*(kind == Mixture::Logistic ? std::sqrt(3.0)/M_PI : 1.0);
+    }
+    if(std::abs(mixture.logLikelihood - logLikelihoodPrev) < eps*std::abs(mixture.logLikelihood))
+      break;
+    logLikelihoodPrev = mixture.logLikelihood;
+  }
+  // likelihood of the last E-step is of params before the last M-step
+  mixture.logLikelihood = calcSums()[3*nComponents];
+  return mixture;
+}
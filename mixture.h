@@ -0,0 +1,57 @@
+#ifndef MIXTURE_H
+#define MIXTURE_H
+
+#include <string>
+#include <ostream>
+#include <Eigen/Dense>
+
+/// Mixture of one-dimensional distributions
+/// \f$ p(x) = \sum_k w_k p_k((x-m_k)/s_k)/s_k \f$
+struct Mixture
+{
+  enum Kind
+  {
+    Gaussian,
+    Logistic
+  };
+  Kind kind = Gaussian;
+  Eigen::VectorXd weights;
+  /// Locations \f$ m_k \f$
+  Eigen::VectorXd means;
+  /// Gaussian sigma or logistic scale \f$ s_k \f$
+  Eigen::VectorXd scales;
+  double logLikelihood = 0.0;
+  size_t nIter = 0;
+  
+  /// Writes kind, weights, means and scales by lines
+  void Write(std::ostream & os) const;
+};
+
+/// Fits mixtures by EM.
+/// E-step runs over fixed blocks of points in parallel, every block is
+/// evaluated by Eigen array expressions for all components at once.
+/// Block sums are reduced in block order, so result does not depend on
+/// number of threads
+class MixtureFitter
+{
+public:
+  MixtureFitter()
+  : nMaxIter(1000)
+  , eps(1e-10)
+  {
+  }
+  size_t nMaxIter;
+  /// Stop when relative log likelihood change is less than eps
+  double eps;
+  
+  /// Components start at quantiles of x with common scale.
+  /// Logistic M-step matches weighted moments: \f$ s = \sqrt{3}\sigma/\pi \f$,
+  /// so it is generalized EM, likelihood is exact
+  Mixture Fit(const Eigen::VectorXd & x, size_t nComponents, Mixture::Kind kind) const;
+  
+private:
+  /// Log density of every point block for every component
+  static void calcLogDensity(const Mixture & mixture, const Eigen::Ref<const Eigen::ArrayXd> & x, Eigen::ArrayXXd & logP);
+};
+
+#endif // MIXTURE_H
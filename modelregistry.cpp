@@ -0,0 +1,96 @@
+#include "modelregistry.h"
+#include "outofcoremodel.h"
+#include <stdexcept>
+#include <sstream>
+
+namespace
+{
+template<class TFunc>
+std::unique_ptr<IRegressionModel> makeModel(TaskData taskData, OptimizedTaskData oTD)
+{
+  return std::make_unique<RegressionModelLn<TFunc>>(std::move(taskData), std::move(oTD));
+}
+
+template<class TFunc>
+std::unique_ptr<IRegressionModel> makeOutOfCoreModel(std::shared_ptr<const HoleFile> holeFile, bool isWater, size_t chunkRows)
+{
+  return std::make_unique<OutOfCoreRegressionModelLn<TFunc>>(std::move(holeFile), isWater, chunkRows);
+}
+
+template<class TFunc>
+double calcFT(const Eigen::VectorXd & funcParams, double t)
+{
+  const typename TFunc::VParams params = funcParams;
+  return TFunc::CalcFT(params, t);
+}
+
+template<class TFunc>
+ModelFamily makeFamily(const std::string & name)
+{
+  const size_t nBreakpointCandidates = BreakpointParam<TFunc>::value < TFunc::nParams ? 64 : 0;
+  return ModelFamily{name, TFunc::nParams, nBreakpointCandidates, &makeModel<TFunc>, &makeOutOfCoreModel<TFunc>,
+    &calcFT<TFunc>, &CalcForecast<TFunc>, &FitGroups<TFunc>, &FitRollingWindows<TFunc>};
+}
+
+const std::vector<ModelFamily> families{
+  makeFamily<Function1>("F1"),
+  makeFamily<Function2>("F2"),
+  makeFamily<Function3>("F3"),
+  makeFamily<Function4>("F4"),
+};
+}
+
+const ModelFamily & ModelRegistry::GetFamily(const std::string & family)
+{
+  for(const ModelFamily & f: families)
+    if(f.name == family)
+      return f;
+  throw std::invalid_argument("Unknown function family " + family);
+}
+
+std::vector<ModelSpec> ModelRegistry::GetDefaultModels()
+{
+  std::vector<ModelSpec> specs{
+    {"QOil1"  , "F1", false},
+    {"QOil2"  , "F3", false},
+    {"QOil4"  , "F4", false},
+    {"QWater1", "F1", true},
+    {"QWater2", "F2", true},
+  };
+  for(ModelSpec & spec: specs)
+    spec.nBreakpointCandidates = GetFamily(spec.family).nBreakpointCandidates;
+  return specs;
+}
+
+std::vector<ModelSpec> ModelRegistry::Parse(const std::string & models)
+{
+  std::vector<ModelSpec> specs;
+  std::istringstream ss(models);
+  std::string item;
+  while(std::getline(ss, item, ','))
+  {
+    const size_t iColon = item.find(':');
+    if(iColon == std::string::npos)
+      throw std::invalid_argument("Model " + item + " is not <target>:<family>");
+    const std::string target = item.substr(0, iColon);
+    const std::string family = item.substr(iColon + 1);
+    if(target != "QOil" && target != "QWater")
+      throw std::invalid_argument("Unknown model target " + target);
+    ModelSpec spec{target + family.substr(1), family, target == "QWater", GetFamily(family).nBreakpointCandidates};
+    for(const ModelSpec & other: specs)
+      if(other.name == spec.name)
+        throw std::invalid_argument("Model " + spec.name + " is repeated");
+    specs.push_back(spec);
+  }
+  if(specs.empty())
+    throw std::invalid_argument("Empty model list");
+  return specs;
+}
+
+std::unique_ptr<IRegressionModel> ModelRegistry::MakeModel(const ModelSpec & spec, TaskData taskData)
+{
+  if(spec.isWater)
+    TaskDataHelper::SwapOilWater(taskData);
+  OptimizedTaskData oTD(taskData);
+  return GetFamily(spec.family).makeModel(std::move(taskData), std::move(oTD));
+}
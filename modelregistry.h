@@ -0,0 +1,66 @@
+#ifndef MODELREGISTRY_H
+#define MODELREGISTRY_H
+
+#include "regressionmodels.h"
+#include "forecast.h"
+#include "groupedfit.h"
+#include "rollingwindow.h"
+#include "holefile.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+/// Function family of regression models: model factory and evaluators
+/// of fitted function params
+struct ModelFamily
+{
+  /// F1, ..., F4
+  std::string name;
+  size_t nFuncParams;
+  /// Breakpoint sweep candidates of fits, 0 for functions without breakpoint
+  size_t nBreakpointCandidates;
+  std::unique_ptr<IRegressionModel> (*makeModel)(TaskData taskData, OptimizedTaskData oTD);
+  /// Model of oil or water of hole file read by chunks
+  std::unique_ptr<IRegressionModel> (*makeOutOfCoreModel)(std::shared_ptr<const HoleFile> holeFile, bool isWater, size_t chunkRows);
+  /// \f$ f(t) \f$ of function params
+  double (*calcFT)(const Eigen::VectorXd & funcParams, double t);
+  /// CalcForecast of model params [q0i ; function params]
+  void (*calcForecast)(const Eigen::VectorXd & params, const std::vector<double> & tEnds, const Eigen::VectorXd & horizon, Forecast & forecast);
+  /// FitGroups of the family
+  GroupedFitResult (*fitGroups)(const TaskDataView & view, const HoleGroups & groups, const GroupedFitParams & gp);
+  /// FitRollingWindows of the family
+  RollingWindowResult (*fitRollingWindows)(const TaskDataView & view, const RollingWindowParams & rp);
+};
+
+/// Analyzed model: function family fitted to oil or water rates
+struct ModelSpec
+{
+  /// Name of results, e.g. QOil1
+  std::string name;
+  /// Name of function family
+  std::string family;
+  bool isWater;
+  /// SolverParams::nBreakpointCandidates of fit, default of family
+  size_t nBreakpointCandidates = 0;
+};
+
+class ModelRegistry
+{
+public:
+  /// Throws invalid_argument for unknown family
+  static const ModelFamily & GetFamily(const std::string & family);
+
+  /// Models of analyze: QOil1, QOil2, QOil4, QWater1, QWater2.
+  /// QOil2 keeps its name of previous results, it is of Function3
+  static std::vector<ModelSpec> GetDefaultModels();
+
+  /// Parses comma separated <target>:<family> list, target is QOil or
+  /// QWater, e.g. "QOil:F3,QWater:F1". Models are named by target and
+  /// function number: QOil3, QWater1
+  static std::vector<ModelSpec> Parse(const std::string & models);
+
+  /// Model of spec, water models are fitted to water of taskData
+  static std::unique_ptr<IRegressionModel> MakeModel(const ModelSpec & spec, TaskData taskData);
+};
+
+#endif // MODELREGISTRY_H
@@ -0,0 +1,198 @@
+#ifndef OUTOFCOREMODEL_H
+#define OUTOFCOREMODEL_H
+
+#include "regressionmodels.h"
+#include "holefile.h"
+#include <memory>
+#include <stdexcept>
+
+/// Regression model over hole file which does not fit memory.
+/// Every evaluation streams holes by chunks of about chunkRows rows, so
+/// memory is two chunks plus O(number of holes) for q0i params and
+/// normal equations. Works with matrixFree solver mode only
+template<class TFunc, class TDiff = HandDiff<TFunc>>
+class OutOfCoreRegressionModelLn: public IRegressionModel
+{
+private:
+  typedef HoleKernels<TFunc, TDiff> Kernels;
+  
+  std::shared_ptr<const HoleFile> _holeFile;
+  const bool _isWater;
+  const size_t _chunkRows;
+  const size_t _taskSize;
+  const size_t _nQParams;
+  const size_t _nFuncParams;
+  const size_t _nParams;
+  /// First \f$ Q/T \f$ of every hole for start params
+  std::vector<double> _firstQDivT;
+  
+  /// Calls func(i, hole) for every hole i in parallel, chunk by chunk
+  template<class THoleFunc>
+  void forEachHole(THoleFunc func) const
+  {
+    _holeFile->ForEachChunk(_isWater, _chunkRows,
+      [&func](size_t iFirstHole, const std::vector<OptimizedHoleData>& chunk)
+      {
+        #pragma omp parallel for schedule(dynamic, 16)
+        for(size_t i = 0; i<chunk.size(); ++i)
+          func(iFirstHole + i, chunk[i]);
+      });
+  }
+  
+public:
+  OutOfCoreRegressionModelLn() = delete;
+  
+  OutOfCoreRegressionModelLn(std::shared_ptr<const HoleFile> holeFile, bool isWater, size_t chunkRows)
+  : _holeFile(holeFile)
+  , _isWater(isWater)
+  , _chunkRows(chunkRows)
+  , _taskSize(holeFile->GetRowsCount())
+  , _nQParams(holeFile->GetHoles().size())
+  , _nFuncParams(TFunc::nParams)
+  , _nParams(_nQParams + _nFuncParams)
+  , _firstQDivT(_nQParams, 0.0)
+  {
+    forEachHole([this](size_t i, const OptimizedHoleData& hole)
+    {
+      if(!hole.qDivT.empty())
+        _firstQDivT[i] = hole.qDivT[0];
+    });
+  }
+  
+  bool IsReady() const
+  {
+    return _nQParams > 0;
+  }
+  
+  size_t GetTaskSize() const
+  {
+    return _taskSize;
+  }
+  
+  size_t GetParamsCount() const
+  {
+    return _nParams;
+  }
+  
+  size_t GetFuncParamsCount() const
+  {
+    return _nFuncParams;
+  }
+  
+  Eigen::VectorXd GenParams0Vec()
+  {
+    Eigen::VectorXd params(_nParams);
+    for(size_t i = 0; i<_nQParams; ++i)
+      params[i] = _firstQDivT[i];
+    for(size_t i = 0; i<_nFuncParams; ++i)
+      params[_nQParams + i] = TFunc::GetDefaultParam(i);
+    return params;
+  }
+  
+  WorkingSet InitWorkingSet()
+  {
+    throw std::logic_error("Out-of-core model supports matrix-free mode only");
+  }
+  
+  WorkingSetF InitWorkingSetF()
+  {
+    throw std::logic_error("Out-of-core model supports matrix-free mode only");
+  }
+  
+  void CalcValue(const Eigen::VectorXd&, WorkingSet&) const
+  {
+    throw std::logic_error("Out-of-core model supports matrix-free mode only");
+  }
+  
+  void CalcValue(const Eigen::VectorXd&, WorkingSetF&) const
+  {
+    throw std::logic_error("Out-of-core model supports matrix-free mode only");
+  }
+  
+  NormalEquations InitNormalEquations()
+  {
+    return NormalEquations(_nQParams, _nFuncParams);
+  }
+  
+  void CalcNormalEquations(const Eigen::VectorXd& params, NormalEquations& ne) const
+  {
+    const typename TFunc::VParams funcParams = params.segment(_nQParams, _nFuncParams);
+    typedef typename Kernels::Accumulator Accumulator;
+    // chunks are set by rows, so their sums are merged in fixed order
+    Accumulator acc;
+    _holeFile->ForEachChunk(_isWater, _chunkRows,
+      [&](size_t iFirstHole, const std::vector<OptimizedHoleData>& chunk)
+      {
+        acc.Merge(ReduceHoles<Accumulator>(chunk.size(), [&](Accumulator& accBlock, size_t i)
+        {
+          accBlock.AddHole(chunk[i], params[iFirstHole+i], funcParams, iFirstHole+i, ne);
+        }));
+      });
+    acc.Store(ne);
+  }
+  
+  void CalcResidual(const Eigen::VectorXd& params, Eigen::VectorXd& yMinusF) const
+  {
+    const typename TFunc::VParams funcParams = params.segment(_nQParams, _nFuncParams);
+    const std::vector<HoleFile::HoleIndex>& holes = _holeFile->GetHoles();
+    yMinusF.resize(_taskSize);
+    forEachHole([&](size_t i, const OptimizedHoleData& hole)
+    {
+      Kernels::CalcResidual(hole, params[i], funcParams, &yMinusF[holes[i].offset]);
+    });
+  }
+  
+  size_t NormalizeParams(Eigen::VectorXd& params) const
+  {
+    return Kernels::NormalizeParams(params, _nQParams);
+  }
+  
+  Eigen::MatrixXd GenStartCandidates(size_t nCandidates, unsigned int seed)
+  {
+    return Kernels::GenStartCandidates(GenParams0Vec(), _nQParams, nCandidates, seed);
+  }
+  
+  double CalcProjectedObjective(Eigen::VectorXd& params) const
+  {
+    const typename TFunc::VParams funcParams = params.segment(_nQParams, _nFuncParams);
+    double sumSq = 0.0;
+    _holeFile->ForEachChunk(_isWater, _chunkRows,
+      [&](size_t iFirstHole, const std::vector<OptimizedHoleData>& chunk)
+      {
+        sumSq += ReduceHoles<HolesSum>(chunk.size(), [&](HolesSum& chunkSumSq, size_t i)
+        {
+          chunkSumSq.sum += Kernels::ProjectHole(chunk[i], funcParams, params[iFirstHole+i]);
+        }).sum;
+      });
+    return sumSq;
+  }
+  
+  /// Sweep needs all rows sorted by time, it is not supported out-of-core
+  bool SweepBreakpoint(Eigen::VectorXd&, size_t) const
+  {
+    return false;
+  }
+  
+  double CalcFT(const Eigen::VectorXd& params, double t) const
+  {
+    const typename TFunc::VParams funcParams = params.tail(_nFuncParams);
+    return TFunc::CalcFT(funcParams, t);
+  }
+  
+  std::unique_ptr<IRegressionModel> Clone() const
+  {
+    return std::make_unique<OutOfCoreRegressionModelLn>(*this);
+  }
+  
+  Eigen::VectorXd GetTarget() const
+  {
+    throw std::logic_error("Out-of-core model targets are read only");
+  }
+  
+  void SetTarget(const Eigen::VectorXd&)
+  {
+    throw std::logic_error("Out-of-core model targets are read only");
+  }
+};
+
+#endif // OUTOFCOREMODEL_H
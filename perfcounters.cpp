@@ -0,0 +1,243 @@
+#include "perfcounters.h"
+#include <atomic>
+#include <mutex>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+/// Event group of one thread. Fds of the group stay open until exit
+struct ThreadCounters
+{
+  int leaderFd = -1;
+  /// Event of every value of group read
+  PerfCounters::Event events[PerfCounters::nEvents];
+  size_t nValues = 0;
+};
+
+/// Groups are added by Enable only, scopes read them without lock
+const size_t maxThreads = 256;
+ThreadCounters threadCounters[maxThreads];
+size_t nThreadCounters = 0;
+bool isCounted[PerfCounters::nEvents] = {};
+std::string error;
+std::atomic<bool> isEnabled(false);
+
+/// Totals of closed scopes, guarded by totalsMutex
+PerfCounters::Snapshot totals;
+std::mutex totalsMutex;
+thread_local bool isInScope = false;
+
+bool isInParallel()
+{
+#ifdef _OPENMP
+  return omp_in_parallel();
+#else
+  return false;
+#endif
+}
+
+#ifdef __linux__
+int openEvent(uint64_t config, int groupFd)
+{
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  // user mode only is allowed by default perf_event_paranoid
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+/// Opens group of events of calling thread, events which can't be
+/// opened are skipped, the first reason is kept in threadError
+ThreadCounters openThread(std::string& threadError)
+{
+  static const uint64_t configs[PerfCounters::nEvents] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+  ThreadCounters counters;
+  for(size_t i = 0; i<PerfCounters::nEvents; ++i)
+  {
+    const int fd = openEvent(configs[i], counters.leaderFd);
+    if(fd < 0)
+    {
+      if(threadError.empty())
+        threadError = std::string("can't count ") + PerfCounters::GetEventName(PerfCounters::Event(i)) + ": " + std::strerror(errno);
+      continue;
+    }
+    if(counters.leaderFd < 0)
+      counters.leaderFd = fd;
+    counters.events[counters.nValues++] = PerfCounters::Event(i);
+  }
+  return counters;
+}
+
+/// Sums counts of all threads. Counts of groups multiplexed with other
+/// perf users are scaled to the whole enabled time
+void readCounts(uint64_t counts[PerfCounters::nEvents])
+{
+  std::fill(counts, counts + PerfCounters::nEvents, 0);
+  for(size_t iThread = 0; iThread<nThreadCounters; ++iThread)
+  {
+    const ThreadCounters& counters = threadCounters[iThread];
+    // nr, time enabled, time running, values
+    uint64_t values[3 + PerfCounters::nEvents];
+    const ssize_t size = (3 + counters.nValues)*sizeof(uint64_t);
+    if(read(counters.leaderFd, values, size) != size)
+      continue;
+    const double scale = values[2] > 0 && values[2] < values[1] ? double(values[1])/values[2] : 1.0;
+    for(size_t i = 0; i<counters.nValues; ++i)
+      counts[counters.events[i]] += uint64_t(values[3 + i]*scale);
+  }
+}
+#else
+void readCounts(uint64_t counts[PerfCounters::nEvents])
+{
+  std::fill(counts, counts + PerfCounters::nEvents, 0);
+}
+#endif
+}
+
+PerfCounters::Scope::Scope(PerfCounters::Phase phase)
+: _phase(phase)
+{
+  if(!IsEnabled() || isInScope || isInParallel())
+    return;
+  _isActive = true;
+  isInScope = true;
+  readCounts(_start);
+}
+
+PerfCounters::Scope::~Scope()
+{
+  if(!_isActive)
+    return;
+  uint64_t end[nEvents];
+  readCounts(end);
+  isInScope = false;
+  std::lock_guard<std::mutex> lock(totalsMutex);
+  // scaled counts of multiplexed groups may go back a little
+  for(size_t i = 0; i<nEvents; ++i)
+    totals.counts[_phase][i] += end[i] > _start[i] ? end[i] - _start[i] : 0;
+}
+
+bool PerfCounters::Enable()
+{
+  static std::mutex enableMutex;
+  std::lock_guard<std::mutex> lock(enableMutex);
+  if(IsEnabled())
+    return true;
+#ifdef __linux__
+  error.clear();
+  const ThreadCounters counters = openThread(error);
+  if(counters.nValues == 0)
+    return false;
+  threadCounters[0] = counters;
+  nThreadCounters = 1;
+  for(size_t i = 0; i<counters.nValues; ++i)
+    isCounted[counters.events[i]] = true;
+  // OpenMP threads are kept by runtime, so counters opened now count all
+  // later parallel regions
+  #pragma omp parallel
+  {
+#ifdef _OPENMP
+    if(omp_get_thread_num() != 0)
+    {
+      std::string threadError;
+      const ThreadCounters opened = openThread(threadError);
+      #pragma omp critical
+      {
+        if(opened.nValues > 0 && nThreadCounters < maxThreads)
+          threadCounters[nThreadCounters++] = opened;
+        else if(error.empty())
+          error = threadError;
+      }
+    }
+#endif
+  }
+  isEnabled.store(true);
+  return true;
+#else
+  error = "hardware counters need Linux perf_event_open";
+  return false;
+#endif
+}
+
+bool PerfCounters::IsEnabled()
+{
+  return isEnabled.load(std::memory_order_relaxed);
+}
+
+bool PerfCounters::IsCounted(PerfCounters::Event event)
+{
+  return IsEnabled() && isCounted[event];
+}
+
+const std::string& PerfCounters::GetError()
+{
+  return error;
+}
+
+PerfCounters::Snapshot PerfCounters::GetSnapshot()
+{
+  std::lock_guard<std::mutex> lock(totalsMutex);
+  return totals;
+}
+
+const char* PerfCounters::GetPhaseName(PerfCounters::Phase phase)
+{
+  static const char* names[nPhases] = {"calcValue", "normalEquations", "linearSolve"};
+  return names[phase];
+}
+
+const char* PerfCounters::GetEventName(PerfCounters::Event event)
+{
+  static const char* names[nEvents] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+  return names[event];
+}
+
+void PerfCounters::Report(std::ostream& os, const std::string& what, const PerfCounters::Snapshot& since)
+{
+  if(!IsEnabled())
+    return;
+  const Snapshot current = GetSnapshot();
+  const auto flags = os.flags();
+  const auto precision = os.precision();
+  os<<"Hardware counters of "<<what<<":"<<std::endl;
+  os<<std::setw(20)<<std::left<<"  phase"<<std::right;
+  for(size_t i = 0; i<nEvents; ++i)
+    os<<std::setw(16)<<GetEventName(Event(i));
+  os<<std::setw(8)<<"IPC"<<std::endl;
+  for(size_t iPhase = 0; iPhase<nPhases; ++iPhase)
+  {
+    uint64_t counts[nEvents];
+    for(size_t i = 0; i<nEvents; ++i)
+      counts[i] = current.counts[iPhase][i] - since.counts[iPhase][i];
+    os<<"  "<<std::setw(18)<<std::left<<GetPhaseName(Phase(iPhase))<<std::right;
+    for(size_t i = 0; i<nEvents; ++i)
+    {
+      if(IsCounted(Event(i)))
+        os<<std::setw(16)<<counts[i];
+      else
+        os<<std::setw(16)<<"-";
+    }
+    if(IsCounted(cycles) && IsCounted(instructions) && counts[cycles] > 0)
+      os<<std::setw(8)<<std::fixed<<std::setprecision(2)<<double(counts[instructions])/counts[cycles];
+    os<<std::endl;
+  }
+  os.flags(flags);
+  os.precision(precision);
+}
@@ -0,0 +1,71 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/// Hardware performance counters of solver phases (Linux perf_event_open).
+/// Counters of the main thread and of OpenMP threads are opened by Enable
+/// and counted in user mode only. Phase counts are sums over all these
+/// threads, so spinning of idle OpenMP threads is counted too. When
+/// counters can't be opened (other OS, perf_event_paranoid, no PMU in
+/// virtual machine) Enable fails and scopes count nothing
+class PerfCounters
+{
+public:
+  /// Measured phases of solver step
+  enum Phase
+  {
+    /// Residual and jacobi matrix. Matrix-free modes evaluate them inside
+    /// of normal equations accumulation
+    calcValue,
+    /// J^T J or accumulation of matrix-free normal equations
+    normalEquations,
+    /// Solve of normal equations and back substitution
+    linearSolve,
+    nPhases
+  };
+  enum Event
+  {
+    cycles,
+    instructions,
+    cacheMisses,
+    branchMisses,
+    nEvents
+  };
+  /// Accumulated counts of all phases
+  struct Snapshot
+  {
+    uint64_t counts[nPhases][nEvents] = {};
+  };
+
+  /// Adds counts of the phase while it exists. Scopes inside of parallel
+  /// regions and nested scopes count nothing
+  class Scope
+  {
+    Phase _phase;
+    bool _isActive = false;
+    uint64_t _start[nEvents];
+  public:
+    explicit Scope(Phase phase);
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+  };
+
+  /// Opens counters of this thread and of OpenMP threads, it can't be
+  /// stopped. Returns false if no event can be counted, see GetError
+  static bool Enable();
+  static bool IsEnabled();
+  /// Some events may be missing, e.g. cache misses in virtual machine
+  static bool IsCounted(Event event);
+  /// Reason of failed Enable or of missing events
+  static const std::string& GetError();
+  static Snapshot GetSnapshot();
+  static const char* GetPhaseName(Phase phase);
+  static const char* GetEventName(Event event);
+  /// Prints counts of phases since snapshot
+  static void Report(std::ostream& os, const std::string& what, const Snapshot& since);
+};
+
+#endif // PERFCOUNTERS_H
@@ -2,116 +2,703 @@
 #define REGRESSIONMODELS_H
 
 #include <vector>
+#include <array>
+#include <random>
+#include <algorithm>
+#include <type_traits>
+#include <memory>
+#include <string>
+#include <stdexcept>
 
 #include "functions.h"
 #include "taskdata.h"
 #include <Eigen/Dense>
 
 /// struct for interacting with solver
-struct WorkingSet
+/// TScalar is storage type: double or float for mixed precision
+template<class TScalar>
+struct WorkingSetT
 {
-  WorkingSet(){};
-  WorkingSet(size_t taskSize, size_t nParams)
-  : J(Eigen::MatrixXd::Zero(taskSize, nParams))
+  typedef Eigen::Matrix<TScalar, Eigen::Dynamic, Eigen::Dynamic> MatrixJ;
+  typedef Eigen::Matrix<TScalar, Eigen::Dynamic, 1> VectorY;
+  
+  WorkingSetT(){};
+  WorkingSetT(size_t taskSize, size_t nParams)
+  : J(MatrixJ::Zero(taskSize, nParams))
   , yMinusF(taskSize)
   {
   }
   /// Task jacobi matrix \f$ J \f$. See (1)
-  Eigen::MatrixXd J;
+  MatrixJ J;
   /// \f$ y-f \f$ in terms of (1). Where \f$ Y=dQ/dTt = Q_{ij}/t_{ij} \f$
-  Eigen::VectorXd yMinusF;
+  VectorY yMinusF;
 };
 
+typedef WorkingSetT<double> WorkingSet;
+typedef WorkingSetT<float> WorkingSetF;
+
+/// Normal equations \f$ J^T J \delta = J^T (y-f) \f$ of model with q0i params.
+/// Column of q0i is nonzero only in rows of hole i, so \f$ J^T J \f$ has
+/// arrow structure and is stored without \f$ n_q^2 \f$ block:
+/// \f$ \begin{pmatrix} diag(qDiag) & qCross \\ qCross^T & fA \end{pmatrix} \f$
+struct NormalEquations
+{
+  NormalEquations(){};
+  NormalEquations(size_t nQParams, size_t nFuncParams)
+  {
+    Resize(nQParams, nFuncParams);
+  }
+  
+  /// Keeps memory if sizes are not changed
+  void Resize(size_t nQParams, size_t nFuncParams)
+  {
+    qDiag.setZero(nQParams);
+    qCross.setZero(nQParams, nFuncParams);
+    qB.setZero(nQParams);
+    fA.setZero(nFuncParams, nFuncParams);
+    fB.setZero(nFuncParams);
+  }
+  
+  Eigen::VectorXd qDiag;
+  Eigen::MatrixXd qCross;
+  Eigen::VectorXd qB;
+  Eigen::MatrixXd fA;
+  Eigen::VectorXd fB;
+  /// \f$ \|y-f\|_\infty \f$
+  double maxAbsYMinusF = 0.0;
+  /// \f$ \|y-f\|_2^2 \f$
+  double sumSqYMinusF = 0.0;
+  
+  /// Eliminates q0i params: S and r of Schur complement system
+  /// \f$ S \delta_f = r \f$
+  void Reduce(Eigen::MatrixXd & S, Eigen::VectorXd & r) const
+  {
+    S = fA;
+    r = fB;
+    const Eigen::Index nF = fB.size();
+    for(Eigen::Index i = 0; i<qDiag.size(); ++i)
+    {
+      if(!(qDiag[i] > 0))
+        continue;
+      for(Eigen::Index k = 0; k<nF; ++k)
+      {
+        const double cDivD = qCross(i, k)/qDiag[i];
+        for(Eigen::Index l = 0; l<nF; ++l)
+          S(k, l) -= cDivD*qCross(i, l);
+        r[k] -= cDivD*qB[i];
+      }
+    }
+  }
+  
+  /// Full step from function params step
+  void BackSubstitute(const Eigen::VectorXd & deltaF, Eigen::VectorXd & delta) const
+  {
+    const Eigen::Index nQ = qDiag.size();
+    delta.resize(nQ + deltaF.size());
+    for(Eigen::Index i = 0; i<nQ; ++i)
+      delta[i] = qDiag[i] > 0 ? (qB[i] - qCross.row(i).dot(deltaF))/qDiag[i] : 0.0;
+    delta.tail(deltaF.size()) = deltaF;
+  }
+};
 
 struct OptimizedHoleData
 {
   std::vector<double> sumT;
   std::vector<double> qDivT;
+  /// Working hours up to the end of last month
+  double tEnd = 0.0;
+  
+  OptimizedHoleData(){};
+  /// From hours ts and production qs per month
+  OptimizedHoleData(const std::vector<double>& ts, const std::vector<double>& qs)
+  {
+    sumT.reserve(ts.size());
+    qDivT.reserve(ts.size());
+    for(size_t j = 0; j<ts.size(); ++j)
+      Append(ts[j], qs[j]);
+  }
+  
+  /// Adds next month with t hours and production q
+  void Append(double t, double q)
+  {
+    qDivT.push_back(q/t);
+    //We use half of time (ts) to get more precice Q derivative
+    sumT.push_back(tEnd + t/2);
+    tEnd += t;
+  }
 };
 
 struct OptimizedTaskData
 {
   std::vector<OptimizedHoleData> holes;
 
+  OptimizedTaskData(){};
   OptimizedTaskData (const TaskData& taskData)
   {
-    holes.resize(taskData.holes.size());
-    for(size_t i = 0; i< taskData.holes.size(); ++i)
+    holes.reserve(taskData.holes.size());
+    for(const HoleData& tHole: taskData.holes)
+      holes.emplace_back(tHole.ts, tHole.qOils);
+  };
+};
+
+/// Read only rows of OptimizedHoleData member
+class RowsView
+{
+  const double* _p = nullptr;
+  size_t _n = 0;
+public:
+  RowsView(){};
+  RowsView(const double* p, size_t n)
+  : _p(p)
+  , _n(n)
+  {
+  }
+  size_t size() const
+  {
+    return _n;
+  }
+  bool empty() const
+  {
+    return _n == 0;
+  }
+  const double& operator[](size_t j) const
+  {
+    return _p[j];
+  }
+};
+
+/// Rows of one hole or their window. Has the same members as
+/// OptimizedHoleData, so HoleKernels work with both. sumT stays time from
+/// hole start
+struct HoleView
+{
+  RowsView sumT;
+  RowsView qDivT;
+};
+
+/// Deterministic parallel sum over holes [0, nHoles). Holes are split to
+/// at most maxBlocks blocks of about minBlockHoles holes or more, every
+/// block is summed in hole order and block sums are merged by pairwise
+/// tree. Shape of sum depends on nHoles only, so result is the same bit
+/// for bit for any number of threads and schedule.
+/// addHole(acc, i) adds hole i to acc, TAcc has Merge(other)
+template<class TAcc, class TAddHole>
+TAcc ReduceHoles(size_t nHoles, TAddHole addHole)
+{
+  const size_t minBlockHoles = 16;
+  const size_t maxBlocks = 128;
+  const size_t nBlocks = std::max<size_t>(std::min((nHoles + minBlockHoles - 1)/minBlockHoles, maxBlocks), 1);
+  std::array<TAcc, maxBlocks> blocks;
+  #pragma omp parallel for schedule(dynamic)
+  for(size_t iBlock = 0; iBlock<nBlocks; ++iBlock)
+    for(size_t i = iBlock*nHoles/nBlocks; i<(iBlock + 1)*nHoles/nBlocks; ++i)
+      addHole(blocks[iBlock], i);
+  for(size_t step = 1; step<nBlocks; step *= 2)
+    for(size_t iBlock = 0; iBlock + step<nBlocks; iBlock += 2*step)
+      blocks[iBlock].Merge(blocks[iBlock + step]);
+  return blocks[0];
+}
+
+/// Sum of doubles for ReduceHoles
+struct HolesSum
+{
+  double sum = 0.0;
+  void Merge(const HolesSum& other)
+  {
+    sum += other.sum;
+  }
+};
+
+/// Computations shared by in-memory and out-of-core models
+template<class TFunc, class TDiff>
+struct HoleKernels
+{
+  typedef typename TFunc::VParams VParams;
+  typedef Eigen::Matrix<double, TFunc::nParams, TFunc::nParams> MFunc;
+  
+  /// Clips params to their limits, returns number of clipped params
+  static size_t NormalizeParams(Eigen::VectorXd& params, const size_t nQParams)
+  {
+    size_t nClip = 0;
+    for(size_t i = 0; i< nQParams; ++i)
     {
-      OptimizedHoleData& hole = holes[i];
-      const HoleData& tHole = taskData.holes[i];
-      hole.sumT.resize(tHole.ts.size());
-      hole.qDivT.resize(tHole.ts.size());
-      for(size_t j = 0; j<tHole.ts.size(); ++j)
+      const double eps = 1e-16;
+      if(params[i] < eps)
       {
-        hole.qDivT[j] = tHole.qOils[j]/tHole.ts[j];
-        if(j==0)
-          hole.sumT[j] = tHole.ts[j]/2;
-        else
-          //We use half of time (ts) to get more precice Q derivative
-          hole.sumT[j] = hole.sumT[j-1] +tHole.ts[j-1]/2 + tHole.ts[j]/2;
+        params[i] = eps;
+        ++nClip;
+      }
+    }
+    for(size_t i = 0; i< TFunc::nParams; ++i)
+    {
+      if(params[i+nQParams] < TFunc::GetParamLowerLimits(i)) 
+      {
+        params[i+nQParams] = TFunc::GetParamLowerLimits(i);
+        ++nClip;
+      }
+      if(params[i+nQParams] > TFunc::GetParamUpperLimits(i)) 
+      {
+        params[i+nQParams] = TFunc::GetParamUpperLimits(i);
+        ++nClip;
+      }
+    }
+    return nClip;
+  }
+  
+  /// Latin hypercube of function params around defaults, sampled in
+  /// [default/10^searchDecades, default*10^searchDecades].
+  /// Column 0 is params0
+  static Eigen::MatrixXd GenStartCandidates(const Eigen::VectorXd& params0, const size_t nQParams, size_t nCandidates, unsigned int seed)
+  {
+    const double searchDecades = 2.0;
+    Eigen::MatrixXd candidates = params0.replicate(1, std::max<size_t>(nCandidates, 1));
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<size_t> strata(candidates.cols()-1);
+    for(size_t iParam = 0; iParam<TFunc::nParams; ++iParam)
+    {
+      const double lnDefault = log(TFunc::GetDefaultParam(iParam));
+      const double lnLow = lnDefault - searchDecades*log(10.0);
+      const double lnHigh = lnDefault + searchDecades*log(10.0);
+      for(size_t i = 0; i<strata.size(); ++i)
+        strata[i] = i;
+      std::shuffle(strata.begin(), strata.end(), gen);
+      for(size_t i = 0; i<strata.size(); ++i)
+      {
+        const double u = (strata[i] + uniform(gen))/strata.size();
+        candidates(nQParams+iParam, i+1) = exp(lnLow + u*(lnHigh-lnLow));
       }
     }
+    for(Eigen::Index i = 0; i<candidates.cols(); ++i)
+    {
+      Eigen::VectorXd col = candidates.col(i);
+      NormalizeParams(col, nQParams);
+      candidates.col(i) = col;
+    }
+    return candidates;
+  }
+  
+  /// Function params block of normal equations: partial sums of block of
+  /// holes. q0i rows belong to one hole and are written to ne directly
+  struct Accumulator
+  {
+    MFunc fA = MFunc::Zero();
+    VParams fB = VParams::Zero();
+    double maxAbsYMinusF = 0.0;
+    double sumSqYMinusF = 0.0;
+    
+    /// Adds rows of hole with q0i index iQ.
+    /// THole is OptimizedHoleData or HoleView
+    template<class THole>
+    void AddHole(const THole& hole, const double q0, const VParams& funcParams, const size_t iQ, NormalEquations& ne)
+    {
+      VParams gradFT;
+      const double jQ = 1.0/q0;
+      const double lnQ0 = log(q0);
+      double qDiag = 0.0;
+      double qB = 0.0;
+      VParams qCross = VParams::Zero();
+      for(size_t j = 0; j<hole.sumT.size(); ++j)
+      {
+        const double qDivTVal = hole.qDivT[j];
+        if(!(abs(qDivTVal) > 0))
+          continue;
+        const double valFT = TDiff::CalcFTGrad(funcParams, hole.sumT[j], gradFT);
+        const VParams jF = gradFT/valFT;
+        const double r = log(qDivTVal) - lnQ0 - log(valFT);
+        qDiag += jQ*jQ;
+        qB += jQ*r;
+        qCross += jQ*jF;
+        fA.noalias() += jF*jF.transpose();
+        fB += jF*r;
+        maxAbsYMinusF = std::max(maxAbsYMinusF, std::abs(r));
+        sumSqYMinusF += r*r;
+      }
+      ne.qDiag[iQ] = qDiag;
+      ne.qB[iQ] = qB;
+      ne.qCross.row(iQ) = qCross.transpose();
+    }
+    
+    void Merge(const Accumulator& other)
+    {
+      fA += other.fA;
+      fB += other.fB;
+      maxAbsYMinusF = std::max(maxAbsYMinusF, other.maxAbsYMinusF);
+      sumSqYMinusF += other.sumSqYMinusF;
+    }
+    
+    /// Writes function params block to ne
+    void Store(NormalEquations& ne) const
+    {
+      ne.fA = fA;
+      ne.fB = fB;
+      ne.maxAbsYMinusF = maxAbsYMinusF;
+      ne.sumSqYMinusF = sumSqYMinusF;
+    }
   };
+  
+  /// Sets q0 to its optimum for fixed function params and returns sum of
+  /// squared residuals. q0 is not changed if hole has no nonzero rows
+  template<class THole>
+  static double ProjectHole(const THole& hole, const VParams& funcParams, double& q0)
+  {
+    // ln(y/f) for every nonzero row, the optimal ln q0i is their mean.
+    // Values are shifted by the first one to keep variance precise
+    double shift = 0.0;
+    double sum = 0.0;
+    double sum2 = 0.0;
+    size_t nUsed = 0;
+    for(size_t j = 0; j<hole.sumT.size(); ++j)
+    {
+      const double qDivTVal = hole.qDivT[j];
+      if(!(abs(qDivTVal) > 0))
+        continue;
+      const double v = log(qDivTVal) - log(TFunc::CalcFT(funcParams, hole.sumT[j]));
+      if(nUsed == 0)
+        shift = v;
+      sum += v - shift;
+      sum2 += (v - shift)*(v - shift);
+      ++nUsed;
+    }
+    if(nUsed == 0)
+      return 0.0;
+    const double mean = sum/nUsed;
+    q0 = exp(shift + mean);
+    return std::max(sum2 - nUsed*mean*mean, 0.0);
+  }
+  
+  /// \f$ y-f \f$ of hole rows, zero for zero rows
+  template<class THole>
+  static void CalcResidual(const THole& hole, const double q0, const VParams& funcParams, double* yMinusF)
+  {
+    for(size_t j = 0; j<hole.sumT.size(); ++j)
+    {
+      const double qDivTVal = hole.qDivT[j];
+      if(abs(qDivTVal) > 0)
+        yMinusF[j] = log(qDivTVal) - log(q0) - log(TFunc::CalcFT(funcParams, hole.sumT[j]));
+      else
+        yMinusF[j] = 0.0;
+    }
+  }
+  
+  /// Moves breakpoint param of params to the best of nCandidates
+  /// breakpoints for fixed other params. getHole(i) gives rows of hole i
+  /// of [0, nQParams). Returns false if function has no breakpoint or no
+  /// better one found
+  template<class TGetHole>
+  static bool SweepBreakpoint(Eigen::VectorXd& params, size_t nQParams, size_t nCandidates, TGetHole getHole)
+  {
+    return sweepBreakpoint(params, nQParams, nCandidates, getHole, HasBreakpoint());
+  }
+  
+private:
+  typedef std::integral_constant<bool, (BreakpointParam<TFunc>::value < TFunc::nParams)> HasBreakpoint;
+  
+  template<class TGetHole>
+  static bool sweepBreakpoint(Eigen::VectorXd&, size_t, size_t, TGetHole, std::false_type)
+  {
+    return false;
+  }
+  
+  /// Rows are sorted by time once, so residuals of the left branch do not
+  /// depend on breakpoint and are taken from prefix sums. Right branch
+  /// residuals are power series of tau (TFunc::CalcRightLnFTSeries), so
+  /// squared residuals of candidates are suffix sums of products of series
+  /// coefficients. Candidates are split into log C groups, every group
+  /// has own expansion point, so the sweep is O(n log n). Best approximate
+  /// candidates and candidates where series converges slowly are checked
+  /// by exact residuals before tau is moved
+  template<class TGetHole>
+  static bool sweepBreakpoint(Eigen::VectorXd& params, size_t nQParams, size_t nCandidates, TGetHole getHole, std::true_type)
+  {
+    const size_t iBreakpoint = BreakpointParam<TFunc>::value;
+    VParams funcParams = params.segment(nQParams, TFunc::nParams);
+    
+    // rows with ln(y/q0i), sorted by time from hole start
+    std::vector<std::pair<double, double>> rows;
+    for(size_t i = 0; i<nQParams; ++i)
+    {
+      const auto hole = getHole(i);
+      for(size_t j = 0; j<hole.sumT.size(); ++j)
+      {
+        const double qDivTVal = hole.qDivT[j];
+        if(abs(qDivTVal) > 0)
+          rows.emplace_back(hole.sumT[j], log(qDivTVal) - log(params[i]));
+      }
+    }
+    const size_t n = rows.size();
+    if(n == 0)
+      return false;
+    std::sort(rows.begin(), rows.end());
+    
+    // prefix[k] - sum of squared residuals of rows [0, k) on the left branch
+    VParams leftParams = funcParams;
+    leftParams[iBreakpoint] = std::numeric_limits<double>::infinity();
+    std::vector<double> prefix(n+1, 0.0);
+    for(size_t k = 0; k<n; ++k)
+    {
+      const double r = rows[k].second - log(TFunc::CalcFT(leftParams, rows[k].first));
+      prefix[k+1] = prefix[k] + r*r;
+    }
+    
+    // candidate k splits rows into [0, k) and [k, n), tau = t_k.
+    // Candidate n puts all rows to the left branch
+    std::vector<size_t> splits;
+    const size_t step = std::max<size_t>(n/std::max<size_t>(nCandidates, 1), 1);
+    for(size_t k = 0; k<n; k += step)
+    {
+      size_t kFirst = k;
+      while(kFirst>0 && rows[kFirst-1].first == rows[k].first)
+        --kFirst;
+      if(splits.empty() || splits.back() != kFirst)
+        splits.push_back(kFirst);
+    }
+    splits.push_back(n);
+    const size_t nSplits = splits.size();
+    auto splitTau = [&rows, n](size_t k)
+    {
+      return k<n ? rows[k].first : rows[n-1].first + 1.0;
+    };
+    // exact objective of breakpoint tau, O(n)
+    auto calcObjective = [&](double tau)
+    {
+      VParams splitParams = funcParams;
+      splitParams[iBreakpoint] = tau;
+      const size_t k = std::lower_bound(rows.begin(), rows.end(),
+        std::make_pair(tau, -std::numeric_limits<double>::infinity())) - rows.begin();
+      double sumSq = prefix[k];
+      for(size_t m = k; m<n; ++m)
+      {
+        const double r = rows[m].second - log(TFunc::CalcFT(splitParams, rows[m].first));
+        sumSq += r*r;
+      }
+      return std::isfinite(sumSq) ? sumSq : std::numeric_limits<double>::max();
+    };
+    
+    // approximate objectives, NaN if series converges too slowly
+    const size_t nTerms = 7;
+    const double maxRatio = 0.5;
+    const size_t nGroups = std::max<size_t>(std::ceil(std::log2(double(nSplits))), 1);
+    std::vector<double> objectives(nSplits);
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t iGroup = 0; iGroup<nGroups; ++iGroup)
+    {
+      const size_t iFirst = iGroup*nSplits/nGroups;
+      const size_t iLast = (iGroup + 1)*nSplits/nGroups;
+      if(iFirst == iLast)
+        continue;
+      const double tau0 = splitTau(splits[iFirst]);
+      // suffix[s] - sum of coefficients of delta^s of squared residuals
+      // of rows [m, n)
+      std::array<double, 2*nTerms - 1> suffix;
+      suffix.fill(0.0);
+      std::array<double, nTerms> coefs;
+      double maxX = 0.0;
+      size_t m = n;
+      for(size_t iSplit = iLast; iSplit-- > iFirst;)
+      {
+        const size_t k = splits[iSplit];
+        for(; m>k; --m)
+        {
+          const std::pair<double, double>& row = rows[m-1];
+          maxX = std::max(maxX, TFunc::CalcRightLnFTSeries(funcParams, row.first, tau0, coefs));
+          // residual is y - ln f
+          coefs[0] = row.second - coefs[0];
+          for(size_t p = 1; p<nTerms; ++p)
+            coefs[p] = -coefs[p];
+          for(size_t p = 0; p<nTerms; ++p)
+            for(size_t q = 0; q<nTerms; ++q)
+              suffix[p+q] += coefs[p]*coefs[q];
+        }
+        const double delta = splitTau(k) - tau0;
+        if(k<n && maxX*delta > maxRatio)
+        {
+          objectives[iSplit] = std::numeric_limits<double>::quiet_NaN();
+          continue;
+        }
+        double sumSq = 0.0;
+        for(size_t s = suffix.size(); s-- > 0;)
+          sumSq = sumSq*delta + suffix[s];
+        sumSq += prefix[k];
+        objectives[iSplit] = std::isfinite(sumSq) ? sumSq : std::numeric_limits<double>::max();
+      }
+    }
+    
+    // exact check of the best approximate candidates and of all slowly
+    // converging ones
+    const size_t nChecked = 4;
+    std::vector<size_t> order;
+    std::vector<size_t> checked;
+    for(size_t iSplit = 0; iSplit<nSplits; ++iSplit)
+    {
+      if(std::isnan(objectives[iSplit]))
+        checked.push_back(iSplit);
+      else
+        order.push_back(iSplit);
+    }
+    const size_t nBest = std::min(nChecked, order.size());
+    std::partial_sort(order.begin(), order.begin() + nBest, order.end(),
+      [&objectives](size_t l, size_t r){return objectives[l]<objectives[r];});
+    checked.insert(checked.end(), order.begin(), order.begin() + nBest);
+    #pragma omp parallel for schedule(dynamic)
+    for(size_t i = 0; i<checked.size(); ++i)
+      objectives[checked[i]] = calcObjective(splitTau(splits[checked[i]]));
+    
+    const double currentObjective = calcObjective(funcParams[iBreakpoint]);
+    size_t iBest = nSplits;
+    for(size_t iSplit: checked)
+      if(objectives[iSplit] < currentObjective && (iBest == nSplits || objectives[iSplit] < objectives[iBest]))
+        iBest = iSplit;
+    if(iBest == nSplits)
+      return false;
+    params[nQParams+iBreakpoint] = splitTau(splits[iBest]);
+    return true;
+  }
 };
 
 class IRegressionModel
 {
 public:
+  virtual ~IRegressionModel() = default;
   virtual bool IsReady() const = 0;
+  /// Number of rows of jacobi matrix
+  virtual size_t GetTaskSize() const = 0;
+  virtual size_t GetParamsCount() const = 0;
+  virtual size_t GetFuncParamsCount() const = 0;
   virtual Eigen::VectorXd GenParams0Vec() = 0;
   virtual WorkingSet InitWorkingSet() = 0;
-  virtual void CalcValue(const Eigen::VectorXd & params, WorkingSet & ws) = 0;
-  virtual size_t NormalizeParams(Eigen::VectorXd & params) = 0;
+  virtual WorkingSetF InitWorkingSetF() = 0;
+  virtual void CalcValue(const Eigen::VectorXd & params, WorkingSet & ws) const = 0;
+  virtual void CalcValue(const Eigen::VectorXd & params, WorkingSetF & ws) const = 0;
+  virtual NormalEquations InitNormalEquations() = 0;
+  /// Accumulates normal equations row by row, jacobi matrix is never stored
+  virtual void CalcNormalEquations(const Eigen::VectorXd & params, NormalEquations & ne) const = 0;
+  /// \f$ y-f \f$ only, without jacobi matrix
+  virtual void CalcResidual(const Eigen::VectorXd & params, Eigen::VectorXd & yMinusF) const = 0;
+  virtual size_t NormalizeParams(Eigen::VectorXd & params) const = 0;
+  /// Latin hypercube of start points over function params.
+  /// Every column is a full params vector, column 0 is GenParams0Vec()
+  virtual Eigen::MatrixXd GenStartCandidates(size_t nCandidates, unsigned int seed) = 0;
+  /// Replaces q0i params by their optimum for fixed function params
+  /// and returns sum of squared residuals
+  virtual double CalcProjectedObjective(Eigen::VectorXd & params) const = 0;
+  /// Moves breakpoint param of the function to the best of nCandidates
+  /// breakpoints for fixed other params.
+  /// Returns false if function has no breakpoint or no better one found
+  virtual bool SweepBreakpoint(Eigen::VectorXd & params, size_t nCandidates) const = 0;
+  /// \f$ f(t) \f$ of model function, function params are tail of params
+  virtual double CalcFT(const Eigen::VectorXd & params, double t) const = 0;
+  virtual std::unique_ptr<IRegressionModel> Clone() const = 0;
+  /// \f$ ln(Q/T) \f$ of every row, NaN for rows excluded from fit
+  virtual Eigen::VectorXd GetTarget() const = 0;
+  /// Replaces \f$ ln(Q/T) \f$ of fitted rows, excluded rows stay excluded
+  virtual void SetTarget(const Eigen::VectorXd & lnY) = 0;
 };
 
 /// Regression model
 /// \f$ ln q_i (t_j) = ln q_{0i} + ln(t_j)+\ksi_{ij} \f$
 /// See also
 /// (1) http://www.machinelearning.ru/wiki/index.php?title=Нелинейная_регрессия
-template<class TFunc>
+/// TDiff computes \f$ f(t) \f$ with gradient: HandDiff or AutoDiff
+template<class TFunc, class TDiff = HandDiff<TFunc>>
 class RegressionModelLn: public IRegressionModel
 {
 private:
-  /// Input statistical data
-  TaskData _taskData;
-  /// Task data optimized for our purposes
-  OptimizedTaskData _oTD;
+  typedef HoleKernels<TFunc, TDiff> Kernels;
+
+  /// Input statistical data. Copies of model share it
+  std::shared_ptr<const TaskData> _taskData;
+  /// Task data optimized for our purposes. Copies of model share it
+  std::shared_ptr<const OptimizedTaskData> _oTD;
+  /// Q/T of rows of all holes set by SetTarget, own for every copy of
+  /// model. Empty until SetTarget, Q/T of _oTD are used then
+  std::vector<double> _qDivT;
+  /// First row of every hole in _qDivT
+  std::vector<size_t> _offsets;
   /// Task size: size of statistical data
   const size_t _taskSize = 0;
   const size_t _nQParams = 0;
   const size_t _nFuncParams = 0;
   const size_t _nParams = 0;
+  void initOffsets()
+  {
+    _offsets.resize(_nQParams);
+    size_t it = 0;
+    for(size_t i = 0; i<_nQParams; ++i)
+    {
+      _offsets[i] = it;
+      it += _oTD->holes[i].sumT.size();
+    }
+  }
+  
+  /// Rows of hole i with own target if it is set
+  HoleView getHole(size_t i) const
+  {
+    const OptimizedHoleData& hole = _oTD->holes[i];
+    const double* qDivT = _qDivT.empty() ? hole.qDivT.data() : _qDivT.data() + _offsets[i];
+    return HoleView{RowsView(hole.sumT.data(), hole.sumT.size()), RowsView(qDivT, hole.sumT.size())};
+  }
+  
 public:  
   RegressionModelLn() = delete;
   
   RegressionModelLn(const TaskData& taskData)
   //please be carefull with initialization order
-  : _taskData(taskData)
-  , _oTD(taskData)
+  : _taskData(std::make_shared<const TaskData>(taskData))
+  , _oTD(std::make_shared<const OptimizedTaskData>(taskData))
   , _taskSize(TaskDataHelper::GetTaskSize(taskData))
   , _nQParams(taskData.holes.size())
   , _nFuncParams(TFunc::nParams)
   , _nParams(_nQParams + _nFuncParams)
   {
+    initOffsets();
+  }
+  
+  /// Model from already optimized task data, oTD must be built from taskData
+  RegressionModelLn(TaskData taskData, OptimizedTaskData oTD)
+  : _taskData(std::make_shared<const TaskData>(std::move(taskData)))
+  , _oTD(std::make_shared<const OptimizedTaskData>(std::move(oTD)))
+  , _taskSize(TaskDataHelper::GetTaskSize(*_taskData))
+  , _nQParams(_taskData->holes.size())
+  , _nFuncParams(TFunc::nParams)
+  , _nParams(_nQParams + _nFuncParams)
+  {
+    if(_oTD->holes.size() != _taskData->holes.size())
+      throw std::invalid_argument("Optimized task data does not match task data");
+    initOffsets();
   }
   
   bool IsReady() const
   {
-    if(_taskData.holes.size()==0
-      && _taskData.holes.size() == _oTD.holes.size()
+    if(_taskData->holes.size()==0
+      && _taskData->holes.size() == _oTD->holes.size()
     )
       return false;
       return true;
   }
   
+  size_t GetTaskSize() const
+  {
+    return _taskSize;
+  }
+  
+  size_t GetParamsCount() const
+  {
+    return _nParams;
+  }
+  
+  size_t GetFuncParamsCount() const
+  {
+    return _nFuncParams;
+  }
+  
   Eigen::VectorXd GenParams0Vec()
   {
     Eigen::VectorXd params(_nParams);
     for(size_t i = 0; i<_nQParams; ++i)
-      params[i] = _oTD.holes[i].qDivT[0];
+      params[i] = getHole(i).qDivT[0];
     for(size_t i = 0; i<_nFuncParams; ++i)
-      params[_taskData.holes.size() + i] = TFunc::GetDefaultParam(i);
+      params[_nQParams + i] = TFunc::GetDefaultParam(i);
     return params;
   }
   
@@ -120,25 +707,66 @@ public:
     return WorkingSet(_taskSize, _nParams);
   }
 
-  void CalcValue(const Eigen::VectorXd& params, WorkingSet& ws)
+  WorkingSetF InitWorkingSetF()
+  {
+    return WorkingSetF(_taskSize, _nParams);
+  }
+
+  void CalcValue(const Eigen::VectorXd& params, WorkingSet& ws) const
+  {
+    calcValue(params, ws);
+  }
+  
+  void CalcValue(const Eigen::VectorXd& params, WorkingSetF& ws) const
   {
-    //const Eigen::Map<const TFunc::VParams> funcParams(&params[_nQParams], _nFuncParams);
-    const Eigen::Map<const Eigen::VectorXd> funcParams(&params[_nQParams], _nFuncParams);
+    calcValue(params, ws);
+  }
+  
+  NormalEquations InitNormalEquations()
+  {
+    return NormalEquations(_nQParams, _nFuncParams);
+  }
+  
+  void CalcNormalEquations(const Eigen::VectorXd& params, NormalEquations& ne) const
+  {
+    const typename TFunc::VParams funcParams = params.segment(_nQParams, _nFuncParams);
+    typedef typename Kernels::Accumulator Accumulator;
+    const Accumulator acc = ReduceHoles<Accumulator>(_nQParams, [&](Accumulator& accBlock, size_t i)
+    {
+      accBlock.AddHole(getHole(i), params[i], funcParams, i, ne);
+    });
+    acc.Store(ne);
+  }
+  
+  void CalcResidual(const Eigen::VectorXd& params, Eigen::VectorXd& yMinusF) const
+  {
+    const typename TFunc::VParams funcParams = params.segment(_nQParams, _nFuncParams);
+    yMinusF.resize(_taskSize);
+    for(size_t i = 0; i<_nQParams; ++i)
+      Kernels::CalcResidual(getHole(i), params[i], funcParams, yMinusF.data() + _offsets[i]);
+  }
+  
+private:
+  /// Fills jacobi matrix and residual of working set with any storage type
+  template<class TScalar>
+  void calcValue(const Eigen::VectorXd& params, WorkingSetT<TScalar>& ws) const
+  {
+    const typename TFunc::VParams funcParams = params.segment(_nQParams, _nFuncParams);
+    typename TFunc::VParams gradFT;
     size_t it = 0;
-    for(size_t i = 0; i<_taskData.holes.size(); ++i)
+    for(size_t i = 0; i<_nQParams; ++i)
     {
-      const HoleData& holeData = _taskData.holes[i];
-      const OptimizedHoleData& optHoleData = _oTD.holes[i];
+      const HoleData& holeData = _taskData->holes[i];
+      const HoleView optHoleData = getHole(i);
       for(size_t j = 0; j<holeData.ts.size();++j)
       {
         // Find the way to minimize task size
         ws.J(it, i) = 1.0/params[i];
         
         const double tFromStart = optHoleData.sumT[j];
-        const double valFT = TFunc::CalcFT(funcParams, tFromStart);
+        const double valFT = TDiff::CalcFTGrad(funcParams, tFromStart, gradFT);
         for(size_t iParam = 0; iParam<_nFuncParams; ++iParam)
-          ws.J(it, _nQParams+iParam) = TFunc::CalcDFDIParam(iParam, funcParams, tFromStart)/valFT;
-        //ws.J(it, _nQParams+iParam) = TFunc::calcDFDIParamDivFT(iParam, funcParams, tFromStart);
+          ws.J(it, _nQParams+iParam) = gradFT[iParam]/valFT;
         
         const double qDivTVal = optHoleData.qDivT[j];
         if(abs(qDivTVal) > 0)
@@ -156,32 +784,74 @@ public:
     }
   }
   
-  size_t NormalizeParams(Eigen::VectorXd& params)
+public:
+  size_t NormalizeParams(Eigen::VectorXd& params) const
   {
-    size_t nClip = 0;
-    for(size_t i = 0; i< _nQParams; ++i)
+    return Kernels::NormalizeParams(params, _nQParams);
+  }
+  
+  Eigen::MatrixXd GenStartCandidates(size_t nCandidates, unsigned int seed)
+  {
+    return Kernels::GenStartCandidates(GenParams0Vec(), _nQParams, nCandidates, seed);
+  }
+  
+  double CalcProjectedObjective(Eigen::VectorXd& params) const
+  {
+    const typename TFunc::VParams funcParams = params.segment(_nQParams, _nFuncParams);
+    return ReduceHoles<HolesSum>(_nQParams, [&](HolesSum& sumSq, size_t i)
     {
-      const double eps = 1e-16;
-      if(params[i] < eps)
+      sumSq.sum += Kernels::ProjectHole(getHole(i), funcParams, params[i]);
+    }).sum;
+  }
+  
+  bool SweepBreakpoint(Eigen::VectorXd& params, size_t nCandidates) const
+  {
+    return Kernels::SweepBreakpoint(params, _nQParams, nCandidates, [this](size_t i){return getHole(i);});
+  }
+  
+  double CalcFT(const Eigen::VectorXd& params, double t) const
+  {
+    const typename TFunc::VParams funcParams = params.tail(_nFuncParams);
+    return TFunc::CalcFT(funcParams, t);
+  }
+  
+  /// Copy shares task data with this model, only target set by
+  /// SetTarget is copied
+  std::unique_ptr<IRegressionModel> Clone() const
+  {
+    return std::make_unique<RegressionModelLn>(*this);
+  }
+  
+  Eigen::VectorXd GetTarget() const
+  {
+    Eigen::VectorXd lnY(_taskSize);
+    for(size_t i = 0; i<_nQParams; ++i)
+    {
+      const HoleView hole = getHole(i);
+      for(size_t j = 0; j<hole.qDivT.size(); ++j)
       {
-        params[i] = eps;
-        ++nClip;
+        const double qDivTVal = hole.qDivT[j];
+        lnY[_offsets[i] + j] = abs(qDivTVal) > 0 ? log(qDivTVal) : std::numeric_limits<double>::quiet_NaN();
       }
     }
-    for(size_t i = 0; i< _nFuncParams; ++i)
+    return lnY;
+  }
+  
+  /// Shared task data is not changed, target of this model is own
+  void SetTarget(const Eigen::VectorXd& lnY)
+  {
+    if(size_t(lnY.size()) != _taskSize)
+      throw std::invalid_argument("Wrong target size");
+    _qDivT.resize(_taskSize);
+    for(size_t i = 0; i<_nQParams; ++i)
     {
-      if(params[i+_nQParams] < TFunc::GetParamLowerLimits(i)) 
+      const std::vector<double>& qDivT = _oTD->holes[i].qDivT;
+      for(size_t j = 0; j<qDivT.size(); ++j)
       {
-        params[i+_nQParams] = TFunc::GetParamLowerLimits(i);
-        ++nClip;
-      }
-      if(params[i+_nQParams] > TFunc::GetParamUpperLimits(i)) 
-      {
-        params[i+_nQParams] = TFunc::GetParamUpperLimits(i);
-        ++nClip;
+        const size_t it = _offsets[i] + j;
+        _qDivT[it] = abs(qDivT[j]) > 0 ? exp(lnY[it]) : qDivT[j];
       }
     }
-    return nClip;
   }
   friend class Tester;
 };
@@ -191,4 +861,17 @@ typedef RegressionModelLn<Function2> RegressionModelLn2;
 typedef RegressionModelLn<Function3> RegressionModelLn3;
 typedef RegressionModelLn<Function4> RegressionModelLn4;
 
+/// Model by function number: 1 - Function1, ..., 4 - Function4
+inline std::unique_ptr<IRegressionModel> CreateRegressionModelLn(size_t iFunction, const TaskData& taskData)
+{
+  switch(iFunction)
+  {
+    case 1: return std::make_unique<RegressionModelLn1>(taskData);
+    case 2: return std::make_unique<RegressionModelLn2>(taskData);
+    case 3: return std::make_unique<RegressionModelLn3>(taskData);
+    case 4: return std::make_unique<RegressionModelLn4>(taskData);
+  }
+  throw std::invalid_argument("Unknown function " + std::to_string(iFunction));
+}
+
 #endif // REGRESSIONMODELS_H
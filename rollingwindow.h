@@ -0,0 +1,120 @@
+#ifndef ROLLINGWINDOW_H
+#define ROLLINGWINDOW_H
+
+#include "solver.h"
+#include "viewmodel.h"
+#include <vector>
+#include <algorithm>
+#include <exception>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/// Params of fits of one model over overlapping windows of rows: window k
+/// is rows [k*stepRows, k*stepRows+windowRows) of every hole
+struct RollingWindowParams
+{
+  RollingWindowParams()
+  : windowRows(24)
+  , stepRows(6)
+  , nChains(0)
+  {
+    sp.variableProjection = true;
+    sp.keepYMinusF = false;
+    sp.nMaxIter = 100;
+  }
+  size_t windowRows;
+  size_t stepRows;
+  /// 0 - number of OpenMP threads
+  size_t nChains;
+  /// Solver params of every window, variable projection by default
+  Solver::SolverParams sp;
+};
+
+struct RollingWindowResult
+{
+  /// First row of every window
+  std::vector<size_t> iFirstRows;
+  /// Function params of every window by columns
+  Eigen::MatrixXd funcParams;
+  std::vector<bool> isConverged;
+};
+
+/// Fits views by models of TFunc. Views are split to contiguous chains
+/// fitted in parallel, every view of a chain starts from result of
+/// previous one, so views must have the same holes.
+/// onFitted(k, params, isConverged) is called by fitting thread
+template<class TFunc, class TFittedFunc>
+void FitViewChains(const std::vector<TaskDataView>& views, const Solver::SolverParams& sp, size_t nChains, TFittedFunc onFitted)
+{
+#ifdef _OPENMP
+  const size_t nThreads = omp_get_max_threads();
+#else
+  const size_t nThreads = 1;
+#endif
+  const size_t nViews = views.size();
+  nChains = std::min(nChains > 0 ? nChains : nThreads, nViews);
+  std::exception_ptr error;
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_t iChain = 0; iChain<nChains; ++iChain)
+  {
+    try
+    {
+      auto workspace = std::make_shared<SolverWorkspace>();
+      Eigen::VectorXd params;
+      for(size_t k = iChain*nViews/nChains; k<(iChain + 1)*nViews/nChains; ++k)
+      {
+        Solver solver(std::make_unique<ViewRegressionModelLn<TFunc>>(views[k]), workspace);
+        if(params.size() == 0)
+          solver.SolverInit(sp);
+        else
+          solver.SolverInit(sp, params);
+        const bool isConverged = solver.Solve() && solver.GetResult().allFinite();
+        onFitted(k, solver.GetResult(), isConverged);
+        // next view starts from defaults after failed one
+        if(isConverged)
+          params = solver.GetResult();
+        else
+          params.resize(0);
+      }
+    }
+    catch(...)
+    {
+      #pragma omp critical
+      error = std::current_exception();
+    }
+  }
+  if(error)
+    std::rethrow_exception(error);
+}
+
+/// Fits windows of view by model of TFunc in parallel chains,
+/// data of view is shared by all windows
+template<class TFunc>
+RollingWindowResult FitRollingWindows(const TaskDataView& view, const RollingWindowParams& rp)
+{
+  if(rp.windowRows == 0 || rp.stepRows == 0)
+    throw std::invalid_argument("Empty rolling window");
+  const size_t nMaxRows = view.GetMaxRows();
+  // windows are whole for the longest hole
+  const size_t nWindows = nMaxRows > rp.windowRows ? (nMaxRows - rp.windowRows)/rp.stepRows + 1 : 1;
+  RollingWindowResult result;
+  std::vector<TaskDataView> windows;
+  for(size_t k = 0; k<nWindows; ++k)
+  {
+    result.iFirstRows.push_back(k*rp.stepRows);
+    windows.push_back(view.Window(k*rp.stepRows, rp.windowRows));
+  }
+  result.funcParams.resize(TFunc::nParams, nWindows);
+  std::vector<char> isConverged(nWindows);
+  FitViewChains<TFunc>(windows, rp.sp, rp.nChains,
+    [&result, &isConverged](size_t k, const Eigen::VectorXd& params, bool isConvergedK)
+    {
+      isConverged[k] = isConvergedK;
+      result.funcParams.col(k) = params.tail(TFunc::nParams);
+    });
+  result.isConverged.assign(isConverged.begin(), isConverged.end());
+  return result;
+}
+
+#endif // ROLLINGWINDOW_H
@@ -0,0 +1,326 @@
+#include "shardedsolver.h"
+#include "holefile.h"
+#include <iostream>
+#include <stdexcept>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/// Commands of coordinator to worker
+enum ShardCommand: uint32_t
+{
+  /// Reset params to start ones. Reply: nQParams, nFuncParams, function params
+  shardInit = 1,
+  /// Args: function params. Reply: S, r of own holes, max |y-f|, sum (y-f)^2
+  shardNormalEquations,
+  /// Args: function params step, enableNormalizer.
+  /// Reply: max |step|, number of clipped params, function params
+  shardUpdate,
+  /// Reply: q0i params
+  shardParams,
+  shardExit
+};
+
+static void sendAll(int fd, const void * data, size_t size)
+{
+  const char * p = static_cast<const char*>(data);
+  while(size > 0)
+  {
+    const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      throw std::runtime_error("Shard connection is broken");
+    p += n;
+    size -= n;
+  }
+}
+
+static void recvAll(int fd, void * data, size_t size)
+{
+  char * p = static_cast<char*>(data);
+  while(size > 0)
+  {
+    const ssize_t n = recv(fd, p, size, 0);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      throw std::runtime_error("Shard connection is broken");
+    p += n;
+    size -= n;
+  }
+}
+
+static void sendDoubles(int fd, const double * data, size_t n)
+{
+  sendAll(fd, data, n*sizeof(double));
+}
+
+static void recvDoubles(int fd, double * data, size_t n)
+{
+  recvAll(fd, data, n*sizeof(double));
+}
+
+static void sendCommand(int fd, ShardCommand command)
+{
+  const uint32_t val = command;
+  sendAll(fd, &val, sizeof(val));
+}
+
+int ShardedSolver::RunWorker(const std::string& holeFilename, const std::string& family, size_t iFirstHole, size_t iLastHole, bool isWater, int fd)
+{
+  ModelSpec spec;
+  spec.family = family;
+  spec.isWater = isWater;
+  std::unique_ptr<IRegressionModel> model = ModelRegistry::MakeModel(spec, HoleFile(holeFilename).ReadHoles(iFirstHole, iLastHole));
+  const size_t nFuncParams = model->GetFuncParamsCount();
+  const size_t nQParams = model->GetParamsCount() - nFuncParams;
+  Eigen::VectorXd params = model->GenParams0Vec();
+  NormalEquations ne = model->InitNormalEquations();
+  Eigen::MatrixXd S(nFuncParams, nFuncParams);
+  Eigen::VectorXd r(nFuncParams);
+  Eigen::VectorXd delta(params.size());
+  Eigen::VectorXd deltaF(nFuncParams);
+  std::vector<double> reply;
+  
+  for(;;)
+  {
+    uint32_t command = 0;
+    recvAll(fd, &command, sizeof(command));
+    switch(command)
+    {
+      case shardInit:
+        params = model->GenParams0Vec();
+        reply.assign({double(nQParams), double(nFuncParams)});
+        reply.insert(reply.end(), params.data() + nQParams, params.data() + params.size());
+        break;
+      case shardNormalEquations:
+        recvDoubles(fd, params.data() + nQParams, nFuncParams);
+        model->CalcNormalEquations(params, ne);
+        ne.Reduce(S, r);
+        reply.assign(S.data(), S.data() + S.size());
+        reply.insert(reply.end(), r.data(), r.data() + r.size());
+        reply.push_back(ne.maxAbsYMinusF);
+        reply.push_back(ne.sumSqYMinusF);
+        break;
+      case shardUpdate:
+      {
+        double enableNormalizer = 0.0;
+        recvDoubles(fd, deltaF.data(), nFuncParams);
+        recvDoubles(fd, &enableNormalizer, 1);
+        ne.BackSubstitute(deltaF, delta);
+        params += delta;
+        const size_t nClip = enableNormalizer != 0.0 ? model->NormalizeParams(params) : 0;
+        reply.assign({delta.lpNorm<Eigen::Infinity>(), double(nClip)});
+        reply.insert(reply.end(), params.data() + nQParams, params.data() + params.size());
+        break;
+      }
+      case shardParams:
+        reply.assign(params.data(), params.data() + nQParams);
+        break;
+      case shardExit:
+        return 0;
+      default:
+        throw std::runtime_error("Unknown shard command");
+    }
+    sendDoubles(fd, reply.data(), reply.size());
+  }
+}
+
+ShardedSolver::ShardedSolver(const std::string& holeFilename, const ModelSpec& spec, size_t nShards)
+{
+  // unknown family fails here, not in workers
+  ModelRegistry::GetFamily(spec.family);
+  const HoleFile holeFile(holeFilename);
+  const std::vector<HoleFile::HoleIndex>& holes = holeFile.GetHoles();
+  if(holes.empty())
+    throw std::invalid_argument("Empty task data");
+  nShards = std::min(std::max<size_t>(nShards, 1), holes.size());
+  
+  char exePath[4096];
+  const ssize_t exePathSize = readlink("/proc/self/exe", exePath, sizeof(exePath)-1);
+  if(exePathSize <= 0)
+    throw std::runtime_error("Can't find executable for shard workers");
+  exePath[exePathSize] = 0;
+  
+  try
+  {
+    // contiguous hole ranges with about equal number of rows,
+    // every shard has at least one hole
+    size_t iFirst = 0;
+    size_t nRowsDone = 0;
+    for(size_t iShard = 0; iShard<nShards; ++iShard)
+    {
+      const size_t nRowsEnd = holeFile.GetRowsCount()*(iShard+1)/nShards;
+      size_t iLast = iFirst + 1;
+      nRowsDone += holes[iFirst].nRows;
+      while(iLast + (nShards - iShard - 1) < holes.size() && (iShard+1 == nShards || nRowsDone + holes[iLast].nRows <= nRowsEnd))
+        nRowsDone += holes[iLast++].nRows;
+      
+      std::vector<std::string> args{exePath, "--shard-worker", "--hole-file", holeFilename,
+        "--shard-family", spec.family,
+        "--shard-first", std::to_string(iFirst), "--shard-last", std::to_string(iLast)};
+      if(spec.isWater)
+        args.push_back("--shard-water");
+      std::vector<char*> argv;
+      for(const std::string& arg: args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+      argv.push_back(nullptr);
+      
+      int fds[2];
+      if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+        throw std::runtime_error("Can't create shard socket");
+      // OpenMP runtime does not survive fork, so worker is exec'ed
+      const pid_t pid = fork();
+      if(pid == 0)
+      {
+        dup2(fds[1], 0);
+        execv(exePath, argv.data());
+        _exit(127);
+      }
+      close(fds[1]);
+      if(pid < 0)
+      {
+        close(fds[0]);
+        throw std::runtime_error("Can't start shard worker");
+      }
+      _workers.push_back({pid, fds[0], 0});
+      iFirst = iLast;
+    }
+  }
+  catch(...)
+  {
+    stopWorkers();
+    throw;
+  }
+}
+
+ShardedSolver::~ShardedSolver()
+{
+  stopWorkers();
+}
+
+void ShardedSolver::stopWorkers()
+{
+  for(const Worker& worker: _workers)
+  {
+    try
+    {
+      sendCommand(worker.fd, shardExit);
+    }
+    catch(std::exception&)
+    {
+    }
+    close(worker.fd);
+    waitpid(worker.pid, nullptr, 0);
+  }
+  _workers.clear();
+}
+
+void ShardedSolver::SolverInit(const Solver::SolverParams& sp)
+{
+  _sp = sp;
+  for(Worker& worker: _workers)
+    sendCommand(worker.fd, shardInit);
+  for(Worker& worker: _workers)
+  {
+    double sizes[2];
+    recvDoubles(worker.fd, sizes, 2);
+    worker.nQParams = sizes[0];
+    _funcParams.resize(size_t(sizes[1]));
+    recvDoubles(worker.fd, _funcParams.data(), _funcParams.size());
+  }
+  const size_t nFuncParams = _funcParams.size();
+  _S.resize(nFuncParams, nFuncParams);
+  _r.resize(nFuncParams);
+  _deltaF.resize(nFuncParams);
+  _isInited = true;
+}
+
+bool ShardedSolver::iterate(size_t nIter)
+{
+  const size_t nFuncParams = _funcParams.size();
+  for(const Worker& worker: _workers)
+  {
+    sendCommand(worker.fd, shardNormalEquations);
+    sendDoubles(worker.fd, _funcParams.data(), nFuncParams);
+  }
+  // workers compute concurrently, replies are summed in fixed order
+  _S.setZero();
+  _r.setZero();
+  double diff2 = 0.0;
+  std::vector<double> reply(nFuncParams*nFuncParams + nFuncParams + 2);
+  for(const Worker& worker: _workers)
+  {
+    recvDoubles(worker.fd, reply.data(), reply.size());
+    _S += Eigen::Map<const Eigen::MatrixXd>(reply.data(), nFuncParams, nFuncParams);
+    _r += Eigen::Map<const Eigen::VectorXd>(reply.data() + nFuncParams*nFuncParams, nFuncParams);
+    diff2 = std::max(diff2, reply[nFuncParams*nFuncParams + nFuncParams]);
+  }
+  _deltaF = _S.ldlt().solve(_r);
+  
+  const double enableNormalizer = _sp.enableNormalizer ? 1.0 : 0.0;
+  for(const Worker& worker: _workers)
+  {
+    sendCommand(worker.fd, shardUpdate);
+    sendDoubles(worker.fd, _deltaF.data(), nFuncParams);
+    sendDoubles(worker.fd, &enableNormalizer, 1);
+  }
+  double diff1 = 0.0;
+  size_t nClip = 0;
+  reply.resize(2 + nFuncParams);
+  for(size_t iWorker = 0; iWorker<_workers.size(); ++iWorker)
+  {
+    recvDoubles(_workers[iWorker].fd, reply.data(), reply.size());
+    diff1 = std::max(diff1, reply[0]);
+    nClip += size_t(reply[1]);
+    // every worker clips function params the same way
+    if(iWorker == 0)
+      _funcParams = Eigen::Map<const Eigen::VectorXd>(reply.data() + 2, nFuncParams);
+  }
+  
+  if(_sp.verbose > 2)
+    std::cout<<"function params: "<<_funcParams.transpose()<<std::endl;
+  if(nClip>0 && _sp.verbose>1)
+    std::cout<<"Warning: "<<nClip<<" params out of range"<< std::endl;
+  if(_sp.verbose > 0)
+    std::cout<<"Step: "<<nIter<<" diff1: "<<diff1<<" Y-F: "<<diff2<<std::endl;
+  return diff1<_sp.epsDiff || diff2<_sp.epsYMinusF;
+}
+
+bool ShardedSolver::Solve()
+{
+  if(!_isInited)
+    throw std::invalid_argument("Solver not initialized");
+  
+  for(size_t nIter = 0; nIter<_sp.nMaxIter; ++nIter)
+  {
+    if(iterate(nIter))
+    {
+      _isInited = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+Eigen::VectorXd ShardedSolver::GetResult() const
+{
+  size_t nQParams = 0;
+  for(const Worker& worker: _workers)
+  {
+    sendCommand(worker.fd, shardParams);
+    nQParams += worker.nQParams;
+  }
+  Eigen::VectorXd params(nQParams + _funcParams.size());
+  size_t iQ = 0;
+  for(const Worker& worker: _workers)
+  {
+    recvDoubles(worker.fd, params.data() + iQ, worker.nQParams);
+    iQ += worker.nQParams;
+  }
+  params.tail(_funcParams.size()) = _funcParams;
+  return params;
+}
@@ -0,0 +1,56 @@
+#ifndef SHARDEDSOLVER_H
+#define SHARDEDSOLVER_H
+
+#include "solver.h"
+#include "modelregistry.h"
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/// Matrix-free fit by local worker processes.
+/// Every worker owns a range of holes of hole file and their q0i params.
+/// q0i are eliminated by the worker, so per iteration it sends only its
+/// contribution to Schur complement system \f$ S \delta_f = r \f$ of
+/// function params, coordinator sums them and sends back \f$ \delta_f \f$.
+/// Workers are copies of the program started with --shard-worker and
+/// connected by unix socket pairs
+class ShardedSolver
+{
+public:
+  /// Model of spec: family and target, other fields are not used
+  ShardedSolver(const std::string & holeFilename, const ModelSpec & spec, size_t nShards);
+  ~ShardedSolver();
+  ShardedSolver(const ShardedSolver &) = delete;
+  ShardedSolver & operator=(const ShardedSolver &) = delete;
+  
+  void SolverInit(const Solver::SolverParams & sp = Solver::SolverParams());
+  /// Solve problem
+  /// returns true if solution found
+  bool Solve();
+  /// Returns result model params, q0i are gathered from workers
+  Eigen::VectorXd GetResult() const;
+  
+  /// Worker loop over socket fd, returns process exit code
+  static int RunWorker(const std::string & holeFilename, const std::string & family, size_t iFirstHole, size_t iLastHole, bool isWater, int fd);
+  
+private:
+  struct Worker
+  {
+    pid_t pid;
+    int fd;
+    size_t nQParams;
+  };
+  std::vector<Worker> _workers;
+  bool _isInited = false;
+  Solver::SolverParams _sp;
+  Eigen::VectorXd _funcParams;
+  Eigen::MatrixXd _S;
+  Eigen::VectorXd _r;
+  Eigen::VectorXd _deltaF;
+  
+  /// One iteration of Solve. Returns true if converged
+  bool iterate(size_t nIter);
+  void stopWorkers();
+};
+
+#endif // SHARDEDSOLVER_H
@@ -1,29 +1,302 @@
 #include "solver.h"
-#include <eigen3/Eigen/IterativeLinearSolvers>
 #include <cmath>
 #include <limits>
 #include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include "boost_serialization_eigen.h"
+#include "memorytracker.h"
+#include "perfcounters.h"
+
+/// Solver state saved by checkpoints
+struct SolverCheckpoint
+{
+  Eigen::VectorXd params;
+  size_t nIter = 0;
+  /// Task size and params count identify the task
+  size_t taskSize = 0;
+  
+  template <typename Archive>
+  void serialize(Archive &ar, const unsigned int)
+  {
+    ar & params;
+    ar & nIter;
+    ar & taskSize;
+  }
+};
 
 void Solver::SolverInit(const Solver::SolverParams & sp)
 {
   if(!_regressionModel->IsReady())
     throw std::invalid_argument("Empty task data");
   _sp = sp;
-  _modelParams = _regressionModel->GenParams0Vec();
-  _ws = _regressionModel->InitWorkingSet();
+  if(_sp.variableProjection)
+    _sp.matrixFree = true;
+  if(_sp.nStartCandidates > 0)
+    SolverInit(sp, multiStart());
+  else
+    SolverInit(sp, _regressionModel->GenParams0Vec());
+}
+
+void Solver::SolverInit(const Solver::SolverParams& sp, const Eigen::VectorXd& params0)
+{
+  if(!_regressionModel->IsReady())
+    throw std::invalid_argument("Empty task data");
+  if(size_t(params0.size()) != _regressionModel->GetParamsCount())
+    throw std::invalid_argument("Wrong start params size");
+  _sp = sp;
+  if(_sp.variableProjection)
+    _sp.matrixFree = true;
+  _modelParams = params0;
+  _nIter = 0;
+  
+  // buffers keep their memory if sizes are the same as for previous task,
+  // buffers of other modes are released
+  SolverWorkspace& w = *_workspace;
+  const size_t taskSize = _regressionModel->GetTaskSize();
+  const size_t nParams = _regressionModel->GetParamsCount();
+  const size_t nFuncParams = _regressionModel->GetFuncParamsCount();
+  MemoryTracker::Scope scope(MemoryTracker::normalEquations);
+  w.delta.resize(nParams);
+  if(_sp.matrixFree)
+  {
+    w.ne.Resize(nParams - nFuncParams, nFuncParams);
+    w.S.resize(nFuncParams, nFuncParams);
+    w.r.resize(nFuncParams);
+    w.deltaF.resize(nFuncParams);
+    if(w.ldlt.rows() != Eigen::Index(nFuncParams))
+      w.ldlt = Eigen::LDLT<Eigen::MatrixXd>(nFuncParams);
+  }
+  else
+  {
+    w.ne.Resize(0, 0);
+    w.A.resize(nParams, nParams);
+    w.b.resize(nParams);
+    if(w.ldlt.rows() != Eigen::Index(nParams))
+      w.ldlt = Eigen::LDLT<Eigen::MatrixXd>(nParams);
+  }
+  
+  MemoryTracker::Scope scopeWorkingSet(MemoryTracker::workingSet);
+  if(!_sp.matrixFree || _sp.keepYMinusF)
+    w.ws.yMinusF.resize(taskSize);
+  else
+    w.ws.yMinusF.resize(0);
+  if(!_sp.matrixFree && _sp.mixedPrecision)
+  {
+    w.wsF.J.resize(taskSize, nParams);
+    w.wsF.J.setZero();
+    w.wsF.yMinusF.resize(taskSize);
+  }
+  else
+  {
+    w.wsF = WorkingSetF();
+  }
+  if(!_sp.matrixFree && !_sp.mixedPrecision)
+  {
+    w.ws.J.resize(taskSize, nParams);
+    w.ws.J.setZero();
+  }
+  else
+  {
+    w.ws.J.resize(0, 0);
+  }
   _isInited = true;
 }
 
+/// Adds lower triangle of \f$ J^T J \f$ to A. Blocks of columns of A are
+/// computed in parallel, every block by one thread, by tiles of chunks of
+/// rows of J. Parallel product of Eigen sums by blocks which depend on
+/// number of threads, here sums of every element have the same order for
+/// any number of threads. Tiles are small enough for stack buffers of
+/// Eigen GEMM, so no heap allocation is made
+static void addJTJ(const Eigen::Ref<const Eigen::MatrixXd> & J, Eigen::MatrixXd & A)
+{
+  const Eigen::Index tileSize = 64;
+  const Eigen::Index chunkRows = 128;
+  const Eigen::Index nBlocks = (J.cols() + tileSize - 1)/tileSize;
+  #pragma omp parallel for schedule(dynamic)
+  for(Eigen::Index iBlock = 0; iBlock<nBlocks; ++iBlock)
+  {
+    const Eigen::Index iCol = iBlock*tileSize;
+    const Eigen::Index nCols = std::min(tileSize, J.cols() - iCol);
+    for(Eigen::Index iRow = 0; iRow<J.rows(); iRow += chunkRows)
+    {
+      const Eigen::Index nRows = std::min(chunkRows, J.rows() - iRow);
+      for(Eigen::Index iTile = iCol; iTile<J.cols(); iTile += tileSize)
+      {
+        const Eigen::Index nTileRows = std::min(tileSize, J.cols() - iTile);
+        A.block(iTile, iCol, nTileRows, nCols).noalias() += J.block(iRow, iTile, nRows, nTileRows).transpose()*J.block(iRow, iCol, nRows, nCols);
+      }
+    }
+  }
+}
+
+void Solver::solveStep(const Eigen::VectorXd& params, SolverWorkspace& w) const
+{
+  {
+    PerfCounters::Scope counters(PerfCounters::calcValue);
+    _regressionModel->CalcValue(params, w.ws);
+  }
+  {
+    PerfCounters::Scope counters(PerfCounters::normalEquations);
+    w.A.resize(w.ws.J.cols(), w.ws.J.cols());
+    w.A.setZero();
+    addJTJ(w.ws.J, w.A);
+    w.b.resize(w.ws.J.cols());
+    w.b.noalias() = w.ws.J.transpose()*w.ws.yMinusF;
+  }
+  PerfCounters::Scope counters(PerfCounters::linearSolve);
+  w.ldlt.compute(w.A);
+  w.delta = w.ldlt.solve(w.b);
+}
+
+void Solver::solveStepMatrixFree(Eigen::VectorXd& params, SolverWorkspace& w) const
+{
+  // with projected q0i their gradient is zero and Schur complement
+  // is Gauss-Newton matrix of function params only problem
+  {
+    PerfCounters::Scope counters(PerfCounters::normalEquations);
+    if(_sp.variableProjection)
+      _regressionModel->CalcProjectedObjective(params);
+    _regressionModel->CalcNormalEquations(params, w.ne);
+  }
+  PerfCounters::Scope counters(PerfCounters::linearSolve);
+  w.ne.Reduce(w.S, w.r);
+  w.ldlt.compute(w.S);
+  w.deltaF = w.ldlt.solve(w.r);
+  w.ne.BackSubstitute(w.deltaF, w.delta);
+}
+
+/// Sets A and b to \f$ J^T J \f$ and \f$ J^T (y-f) \f$ of float jacobi matrix.
+/// Rows are converted to double jBlock and yBlock by blocks, so no double
+/// copy of J is made
+template<class TVectorY>
+void accumulateNormalEquations(const Eigen::MatrixXf & J, const TVectorY & yMinusF, Eigen::MatrixXd & jBlock, Eigen::VectorXd & yBlock, Eigen::MatrixXd & A, Eigen::VectorXd & b)
+{
+  const Eigen::Index blockRows = 1024;
+  A.setZero();
+  b.setZero();
+  // the last block uses top rows, so blocks keep their size
+  jBlock.resize(std::min(blockRows, J.rows()), J.cols());
+  yBlock.resize(jBlock.rows());
+  for(Eigen::Index iRow = 0; iRow<J.rows(); iRow += blockRows)
+  {
+    const Eigen::Index nRows = std::min(blockRows, J.rows() - iRow);
+    jBlock.topRows(nRows) = J.middleRows(iRow, nRows).cast<double>();
+    yBlock.head(nRows) = yMinusF.segment(iRow, nRows).template cast<double>();
+    addJTJ(jBlock.topRows(nRows), A);
+    b.noalias() += jBlock.topRows(nRows).transpose()*yBlock.head(nRows);
+  }
+}
+
+void Solver::solveStepF(const Eigen::VectorXd& params, const Eigen::VectorXd * yMinusF)
+{
+  SolverWorkspace& w = *_workspace;
+  {
+    PerfCounters::Scope counters(PerfCounters::calcValue);
+    _regressionModel->CalcValue(params, w.wsF);
+  }
+  {
+    PerfCounters::Scope counters(PerfCounters::normalEquations);
+    if(yMinusF)
+      accumulateNormalEquations(w.wsF.J, *yMinusF, w.jBlock, w.yBlock, w.A, w.b);
+    else
+      accumulateNormalEquations(w.wsF.J, w.wsF.yMinusF, w.jBlock, w.yBlock, w.A, w.b);
+  }
+  PerfCounters::Scope counters(PerfCounters::linearSolve);
+  w.ldlt.compute(w.A);
+  w.delta = w.ldlt.solve(w.b);
+}
+
+void Solver::refineStep()
+{
+  SolverWorkspace& w = *_workspace;
+  _regressionModel->CalcResidual(_modelParams, w.ws.yMinusF);
+  solveStepF(_modelParams, &w.ws.yMinusF);
+  _modelParams += w.delta;
+  if(_sp.enableNormalizer)
+    _regressionModel->NormalizeParams(_modelParams);
+  _regressionModel->CalcResidual(_modelParams, w.ws.yMinusF);
+}
+
+const Eigen::VectorXd& Solver::step()
+{
+  SolverWorkspace& w = *_workspace;
+  // product and solver temporaries
+  MemoryTracker::Scope scope(MemoryTracker::normalEquations);
+  if(_sp.matrixFree)
+    solveStepMatrixFree(_modelParams, w);
+  else if(_sp.mixedPrecision)
+    solveStepF(_modelParams);
+  else
+    solveStep(_modelParams, w);
+  return w.delta;
+}
+
 Eigen::VectorXd Solver::SolveStep()
 {
-  using namespace Eigen;
+  return step();
+}
+
+double Solver::runIterations(Eigen::VectorXd& params, SolverWorkspace& w, size_t nIter) const
+{
+  for(size_t iIter = 0; iIter<nIter; ++iIter)
+  {
+    solveStepMatrixFree(params, w);
+    params += w.delta;
+    if(_sp.enableNormalizer)
+      _regressionModel->NormalizeParams(params);
+  }
+  if(_sp.variableProjection)
+    return _regressionModel->CalcProjectedObjective(params);
+  _regressionModel->CalcNormalEquations(params, w.ne);
+  return w.ne.sumSqYMinusF;
+}
 
-  _regressionModel->CalcValue(_modelParams, _ws);
-  MatrixXd A = _ws.J.transpose()*_ws.J;
-  MatrixXd b = _ws.J.transpose()*_ws.yMinusF;
-  ConjugateGradient<MatrixXd, Lower|Upper> cg;
-  cg.compute(A);
-  return cg.solve(b);
+Eigen::VectorXd Solver::multiStart() const
+{
+  Eigen::MatrixXd candidates = _regressionModel->GenStartCandidates(_sp.nStartCandidates, _sp.startSeed);
+  const size_t nCandidates = candidates.cols();
+  std::vector<double> objectives(nCandidates);
+  #pragma omp parallel for schedule(dynamic)
+  for(size_t i = 0; i<nCandidates; ++i)
+  {
+    Eigen::VectorXd params = candidates.col(i);
+    objectives[i] = _regressionModel->CalcProjectedObjective(params);
+    _regressionModel->NormalizeParams(params);
+    candidates.col(i) = params;
+  }
+  
+  std::vector<size_t> order(nCandidates);
+  std::iota(order.begin(), order.end(), 0);
+  const size_t nSolves = std::min(std::max<size_t>(_sp.nStartSolves, 1), nCandidates);
+  std::partial_sort(order.begin(), order.begin()+nSolves, order.end(),
+    [&objectives](size_t l, size_t r){return objectives[l]<objectives[r];});
+  
+  std::vector<Eigen::VectorXd> starts(nSolves);
+  std::vector<double> results(nSolves);
+  #pragma omp parallel for schedule(dynamic)
+  for(size_t i = 0; i<nSolves; ++i)
+  {
+    starts[i] = candidates.col(order[i]);
+    // short solves run in parallel, every one in own workspace. They are
+    // matrix-free in any mode, so they need no jacobi matrix
+    SolverWorkspace w;
+    w.ne = _regressionModel->InitNormalEquations();
+    results[i] = runIterations(starts[i], w, _sp.nStartIter);
+    if(!std::isfinite(results[i]))
+      results[i] = std::numeric_limits<double>::max();
+  }
+  
+  const size_t iBest = std::min_element(results.begin(), results.end()) - results.begin();
+  if(_sp.verbose > 0)
+    std::cout<<"Multi-start: "<<nCandidates<<" candidates, best objective: "<<objectives[order[0]]
+      <<", after short solves: "<<results[iBest]<<std::endl;
+  return starts[iBest];
 }
 
 Eigen::VectorXd Solver::GetResult() const
@@ -31,47 +304,157 @@ Eigen::VectorXd Solver::GetResult() const
   return _modelParams;
 }
 
+bool Solver::iterate(size_t nIter)
+{
+  const SolverWorkspace& w = *_workspace;
+  const PerfCounters::Snapshot counters = PerfCounters::GetSnapshot();
+  const Eigen::VectorXd& deltaParams = step();
+  _modelParams += deltaParams;
+
+  if(_sp.verbose > 2)
+    std::cout<<"params: "<<_modelParams<<std::endl;
+  if(_sp.verbose > 3 && !_sp.matrixFree)
+  {
+    if(_sp.mixedPrecision)
+      std::cout<<"y-f: "<< w.wsF.yMinusF<<std::endl;
+    else
+      std::cout<<"y-f: "<< w.ws.yMinusF<<std::endl;
+  }
+  
+  if(_sp.enableNormalizer)
+  {
+    size_t nClip =_regressionModel->NormalizeParams(_modelParams);
+    if( nClip>0  && _sp.verbose>1)
+      std::cout<<"Warning: "<<nClip<<" params out of range"<< std::endl;
+  }
+  
+  if(_sp.nBreakpointCandidates > 0)
+  {
+    bool isMoved = _regressionModel->SweepBreakpoint(_modelParams, _sp.nBreakpointCandidates);
+    if(isMoved && _sp.verbose > 1)
+      std::cout<<"Breakpoint moved"<<std::endl;
+  }
+  
+  double diff1 = deltaParams.lpNorm<Eigen::Infinity>();
+  double diff2 = 0.0;
+  if(_sp.matrixFree)
+    diff2 = w.ne.maxAbsYMinusF;
+  else if(_sp.mixedPrecision)
+    diff2 = w.wsF.yMinusF.lpNorm<Eigen::Infinity>();
+  else
+    diff2 = w.ws.yMinusF.lpNorm<Eigen::Infinity>();
+  if(_sp.verbose > 0)
+  {
+    std::cout<<"Step: "<<nIter<<" diff1: "<<diff1<<" Y-F: "<<diff2<<std::endl;
+    PerfCounters::Report(std::cout, "step " + std::to_string(nIter), counters);
+  }
+  return diff1<_sp.epsDiff || diff2<_sp.epsYMinusF;
+}
+
 bool Solver::Solve()
 {
   if(!_isInited)
     throw std::invalid_argument("Solver not initialized");
   
-  for(size_t nIter = 0; nIter<_sp.nMaxIter; ++nIter)
+  for(; _nIter<_sp.nMaxIter; ++_nIter)
   {
-    Eigen::VectorXd deltaParams = SolveStep();
-    _modelParams += deltaParams;
-
-    if(_sp.verbose > 2)
-      std::cout<<"params: "<<_modelParams<<std::endl;
-    if(_sp.verbose > 3)
-      std::cout<<"y-f: "<< _ws.yMinusF<<std::endl;
-    
-    if(_sp.enableNormalizer)
-    {
-      size_t nClip =_regressionModel->NormalizeParams(_modelParams);
-      if( nClip>0  && _sp.verbose>1)
-        std::cout<<"Warning: "<<nClip<<" params out of range"<< std::endl;
-    }
-    
-    double diff1 = deltaParams.lpNorm<Eigen::Infinity>();
-    double diff2 = _ws.yMinusF.lpNorm<Eigen::Infinity>();
-    if(_sp.verbose > 0)
-      std::cout<<"Step: "<<nIter<<" diff1: "<<diff1<<" Y-F: "<<diff2<<std::endl;
-    if(diff1<_sp.epsDiff || diff2<_sp.epsYMinusF)
+    if(iterate(_nIter))
     {
+      finish();
+      if(!_sp.checkpointFile.empty())
+        std::remove(_sp.checkpointFile.c_str());
       _isInited = false;
       return true;
     }
+    if(!_sp.checkpointFile.empty() && (_nIter+1) % std::max<size_t>(_sp.checkpointInterval, 1) == 0)
+      saveCheckpoint(_nIter+1);
   }
+  finish();
+  // not converged fit may be resumed with more iterations
+  if(!_sp.checkpointFile.empty())
+    saveCheckpoint(_nIter);
   return false;
 }
 
-Solver::Solver(std::unique_ptr<IRegressionModel> rm)
+bool Solver::SolverResume(const Solver::SolverParams& sp)
+{
+  SolverCheckpoint checkpoint;
+  {
+    std::ifstream ifs(sp.checkpointFile, std::ios::binary);
+    if(sp.checkpointFile.empty() || !ifs)
+    {
+      SolverInit(sp);
+      return false;
+    }
+    boost::archive::binary_iarchive ia(ifs);
+    ia>>checkpoint;
+  }
+  if(checkpoint.taskSize != _regressionModel->GetTaskSize()
+    || size_t(checkpoint.params.size()) != _regressionModel->GetParamsCount())
+    throw std::invalid_argument("Checkpoint does not match task: " + sp.checkpointFile);
+  SolverInit(sp, checkpoint.params);
+  _nIter = checkpoint.nIter;
+  if(_sp.verbose > 0)
+    std::cout<<"Resumed from iteration "<<_nIter<<std::endl;
+  return true;
+}
+
+void Solver::saveCheckpoint(size_t nIter) const
+{
+  SolverCheckpoint checkpoint;
+  checkpoint.params = _modelParams;
+  checkpoint.nIter = nIter;
+  checkpoint.taskSize = _regressionModel->GetTaskSize();
+  // file is replaced only by complete checkpoint
+  const std::string tmpFile = _sp.checkpointFile + ".tmp";
+  {
+    std::ofstream ofs(tmpFile, std::ios::binary);
+    boost::archive::binary_oarchive oa(ofs);
+    oa<<checkpoint;
+    if(!ofs)
+      throw std::runtime_error("Can't write checkpoint " + tmpFile);
+  }
+  if(std::rename(tmpFile.c_str(), _sp.checkpointFile.c_str()) != 0)
+    throw std::runtime_error("Can't write checkpoint " + _sp.checkpointFile);
+}
+
+void Solver::finish()
+{
+  SolverWorkspace& w = *_workspace;
+  if(_sp.matrixFree)
+  {
+    // back substituted q0i step is linearized, result gets exact optimum
+    if(_sp.variableProjection)
+      _regressionModel->CalcProjectedObjective(_modelParams);
+    if(_sp.keepYMinusF)
+      _regressionModel->CalcResidual(_modelParams, w.ws.yMinusF);
+  }
+  else if(_sp.mixedPrecision)
+    refineStep();
+}
+
+Solver::Solver(std::unique_ptr<IRegressionModel> rm, std::shared_ptr<SolverWorkspace> workspace)
 : _regressionModel(std::move(rm))
+, _workspace(workspace ? workspace : std::make_shared<SolverWorkspace>())
+{
+}
+
+const WorkingSet& Solver::GetWorkingSet() const
+{
+  return _workspace->ws;
+}
+
+const Eigen::VectorXd& Solver::GetYMinusF() const
+{
+  return _workspace->ws.yMinusF;
+}
+
+const SolverWorkspace& Solver::GetWorkspace() const
 {
+  return *_workspace;
 }
 
-WorkingSet Solver::GetWorkingSet() const
+const IRegressionModel& Solver::GetModel() const
 {
-  return _ws;
+  return *_regressionModel;
 }
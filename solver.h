@@ -3,6 +3,33 @@
 
 #include "regressionmodels.h"
 #include <memory>
+#include <string>
+
+/// Solver buffers. They are sized on SolverInit and reused by every
+/// iteration and by every solver sharing the workspace, so steady state
+/// iterations make no heap allocations
+struct SolverWorkspace
+{
+  WorkingSet ws;
+  /// float working set for mixedPrecision
+  WorkingSetF wsF;
+  /// normal equations for matrixFree
+  NormalEquations ne;
+  /// dense normal equations, lower triangle of A
+  Eigen::MatrixXd A;
+  Eigen::VectorXd b;
+  /// double rows block of float jacobi matrix and of y-f
+  Eigen::MatrixXd jBlock;
+  Eigen::VectorXd yBlock;
+  /// reduced system of matrixFree
+  Eigen::MatrixXd S;
+  Eigen::VectorXd r;
+  Eigen::VectorXd deltaF;
+  /// factorization of A or of S
+  Eigen::LDLT<Eigen::MatrixXd> ldlt;
+  /// params step
+  Eigen::VectorXd delta;
+};
 
 /// Regression task solver
 class Solver
@@ -17,6 +44,16 @@ public:
     , nMaxIter(1000)
     , verbose(0)
     , enableNormalizer(true)
+    , nStartCandidates(0)
+    , nStartSolves(3)
+    , nStartIter(5)
+    , startSeed(12345)
+    , nBreakpointCandidates(0)
+    , mixedPrecision(false)
+    , matrixFree(false)
+    , keepYMinusF(true)
+    , variableProjection(false)
+    , checkpointInterval(10)
     {
     }
     double epsDiff;
@@ -24,6 +61,34 @@ public:
     size_t nMaxIter;
     int verbose;
     bool enableNormalizer;
+    /// Multi-start: number of sampled start points, 0 disables multi-start
+    size_t nStartCandidates;
+    /// Multi-start: number of best candidates refined by short solves
+    size_t nStartSolves;
+    /// Multi-start: iterations of every short solve
+    size_t nStartIter;
+    unsigned int startSeed;
+    /// Breakpoint sweep after every step: number of candidate
+    /// breakpoints, 0 disables sweep
+    size_t nBreakpointCandidates;
+    /// Store jacobi matrix and y-f in float, accumulate normal equations
+    /// in double and finish with one full precision refinement step
+    bool mixedPrecision;
+    /// Accumulate normal equations directly, without jacobi matrix.
+    /// Memory does not depend on task size
+    bool matrixFree;
+    /// Compute \f$ y-f \f$ of result for matrixFree mode. Disable it when
+    /// task does not fit memory, GetYMinusF is empty then
+    bool keepYMinusF;
+    /// Variable projection: before every step q0i params are replaced by
+    /// their closed form optimum for current function params, so Gauss-Newton
+    /// iterates over function params only. Implies matrixFree
+    bool variableProjection;
+    /// Solve writes checkpoint to this file every checkpointInterval
+    /// iterations and after the last one, removes it when converged.
+    /// Empty disables checkpoints
+    std::string checkpointFile;
+    size_t checkpointInterval;
   };
 private:
   //Solver state;
@@ -34,22 +99,69 @@ private:
   std::unique_ptr<IRegressionModel> _regressionModel;
   
   //working set
-  WorkingSet _ws;
+  std::shared_ptr<SolverWorkspace> _workspace;
   Eigen::VectorXd _modelParams;
+  /// Iterations done since SolverInit
+  size_t _nIter = 0;
+  
+  /// Gauss-Newton step for params into w.delta by jacobi matrix of w.ws
+  /// and dense normal equations
+  void solveStep(const Eigen::VectorXd & params, SolverWorkspace & w) const;
+  /// Same by matrix-free normal equations w.ne. With variableProjection
+  /// q0i of params are replaced by their optimum first
+  void solveStepMatrixFree(Eigen::VectorXd & params, SolverWorkspace & w) const;
+  /// Step of current mode into workspace delta
+  const Eigen::VectorXd & step();
+  /// Mixed precision step: float jacobi matrix, double normal equations.
+  /// Full precision residual is used instead of float one if given
+  void solveStepF(const Eigen::VectorXd & params, const Eigen::VectorXd * yMinusF = nullptr);
+  /// Full precision refinement step after mixed precision iterations
+  void refineStep();
+  /// One iteration of Solve. Returns true if converged
+  bool iterate(size_t nIter);
+  /// Fills y-f of working set for modes that do not keep it
+  void finish();
+  /// Writes params and nIter iterations done to checkpoint file
+  void saveCheckpoint(size_t nIter) const;
+  /// Makes nIter matrix-free steps from params, projected ones with
+  /// variableProjection, returns sum of squared residuals. Normal
+  /// equations of w are initialized by caller
+  double runIterations(Eigen::VectorXd & params, SolverWorkspace & w, size_t nIter) const;
+  /// Selects start params: evaluates sampled candidates in one parallel
+  /// pass and refines the best of them by short parallel solves
+  Eigen::VectorXd multiStart() const;
 public:
-  Solver(std::unique_ptr<IRegressionModel> rm);
+  /// Solvers may share workspace, if it is not given solver creates own
+  Solver(std::unique_ptr<IRegressionModel> rm, std::shared_ptr<SolverWorkspace> workspace = nullptr);
   
   void SolverInit(const SolverParams & sp = SolverParams());
+  /// Warm start from given params, multi-start is not used
+  void SolverInit(const SolverParams & sp, const Eigen::VectorXd & params0);
+  /// Continues from sp.checkpointFile if it exists, otherwise same as
+  /// SolverInit(sp). Gauss-Newton state is params only, working set is
+  /// recomputed from them, so resumed solve makes the same steps.
+  /// Returns true if resumed
+  bool SolverResume(const SolverParams & sp);
   /// One solve step. Genereates and solves SLE from regression model
   Eigen::VectorXd  SolveStep();
   /// Returns result model params
   Eigen::VectorXd GetResult() const;
   
-  WorkingSet GetWorkingSet() const;
+  /// View of working set, valid until next SolverInit of any solver
+  /// sharing the workspace. Jacobi matrix is empty for matrixFree and
+  /// mixedPrecision modes
+  const WorkingSet & GetWorkingSet() const;
+  /// View of \f$ y-f \f$ of result
+  const Eigen::VectorXd & GetYMinusF() const;
+  /// Buffers of the last step, valid until next SolverInit of any solver
+  /// sharing the workspace
+  const SolverWorkspace & GetWorkspace() const;
+  const IRegressionModel & GetModel() const;
 
   /// Solve problem
   /// returns true if solution found
   bool Solve();
+  friend class Tester;
 };
 
 
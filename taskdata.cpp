@@ -33,12 +33,14 @@ void TaskDataHelper::StripTaskData(TaskData& taskData, size_t iHole, size_t nHol
   nHole = nHole>nn? nn:nHole;
   for(size_t j = 0; j<nHole; ++j)
   {
-    taskData.holes[j] = taskData.holes[j+iHole];
+    if(iHole > 0)
+      taskData.holes[j] = std::move(taskData.holes[j+iHole]);
     size_t nnQ = taskData.holes[j].ts.size();
     if(nQ<nnQ)
     {
       taskData.holes[j].ts.resize(nQ);
       taskData.holes[j].qOils.resize(nQ);
+      taskData.holes[j].qWaters.resize(std::min(nQ, taskData.holes[j].qWaters.size()));
     }
   }
   taskData.holes.resize(nHole);
@@ -0,0 +1,59 @@
+#include "taskdataview.h"
+#include <numeric>
+#include <stdexcept>
+#include <limits>
+
+TaskDataView::TaskDataView(std::shared_ptr<const OptimizedTaskData> data)
+: _data(data)
+, _holes(data->holes.size())
+, _iFirstRow(0)
+, _nRows(std::numeric_limits<size_t>::max())
+{
+  std::iota(_holes.begin(), _holes.end(), 0);
+}
+
+TaskDataView TaskDataView::Holes(size_t iFirst, size_t n) const
+{
+  TaskDataView view(*this);
+  iFirst = std::min(iFirst, _holes.size());
+  n = std::min(n, _holes.size() - iFirst);
+  view._holes.assign(_holes.begin() + iFirst, _holes.begin() + iFirst + n);
+  return view;
+}
+
+TaskDataView TaskDataView::Holes(const std::vector<size_t>& iHoles) const
+{
+  TaskDataView view(*this);
+  view._holes.resize(iHoles.size());
+  for(size_t i = 0; i<iHoles.size(); ++i)
+  {
+    if(iHoles[i] >= _holes.size())
+      throw std::out_of_range("Wrong hole of view");
+    view._holes[i] = _holes[iHoles[i]];
+  }
+  return view;
+}
+
+TaskDataView TaskDataView::Window(size_t iFirstRow, size_t nRows) const
+{
+  TaskDataView view(*this);
+  view._iFirstRow = _iFirstRow + std::min(iFirstRow, _nRows);
+  view._nRows = std::min(nRows, _nRows - std::min(iFirstRow, _nRows));
+  return view;
+}
+
+size_t TaskDataView::GetRowsCount() const
+{
+  size_t nRows = 0;
+  for(size_t i = 0; i<_holes.size(); ++i)
+    nRows += GetHole(i).sumT.size();
+  return nRows;
+}
+
+size_t TaskDataView::GetMaxRows() const
+{
+  size_t nMax = 0;
+  for(size_t i = 0; i<_holes.size(); ++i)
+    nMax = std::max(nMax, GetHole(i).sumT.size());
+  return nMax;
+}
@@ -0,0 +1,54 @@
+#ifndef TASKDATAVIEW_H
+#define TASKDATAVIEW_H
+
+#include "regressionmodels.h"
+#include <memory>
+#include <vector>
+
+/// Holes subset and rows window of shared optimized task data.
+/// Views are cheap to copy and to narrow, rows are never copied
+class TaskDataView
+{
+  std::shared_ptr<const OptimizedTaskData> _data;
+  /// Holes of data in view order
+  std::vector<size_t> _holes;
+  /// Window of rows of every hole
+  size_t _iFirstRow;
+  size_t _nRows;
+public:
+  /// All holes and rows of data
+  explicit TaskDataView(std::shared_ptr<const OptimizedTaskData> data);
+  
+  /// Holes [iFirst, iFirst+n) of this view, clipped to its holes
+  TaskDataView Holes(size_t iFirst, size_t n) const;
+  /// Holes of this view by their indices in it
+  TaskDataView Holes(const std::vector<size_t>& iHoles) const;
+  /// Rows [iFirstRow, iFirstRow+nRows) of current window of every hole.
+  /// Holes shorter than window have less rows or none
+  TaskDataView Window(size_t iFirstRow, size_t nRows) const;
+  
+  size_t GetHolesCount() const
+  {
+    return _holes.size();
+  }
+  /// Index in shared data of view hole i
+  size_t GetDataHole(size_t i) const
+  {
+    return _holes[i];
+  }
+  /// Window of view hole i
+  HoleView GetHole(size_t i) const
+  {
+    const OptimizedHoleData& hole = _data->holes[_holes[i]];
+    const size_t n = hole.sumT.size();
+    const size_t iFirst = std::min(_iFirstRow, n);
+    const size_t nRows = std::min(_nRows, n - iFirst);
+    return HoleView{RowsView(hole.sumT.data() + iFirst, nRows), RowsView(hole.qDivT.data() + iFirst, nRows)};
+  }
+  /// Rows of all holes in window
+  size_t GetRowsCount() const;
+  /// Rows of the longest hole from the window start
+  size_t GetMaxRows() const;
+};
+
+#endif // TASKDATAVIEW_H
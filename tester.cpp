@@ -1,4 +1,36 @@
 #include "tester.h"
+#include "outofcoremodel.h"
+#include "shardedsolver.h"
+#include "fitserver.h"
+#include "bootstrap.h"
+#include "mixture.h"
+#include "importpipeline.h"
+#include "analyze.h"
+#include "backtest.h"
+#include "modelregistry.h"
+#include "compacttaskdata.h"
+#include "perfcounters.h"
+#include <random>
+#include <sstream>
+#include <fstream>
+#include <map>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <thread>
+#include <boost/filesystem.hpp>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+Tester::Tester(const std::string & dataFilename)
+: _dataFilename(dataFilename)
+{
+}
 
 void Tester::testSolver()
 {
@@ -24,10 +56,1299 @@ void Tester::testSolver()
   std::cout<<"test passed"<<std::endl;
 }
 
+void Tester::testMultiStart()
+{
+  const std::vector<size_t> sizes{100, 50, 80};
+  Eigen::VectorXd funcParams(2);
+  funcParams<<1e-3, 0.5;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  RegressionModelLn3 rm(generateTaskData<Function3>(sizes, q0iParams, funcParams));
+  
+  Eigen::VectorXd params0 = rm.GenParams0Vec();
+  const double objective0 = rm.CalcProjectedObjective(params0);
+  Eigen::MatrixXd candidates = rm.GenStartCandidates(64, 1);
+  tassert(candidates.cols() == 64);
+  tassert(candidates.col(0) == rm.GenParams0Vec());
+  double bestObjective = objective0;
+  for(Eigen::Index i = 0; i<candidates.cols(); ++i)
+  {
+    Eigen::VectorXd params = candidates.col(i);
+    bestObjective = std::min(bestObjective, rm.CalcProjectedObjective(params));
+  }
+  tassert(bestObjective < objective0);
+  
+  Solver::SolverParams sp;
+  sp.nStartCandidates = 64;
+  sp.nMaxIter = 50;
+  Solver solver(std::make_unique<RegressionModelLn3>(rm));
+  solver.SolverInit(sp);
+  solver.Solve();
+  Eigen::VectorXd res = solver.GetResult();
+  std::cout<<"Multi-start solution: "<<res.transpose()<<std::endl;
+  tassert(rm.CalcProjectedObjective(res) <= bestObjective);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testBreakpointSweep()
+{
+  const std::vector<size_t> sizes{30, 20, 25};
+  Eigen::VectorXd funcParams(3);
+  funcParams<<2.0, 0.3, 4000;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  Eigen::VectorXd params(q0iParams.size() + funcParams.size());
+  params<<q0iParams, funcParams;
+  RegressionModelLn4 rm(generateTaskData<Function4>(sizes, q0iParams, funcParams));
+  
+  Eigen::VectorXd swept = params;
+  swept[params.size()-1] = Function4::GetDefaultParam(2);
+  tassert(rm.SweepBreakpoint(swept, 64));
+  std::cout<<"Swept tau: "<<swept[params.size()-1]<<std::endl;
+  tassert(std::abs(swept[params.size()-1] - funcParams[2]) <= 500);
+  tassert(!rm.SweepBreakpoint(swept, 64));
+  // view of the same rows is swept to the same tau
+  const TaskDataView view(std::make_shared<const OptimizedTaskData>(generateTaskData<Function4>(sizes, q0iParams, funcParams)));
+  Eigen::VectorXd sweptView = params;
+  sweptView[params.size()-1] = Function4::GetDefaultParam(2);
+  tassert(ViewRegressionModelLn<Function4>(view).SweepBreakpoint(sweptView, 64));
+  tassert(sweptView == swept);
+  
+  // series objectives select the same tau as exact objectives of all
+  // row times from far start
+  auto calcObjective = [&rm](const Eigen::VectorXd & p)
+  {
+    NormalEquations ne = rm.InitNormalEquations();
+    rm.CalcNormalEquations(p, ne);
+    return ne.sumSqYMinusF;
+  };
+  Eigen::VectorXd shifted = params;
+  shifted[params.size()-2] = 0.35;
+  shifted[params.size()-1] = 100;
+  Eigen::VectorXd best = shifted;
+  for(size_t j = 0; j<sizes[0]; ++j)
+  {
+    Eigen::VectorXd candidate = shifted;
+    candidate[params.size()-1] = 500.0*j + 250.0;
+    if(calcObjective(candidate) < calcObjective(best))
+      best = candidate;
+  }
+  tassert(rm.SweepBreakpoint(shifted, 64));
+  std::cout<<"Swept tau: "<<shifted[params.size()-1]<<", exact search: "<<best[params.size()-1]<<std::endl;
+  tassert(shifted[params.size()-1] == best[params.size()-1]);
+  
+  RegressionModelLn2 rm2(generateTaskData<Function2>(sizes, q0iParams, Eigen::VectorXd::Constant(1, 0.3)));
+  Eigen::VectorXd params2(q0iParams.size() + 1);
+  params2<<q0iParams, 0.3;
+  tassert(!rm2.SweepBreakpoint(params2, 64));
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testMixedPrecision()
+{
+  const std::vector<size_t> sizes{100, 50, 80};
+  Eigen::VectorXd funcParams(2);
+  funcParams<<1e-3, 0.5;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  RegressionModelLn3 rm(generateTaskData<Function3>(sizes, q0iParams, funcParams));
+  
+  Solver::SolverParams sp;
+  sp.nMaxIter = 100;
+  // defaults are too far from solution for Function3
+  sp.nStartCandidates = 16;
+  Solver solverD(std::make_unique<RegressionModelLn3>(rm));
+  solverD.SolverInit(sp);
+  solverD.Solve();
+  sp.mixedPrecision = true;
+  Solver solverF(std::make_unique<RegressionModelLn3>(rm));
+  solverF.SolverInit(sp);
+  solverF.Solve();
+  
+  const Eigen::VectorXd resD = solverD.GetResult();
+  const Eigen::VectorXd resF = solverF.GetResult();
+  std::cout<<"Double: "<<resD.transpose()<<std::endl;
+  std::cout<<"Mixed:  "<<resF.transpose()<<std::endl;
+  tassert(((resD - resF).array().abs() <= 1e-4*resD.array().abs()).all());
+  tassert(solverF.GetWorkingSet().yMinusF.size() == solverD.GetWorkingSet().yMinusF.size());
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testMatrixFree()
+{
+  const std::vector<size_t> sizes{100, 50, 80};
+  Eigen::VectorXd funcParams(2);
+  funcParams<<1e-3, 0.5;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  TaskData taskData = generateTaskData<Function3>(sizes, q0iParams, funcParams);
+  taskData.holes[1].qOils[3] = 0.0;
+  RegressionModelLn3 rm(taskData);
+  
+  Eigen::VectorXd params = rm.GenParams0Vec();
+  WorkingSet ws = rm.InitWorkingSet();
+  rm.CalcValue(params, ws);
+  const Eigen::MatrixXd A = ws.J.transpose()*ws.J;
+  const Eigen::VectorXd b = ws.J.transpose()*ws.yMinusF;
+  NormalEquations ne = rm.InitNormalEquations();
+  rm.CalcNormalEquations(params, ne);
+  const size_t nQ = sizes.size();
+  const double eps = 1e-9;
+  tassert((Eigen::VectorXd(A.diagonal().head(nQ)) - ne.qDiag).lpNorm<Eigen::Infinity>() <= eps*ne.qDiag.lpNorm<Eigen::Infinity>());
+  tassert((A.topRightCorner(nQ, 2) - ne.qCross).lpNorm<Eigen::Infinity>() <= eps*ne.qCross.lpNorm<Eigen::Infinity>());
+  tassert((A.bottomRightCorner(2, 2) - ne.fA).lpNorm<Eigen::Infinity>() <= eps*ne.fA.lpNorm<Eigen::Infinity>());
+  tassert((b.head(nQ) - ne.qB).lpNorm<Eigen::Infinity>() <= eps*ne.qB.lpNorm<Eigen::Infinity>());
+  tassert((b.tail(2) - ne.fB).lpNorm<Eigen::Infinity>() <= eps*ne.fB.lpNorm<Eigen::Infinity>());
+  tassert(std::abs(ne.sumSqYMinusF - ws.yMinusF.squaredNorm()) <= eps*ne.sumSqYMinusF);
+  
+  Solver::SolverParams sp;
+  sp.nMaxIter = 100;
+  sp.nStartCandidates = 16;
+  Solver solverD(std::make_unique<RegressionModelLn3>(rm));
+  solverD.SolverInit(sp);
+  solverD.Solve();
+  sp.matrixFree = true;
+  Solver solverMF(std::make_unique<RegressionModelLn3>(rm));
+  solverMF.SolverInit(sp);
+  solverMF.Solve();
+  const Eigen::VectorXd resD = solverD.GetResult();
+  const Eigen::VectorXd resMF = solverMF.GetResult();
+  std::cout<<"Dense:       "<<resD.transpose()<<std::endl;
+  std::cout<<"Matrix-free: "<<resMF.transpose()<<std::endl;
+  tassert(((resD - resMF).array().abs() <= 1e-6*resD.array().abs()).all());
+  tassert(solverMF.GetWorkingSet().yMinusF.size() == ws.yMinusF.size());
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testVariableProjection()
+{
+  const std::vector<size_t> sizes{100, 50, 80};
+  Eigen::VectorXd funcParams(2);
+  funcParams<<1e-3, 0.5;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  TaskData taskData = generateTaskData<Function3>(sizes, q0iParams, funcParams);
+  taskData.holes[1].qOils[3] = 0.0;
+  
+  Solver::SolverParams sp;
+  sp.nMaxIter = 100;
+  sp.matrixFree = true;
+  sp.nStartCandidates = 16;
+  Solver solverRef(std::make_unique<RegressionModelLn3>(taskData));
+  solverRef.SolverInit(sp);
+  tassert(solverRef.Solve());
+  const Eigen::VectorXd resRef = solverRef.GetResult();
+  
+  // function params off by factor 2: joint iteration from here ends with
+  // collapsed q0i, projection keeps them optimal on every step
+  Eigen::VectorXd params0 = RegressionModelLn3(taskData).GenParams0Vec();
+  params0.tail(2) = 2.0*funcParams;
+  sp.nStartCandidates = 0;
+  Solver solverMF(std::make_unique<RegressionModelLn3>(taskData));
+  solverMF.SolverInit(sp, params0);
+  solverMF.Solve();
+  sp.variableProjection = true;
+  Solver solverVP(std::make_unique<RegressionModelLn3>(taskData));
+  solverVP.SolverInit(sp, params0);
+  tassert(solverVP.Solve());
+  const Eigen::VectorXd resVP = solverVP.GetResult();
+  std::cout<<"Multi-start: "<<resRef.transpose()<<std::endl;
+  std::cout<<"Joint:       "<<solverMF.GetResult().transpose()<<", iterations: "<<solverMF._nIter<<std::endl;
+  std::cout<<"Projection:  "<<resVP.transpose()<<", iterations: "<<solverVP._nIter<<std::endl;
+  tassert(((resRef - resVP).array().abs() <= 1e-6*resRef.array().abs()).all());
+  // result q0i are exact optimum for its function params
+  Eigen::VectorXd projected = resVP;
+  solverVP.GetModel().CalcProjectedObjective(projected);
+  tassert(((projected - resVP).array().abs() <= 1e-12*resVP.array().abs()).all());
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testDeterministicReductions()
+{
+  std::vector<size_t> sizes;
+  for(size_t i = 0; i<150; ++i)
+    sizes.push_back(20 + (i*37)%90);
+  Eigen::VectorXd funcParams(2);
+  funcParams<<1e-3, 0.5;
+  Eigen::VectorXd q0iParams = Eigen::VectorXd::LinSpaced(sizes.size(), 1.0, 5.0);
+  TaskData taskData = generateTaskData<Function3>(sizes, q0iParams, funcParams);
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<double> noise(0.9, 1.1);
+  for(HoleData & hole: taskData.holes)
+    for(double & q: hole.qOils)
+      q *= noise(gen);
+  RegressionModelLn3 rm(taskData);
+  Eigen::VectorXd params0 = rm.GenParams0Vec();
+  params0.tail(2) = 2.0*funcParams;
+  
+  // every result is computed with 1, 2 and 3 threads and has to be the same bit to bit
+  std::vector<Eigen::VectorXd> results;
+  const std::vector<int> nThreads{1, 2, 3};
+#ifdef _OPENMP
+  const int nMaxThreads = omp_get_max_threads();
+#endif
+  for(int n: nThreads)
+  {
+#ifdef _OPENMP
+    omp_set_num_threads(n);
+#endif
+    Eigen::VectorXd result;
+    NormalEquations ne = rm.InitNormalEquations();
+    rm.CalcNormalEquations(params0, ne);
+    Eigen::VectorXd projected = params0;
+    const double projectedObjective = rm.CalcProjectedObjective(projected);
+    result.resize(ne.qDiag.size() + ne.qCross.size() + ne.qB.size() + ne.fA.size() + ne.fB.size() + 2);
+    result<<ne.qDiag, Eigen::Map<const Eigen::VectorXd>(ne.qCross.data(), ne.qCross.size()), ne.qB, Eigen::Map<const Eigen::VectorXd>(ne.fA.data(), ne.fA.size()), ne.fB, ne.sumSqYMinusF, projectedObjective;
+    for(size_t mode = 0; mode<4; ++mode)
+    {
+      Solver::SolverParams sp;
+      sp.nMaxIter = 20;
+      sp.mixedPrecision = mode == 1;
+      sp.matrixFree = mode == 2;
+      sp.variableProjection = mode == 3;
+      Solver solver(std::make_unique<RegressionModelLn3>(rm));
+      solver.SolverInit(sp, params0);
+      solver.Solve();
+      result.conservativeResize(result.size() + params0.size());
+      result.tail(params0.size()) = solver.GetResult();
+    }
+    results.push_back(result);
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(nMaxThreads);
+#endif
+  for(size_t i = 1; i<results.size(); ++i)
+    tassert((results[i].array() == results[0].array()).all());
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testViews()
+{
+  const std::vector<size_t> sizes{60, 40, 50};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<1e-4;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  for(HoleData& hole: taskData.holes)
+    hole.qWaters = hole.qOils;
+  taskData.holes[1].qOils[3] = 0.0;
+  const auto oTD = std::make_shared<const OptimizedTaskData>(taskData);
+  const TaskDataView view(oTD);
+  
+  // narrowed views point to shared rows
+  const TaskDataView sub = view.Holes(1, 2).Window(5, 10).Window(2, 100);
+  tassert(sub.GetHolesCount() == 2 && sub.GetDataHole(0) == 1);
+  tassert(&sub.GetHole(0).sumT[0] == &oTD->holes[1].sumT[7]);
+  tassert(sub.GetHole(1).qDivT.size() == 8);
+  tassert(view.Holes({2, 0}).Window(45, 100).GetRowsCount() == 5 + 15);
+  
+  // view of first rows fits the same as stripped copy of task
+  const size_t nQ = 30;
+  TaskData stripped = taskData;
+  TaskDataHelper::StripTaskData(stripped, 0, sizes.size(), nQ);
+  for(const HoleData& hole: stripped.holes)
+    tassert(hole.ts.size() == nQ && hole.qOils.size() == nQ && hole.qWaters.size() == nQ);
+  Solver::SolverParams sp;
+  sp.matrixFree = true;
+  Solver solverCopy(std::make_unique<RegressionModelLn1>(stripped));
+  solverCopy.SolverInit(sp);
+  tassert(solverCopy.Solve());
+  Solver solverView(std::make_unique<ViewRegressionModelLn<Function1>>(view.Window(0, nQ)));
+  solverView.SolverInit(sp);
+  tassert(solverView.Solve());
+  tassert(((solverCopy.GetResult() - solverView.GetResult()).array().abs() <= 1e-10*solverCopy.GetResult().array().abs()).all());
+  tassert((solverCopy.GetYMinusF() - solverView.GetYMinusF()).lpNorm<Eigen::Infinity>() <= 1e-10);
+  
+  // warm started windows of chains give the same params as cold fits
+  RollingWindowParams rp;
+  rp.windowRows = 20;
+  rp.stepRows = 10;
+  rp.nChains = 2;
+  const RollingWindowResult rolling = FitRollingWindows<Function1>(view, rp);
+  tassert(rolling.iFirstRows.size() == 5);
+  for(size_t k = 0; k<rolling.iFirstRows.size(); ++k)
+  {
+    Solver solver(std::make_unique<ViewRegressionModelLn<Function1>>(view.Window(rolling.iFirstRows[k], rp.windowRows)));
+    solver.SolverInit(rp.sp);
+    tassert(solver.Solve());
+    const Eigen::VectorXd cold = solver.GetResult().tail(1);
+    std::cout<<"Window from "<<rolling.iFirstRows[k]<<": "<<rolling.funcParams.col(k).transpose()<<std::endl;
+    tassert(rolling.isConverged[k]);
+    tassert(std::abs(rolling.funcParams(0, k) - cold[0]) <= 1e-6*cold[0]);
+  }
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testBacktest()
+{
+  const std::vector<size_t> sizes{60, 40, 50};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<1e-4;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  taskData.holes[1].qOils[3] = 0.0;
+  const TaskDataView view(std::make_shared<const OptimizedTaskData>(taskData));
+  
+  BacktestParams bp;
+  bp.firstCutoff = 10;
+  bp.stepCutoff = 10;
+  bp.horizonRows = 10;
+  bp.nChains = 1;
+  const BacktestResult serial = Backtest<Function1>(view, bp);
+  bp.nChains = 3;
+  const BacktestResult chains = Backtest<Function1>(view, bp);
+  tassert(serial.cutoffs == std::vector<size_t>({10, 20, 30, 40, 50}));
+  // last cutoff scores the longest hole only
+  tassert(serial.nScoredRows[4] == 10 && serial.nScoredRows[0] == 30);
+  for(size_t k = 0; k<serial.cutoffs.size(); ++k)
+  {
+    std::cout<<"Cutoff "<<serial.cutoffs[k]<<" RMSE: "<<chains.rmse[k]<<std::endl;
+    tassert(serial.isConverged[k] && chains.isConverged[k]);
+    tassert(std::abs(serial.rmse[k] - chains.rmse[k]) <= 1e-6*serial.rmse[k] + 1e-12);
+    // data is generated by Function1
+    tassert(chains.rmse[k] < 1e-2);
+  }
+  tassert(chains.totalRmse < 1e-2);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testModelRegistry()
+{
+  const std::vector<ModelSpec> specs = ModelRegistry::Parse("QOil:F3,QWater:F1");
+  tassert(specs.size() == 2);
+  tassert(specs[0].name == "QOil3" && specs[0].family == "F3" && !specs[0].isWater);
+  tassert(specs[1].name == "QWater1" && specs[1].family == "F1" && specs[1].isWater);
+  for(const std::string bad: {"", "QOil", "QGas:F1", "QOil:F5", "QOil:F1,QOil:F1"})
+  {
+    bool isThrown = false;
+    try
+    {
+      ModelRegistry::Parse(bad);
+    }
+    catch(std::invalid_argument &)
+    {
+      isThrown = true;
+    }
+    tassert(isThrown);
+  }
+  // QOil2 of analyze is of Function3
+  const std::vector<ModelSpec> defaults = ModelRegistry::GetDefaultModels();
+  tassert(defaults.size() == 5 && defaults[1].name == "QOil2" && defaults[1].family == "F3");
+  // breakpoint of F4 is swept by default
+  tassert(defaults[2].family == "F4" && defaults[2].nBreakpointCandidates > 0);
+  tassert(defaults[0].nBreakpointCandidates == 0 && ModelRegistry::Parse("QOil:F4")[0].nBreakpointCandidates > 0);
+  
+  Eigen::VectorXd funcParams(size_t(Function3::nParams));
+  for(size_t i = 0; i<Function3::nParams; ++i)
+    funcParams[i] = Function3::GetDefaultParam(i);
+  const ModelFamily & family = ModelRegistry::GetFamily("F3");
+  tassert(family.nFuncParams == Function3::nParams);
+  tassert(family.calcFT(funcParams, 1000.0) == Function3::CalcFT(funcParams, 1000.0));
+  
+  // water model is fitted to water rates
+  const std::vector<size_t> sizes{20, 30};
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4;
+  TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, Eigen::VectorXd::Constant(1, 1e-4));
+  for(HoleData& hole: taskData.holes)
+    hole.qWaters.assign(hole.qOils.size(), 3.0);
+  TaskData taskDataWater = taskData;
+  TaskDataHelper::SwapOilWater(taskDataWater);
+  const std::unique_ptr<IRegressionModel> model = ModelRegistry::MakeModel(specs[1], taskData);
+  tassert(model->GetTarget() == RegressionModelLn1(taskDataWater).GetTarget());
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testGroupedFit()
+{
+  // groups A and B of different function params, holes are interleaved
+  const std::vector<size_t> sizes{60, 40, 50};
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  const TaskData taskDataA = generateTaskData<Function1>(sizes, q0iParams, Eigen::VectorXd::Constant(1, 1e-4));
+  const TaskData taskDataB = generateTaskData<Function1>(sizes, q0iParams, Eigen::VectorXd::Constant(1, 3e-4));
+  TaskData taskData;
+  for(size_t i = 0; i<sizes.size(); ++i)
+  {
+    taskData.holes.push_back(taskDataA.holes[i]);
+    taskData.holes.back().name = "A" + std::to_string(i);
+    taskData.holes.push_back(taskDataB.holes[i]);
+    taskData.holes.back().name = "B" + std::to_string(i);
+  }
+  const HoleGroups groups = HoleGroups::ByPrefix(taskData, 1);
+  tassert(groups.names == std::vector<std::string>({"A", "B"}));
+  tassert(groups.holes[1] == std::vector<size_t>({1, 3, 5}));
+  
+  const std::string mapFilename = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv")).string();
+  {
+    std::ofstream f(mapFilename);
+    for(const HoleData& hole: taskData.holes)
+      f<<hole.name<<","<<(hole.name[0] == 'A' ? "field1" : "field2")<<std::endl;
+  }
+  const HoleGroups groupsFile = HoleGroups::ByFile(taskData, mapFilename);
+  boost::filesystem::remove(mapFilename);
+  tassert(groupsFile.names == std::vector<std::string>({"field1", "field2"}));
+  tassert(groupsFile.holes == groups.holes);
+  
+  const TaskDataView view(std::make_shared<const OptimizedTaskData>(taskData));
+  const GroupedFitResult result = FitGroups<Function1>(view, groups, GroupedFitParams());
+  std::cout<<"Group params: "<<result.funcParams<<std::endl;
+  tassert(result.isConverged[0] && result.isConverged[1]);
+  tassert(std::abs(result.funcParams(0, 0) - 1e-4) <= 1e-6*1e-4);
+  tassert(std::abs(result.funcParams(0, 1) - 3e-4) <= 1e-6*3e-4);
+  // the same as fit of group alone
+  for(size_t k = 0; k<groups.holes.size(); ++k)
+  {
+    Solver solver(std::make_unique<ViewRegressionModelLn<Function1>>(view.Holes(groups.holes[k])));
+    solver.SolverInit(GroupedFitParams().sp);
+    tassert(solver.Solve());
+    for(size_t i = 0; i<groups.holes[k].size(); ++i)
+      tassert(std::abs(result.q0[groups.holes[k][i]] - solver.GetResult()[i]) <= 1e-10*solver.GetResult()[i]);
+  }
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testCompactTaskData()
+{
+  // columns of equal, integer across words, negative and fractional values
+  const std::vector<std::vector<double>> columns{
+    {5, 5, 5},
+    {0, 1023, 7, 512},
+    {-3, 4, -1},
+    {1.5, 2, -7},
+    {},
+  };
+  const std::vector<int> widths{0, 10, 3, 64, 0};
+  std::vector<uint64_t> words(1, 0);
+  std::vector<PackedColumn> packed;
+  for(const std::vector<double> & values: columns)
+    packed.push_back(PackedColumn::Pack(values, words));
+  tassert(words.size() == 1 + 0 + 1 + 1 + 3);
+  for(size_t k = 0; k<columns.size(); ++k)
+  {
+    tassert(packed[k].width == widths[k]);
+    for(size_t j = 0; j<columns[k].size(); ++j)
+      tassert(packed[k].Get(words.data(), j) == columns[k][j]);
+  }
+  
+  // integer monthly series of CSV with gap of months in the second hole
+  std::mt19937 gen(123);
+  std::uniform_int_distribution<int> hours(600, 744);
+  std::uniform_int_distribution<int> tons(0, 5000);
+  TaskData taskData;
+  std::vector<std::vector<int64_t>> months;
+  const std::vector<size_t> sizes{100, 37, 250};
+  for(size_t i = 0; i<sizes.size(); ++i)
+  {
+    HoleData hole;
+    hole.name = "hole" + std::to_string(i);
+    months.emplace_back();
+    for(size_t j = 0; j<sizes[i]; ++j)
+    {
+      hole.ts.push_back(hours(gen));
+      hole.qOils.push_back(tons(gen));
+      hole.qWaters.push_back(tons(gen)/3);
+      months.back().push_back(31000 + 30*j + (i == 1 && j > 20 ? 90 : 0));
+    }
+    taskData.holes.push_back(hole);
+  }
+  CompactTaskData compact;
+  for(size_t i = 0; i<sizes.size(); ++i)
+    compact.AddHole(taskData.holes[i], months[i]);
+  
+  const std::string compactFilename = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.compact")).string();
+  compact.Write(compactFilename);
+  const CompactTaskData read = CompactTaskData::Read(compactFilename);
+  // broken counts and truncated files are rejected before allocation
+  const uint64_t fileSize = boost::filesystem::file_size(compactFilename);
+  for(size_t iCase = 0; iCase<2; ++iCase)
+  {
+    compact.Write(compactFilename);
+    if(iCase == 0)
+    {
+      std::fstream f(compactFilename, std::ios::in | std::ios::out | std::ios::binary);
+      const uint64_t nHoles = uint64_t(1)<<60;
+      f.seekp(8);
+      f.write(reinterpret_cast<const char*>(&nHoles), sizeof(nHoles));
+    }
+    else
+      boost::filesystem::resize_file(compactFilename, fileSize/2);
+    bool isThrown = false;
+    try
+    {
+      CompactTaskData::Read(compactFilename);
+    }
+    catch(std::invalid_argument&)
+    {
+      isThrown = true;
+    }
+    tassert(isThrown);
+  }
+  boost::filesystem::remove(compactFilename);
+  
+  size_t nRows = 0;
+  for(const CompactTaskData * data: std::vector<const CompactTaskData*>{&compact, &read})
+  {
+    tassert(data->GetHolesCount() == sizes.size());
+    const TaskData decoded = data->ToTaskData();
+    const OptimizedTaskData oil = data->ToOptimized(false);
+    const OptimizedTaskData water = data->ToOptimized(true);
+    TaskData taskDataWater = taskData;
+    TaskDataHelper::SwapOilWater(taskDataWater);
+    const OptimizedTaskData oilExpected(taskData);
+    const OptimizedTaskData waterExpected(taskDataWater);
+    nRows = 0;
+    for(size_t i = 0; i<sizes.size(); ++i)
+    {
+      const HoleData & hole = decoded.holes[i];
+      tassert(hole.name == taskData.holes[i].name);
+      tassert(hole.ts == taskData.holes[i].ts && hole.qOils == taskData.holes[i].qOils && hole.qWaters == taskData.holes[i].qWaters);
+      tassert(data->GetMonths(i) == months[i]);
+      tassert(oil.holes[i].sumT == oilExpected.holes[i].sumT && oil.holes[i].qDivT == oilExpected.holes[i].qDivT);
+      tassert(water.holes[i].qDivT == waterExpected.holes[i].qDivT);
+      nRows += sizes[i];
+    }
+  }
+  // hours, oil and water of task data are 24 bytes per row
+  std::cout<<"Compact task data: "<<compact.GetBytes()<<" bytes of "<<nRows*24<<std::endl;
+  tassert(compact.GetBytes()*3 < nRows*24);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testNoAllocations()
+{
+  const std::vector<size_t> sizes{300, 200, 250};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<0.001;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  const TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  
+  auto workspace = std::make_shared<SolverWorkspace>();
+  // matrix-free, default dense and mixed precision modes
+  for(size_t iMode = 0; iMode<3; ++iMode)
+  {
+    Solver::SolverParams sp;
+    sp.matrixFree = iMode == 0;
+    sp.mixedPrecision = iMode == 2;
+    for(size_t iModel = 0; iModel<2; ++iModel)
+    {
+      Solver solver(std::make_unique<RegressionModelLn1>(taskData), workspace);
+      solver.SolverInit(sp);
+      // first iteration may allocate thread pool of OpenMP
+      solver.iterate(0);
+      const size_t nAllocations = MemoryTracker::GetAllocationCount();
+      for(size_t nIter = 1; nIter<10; ++nIter)
+        solver.iterate(nIter);
+      const size_t nSteadyAllocations = MemoryTracker::GetAllocationCount() - nAllocations;
+      std::cout<<"Allocations in steady state iterations of mode "<<iMode<<": "<<nSteadyAllocations<<std::endl;
+      tassert(nSteadyAllocations == 0);
+    }
+  }
+  tassert(MemoryTracker::GetAllocationCount() > 0);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testMemoryAccounting()
+{
+  MemoryTracker::Enable();
+  const size_t n = 1<<20;
+  const size_t bytesBefore = MemoryTracker::GetCurrentBytes(MemoryTracker::workingSet);
+  std::unique_ptr<Eigen::VectorXd> v;
+  {
+    MemoryTracker::Scope scope(MemoryTracker::workingSet);
+    v = std::make_unique<Eigen::VectorXd>(n);
+    // nested scope
+    MemoryTracker::Scope scopeResults(MemoryTracker::results);
+    Eigen::VectorXd r(n);
+    tassert(MemoryTracker::GetCurrentBytes(MemoryTracker::results) >= n*sizeof(double));
+  }
+  const size_t bytes = MemoryTracker::GetCurrentBytes(MemoryTracker::workingSet) - bytesBefore;
+  tassert(bytes >= n*sizeof(double) && bytes < n*sizeof(double) + 4096);
+  MemoryTracker::ResetPeaks();
+  // freed outside of scope, bytes return to category of the block
+  v.reset();
+  tassert(MemoryTracker::GetCurrentBytes(MemoryTracker::workingSet) == bytesBefore);
+  tassert(MemoryTracker::GetPeakBytes(MemoryTracker::workingSet) == bytesBefore + bytes);
+  
+  // fit accounts jacobi matrix to working set and normal equations separately
+  const std::vector<size_t> sizes{300, 200};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<0.001;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4;
+  Solver solver(std::make_unique<RegressionModelLn1>(generateTaskData<Function1>(sizes, q0iParams, funcParams)));
+  MemoryTracker::ResetPeaks();
+  solver.SolverInit();
+  tassert(solver.Solve());
+  const size_t jBytes = 500*3*sizeof(double);
+  tassert(MemoryTracker::GetPeakBytes(MemoryTracker::workingSet) >= bytesBefore + jBytes);
+  tassert(MemoryTracker::GetPeakBytes(MemoryTracker::normalEquations) >= 3*3*sizeof(double));
+  MemoryTracker::Report(std::cout, "testMemoryAccounting");
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testPerfCounters()
+{
+  const std::vector<size_t> sizes{300, 200};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<0.001;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4;
+  const TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  const bool isEnabled = PerfCounters::Enable();
+  std::cout<<"Hardware counters: "<<(isEnabled ? "enabled" : "unavailable")<<" "<<PerfCounters::GetError()<<std::endl;
+  tassert(PerfCounters::IsEnabled() == isEnabled);
+  tassert(isEnabled || !PerfCounters::GetError().empty());
+  const PerfCounters::Snapshot before = PerfCounters::GetSnapshot();
+  Solver solver(std::make_unique<RegressionModelLn1>(taskData));
+  solver.SolverInit();
+  tassert(solver.Solve());
+  const PerfCounters::Snapshot after = PerfCounters::GetSnapshot();
+  std::ostringstream report;
+  PerfCounters::Report(report, "testPerfCounters", before);
+  std::cout<<report.str();
+  if(!isEnabled)
+  {
+    // solve works as before and nothing is counted or reported
+    tassert(report.str().empty());
+    tassert(std::equal(&after.counts[0][0], &after.counts[0][0] + PerfCounters::nPhases*PerfCounters::nEvents, &before.counts[0][0]));
+  }
+  else if(PerfCounters::IsCounted(PerfCounters::instructions))
+  {
+    for(size_t iPhase = 0; iPhase<PerfCounters::nPhases; ++iPhase)
+      tassert(after.counts[iPhase][PerfCounters::instructions] > before.counts[iPhase][PerfCounters::instructions]);
+  }
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testOutOfCore()
+{
+  const std::vector<size_t> sizes{300, 200, 250, 120};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<0.001;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3, 5;
+  TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  for(size_t i = 0; i<taskData.holes.size(); ++i)
+    taskData.holes[i].name = "hole" + std::to_string(i);
+  taskData.holes[2].qOils[7] = 0.0;
+  
+  // csv rows are ordered by month, so rows of every hole are scattered
+  const boost::filesystem::path tmpDir = boost::filesystem::temp_directory_path();
+  const std::string csvFilename = (tmpDir / boost::filesystem::unique_path("%%%%-%%%%.csv")).string();
+  const std::string holeFilename = (tmpDir / boost::filesystem::unique_path("%%%%-%%%%.holes")).string();
+  {
+    std::ofstream csv(csvFilename);
+    csv.precision(17);
+    for(size_t j = 0; j<sizes[0]; ++j)
+      for(const HoleData& hole: taskData.holes)
+        if(j<hole.ts.size())
+          csv<<j<<","<<hole.name<<","<<hole.ts[j]<<","<<hole.qOils[j]<<",0"<<std::endl;
+  }
+  HoleFile::ConvertCSV(csvFilename, holeFilename);
+  auto holeFile = std::make_shared<const HoleFile>(holeFilename);
+  tassert(holeFile->GetRowsCount() == TaskDataHelper::GetTaskSize(taskData));
+  tassert(holeFile->GetHoles().size() == taskData.holes.size());
+  
+  Solver::SolverParams sp;
+  sp.matrixFree = true;
+  Solver solverMem(std::make_unique<RegressionModelLn1>(taskData));
+  solverMem.SolverInit(sp);
+  solverMem.Solve();
+  // chunks of about 256 rows: holes are streamed by three chunks
+  Solver solverOOC(std::make_unique<OutOfCoreRegressionModelLn<Function1>>(holeFile, false, 256));
+  solverOOC.SolverInit(sp);
+  solverOOC.Solve();
+  const Eigen::VectorXd resMem = solverMem.GetResult();
+  const Eigen::VectorXd resOOC = solverOOC.GetResult();
+  std::cout<<"In memory:   "<<resMem.transpose()<<std::endl;
+  std::cout<<"Out-of-core: "<<resOOC.transpose()<<std::endl;
+  tassert(((resMem - resOOC).array().abs() <= 1e-9*resMem.array().abs()).all());
+  tassert((solverMem.GetYMinusF() - solverOOC.GetYMinusF()).lpNorm<Eigen::Infinity>() <= 1e-9);
+  
+  HoleFile::Write(taskData, holeFilename);
+  Solver solverW(std::make_unique<OutOfCoreRegressionModelLn<Function1>>(std::make_shared<const HoleFile>(holeFilename), false, 1));
+  sp.keepYMinusF = false;
+  solverW.SolverInit(sp);
+  solverW.Solve();
+  tassert(((resMem - solverW.GetResult()).array().abs() <= 1e-9*resMem.array().abs()).all());
+  tassert(solverW.GetYMinusF().size() == 0);
+  
+  // buffers of 5 rows per hole are flushed many times
+  HoleFile::ConvertCSV(csvFilename, holeFilename, 5*4*3*sizeof(double));
+  const TaskData read = HoleFile(holeFilename).ReadHoles(0, taskData.holes.size());
+  for(size_t i = 0; i<taskData.holes.size(); ++i)
+    tassert(read.holes[i].name == taskData.holes[i].name && read.holes[i].ts == taskData.holes[i].ts && read.holes[i].qOils == taskData.holes[i].qOils);
+  
+  // truncated file and corrupt header are rejected
+  const uint64_t fileSize = boost::filesystem::file_size(holeFilename);
+  auto isBroken = [&holeFilename]()
+  {
+    try
+    {
+      HoleFile holeFileBroken(holeFilename);
+    }
+    catch(std::invalid_argument & e)
+    {
+      std::cout<<e.what()<<std::endl;
+      return true;
+    }
+    return false;
+  };
+  boost::filesystem::resize_file(holeFilename, fileSize - 1);
+  tassert(isBroken());
+  HoleFile::Write(taskData, holeFilename);
+  {
+    std::fstream f(holeFilename, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(8);
+    const uint64_t nHoles = uint64_t(1) << 60;
+    f.write(reinterpret_cast<const char*>(&nHoles), sizeof(nHoles));
+  }
+  tassert(isBroken());
+  
+  boost::filesystem::remove(csvFilename);
+  boost::filesystem::remove(holeFilename);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testShardedSolver()
+{
+  const std::vector<size_t> sizes{300, 200, 250, 120, 180};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<0.001;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3, 5, 1;
+  TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  taskData.holes[3].qOils[5] = 0.0;
+  Eigen::VectorXd funcParamsWater(2);
+  funcParamsWater<<1e-5, 2.0;
+  const TaskData taskDataWater = generateTaskData<Function3>(sizes, q0iParams, funcParamsWater);
+  for(size_t i = 0; i<sizes.size(); ++i)
+    taskData.holes[i].qWaters = taskDataWater.holes[i].qOils;
+  const std::string holeFilename = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.holes")).string();
+  HoleFile::Write(taskData, holeFilename);
+  
+  Solver::SolverParams sp;
+  sp.matrixFree = true;
+  Solver solver(std::make_unique<RegressionModelLn1>(taskData));
+  solver.SolverInit(sp);
+  solver.Solve();
+  const Eigen::VectorXd res = solver.GetResult();
+  std::cout<<"One process: "<<res.transpose()<<std::endl;
+  for(size_t nShards: {1, 3})
+  {
+    ShardedSolver shardedSolver(holeFilename, ModelRegistry::Parse("QOil:F1")[0], nShards);
+    shardedSolver.SolverInit(sp);
+    tassert(shardedSolver.Solve());
+    const Eigen::VectorXd resSharded = shardedSolver.GetResult();
+    std::cout<<nShards<<" shards:    "<<resSharded.transpose()<<std::endl;
+    tassert(resSharded.size() == res.size());
+    tassert(((res - resSharded).array().abs() <= 1e-9*res.array().abs()).all());
+  }
+  
+  // family and target of spec are fitted by workers
+  const ModelSpec spec = ModelRegistry::Parse("QWater:F3")[0];
+  Solver solverWater(ModelRegistry::MakeModel(spec, taskData));
+  solverWater.SolverInit(sp);
+  solverWater.Solve();
+  const Eigen::VectorXd resWater = solverWater.GetResult();
+  ShardedSolver shardedWater(holeFilename, spec, 2);
+  shardedWater.SolverInit(sp);
+  tassert(shardedWater.Solve());
+  const Eigen::VectorXd resWaterSharded = shardedWater.GetResult();
+  std::cout<<spec.name<<" 2 shards: "<<resWaterSharded.transpose()<<std::endl;
+  tassert(resWaterSharded.size() == resWater.size());
+  tassert(((resWater - resWaterSharded).array().abs() <= 1e-8*resWater.array().abs()).all());
+  boost::filesystem::remove(holeFilename);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testFitServer()
+{
+  const std::vector<size_t> sizes{300, 200, 250};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<0.001;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  const boost::filesystem::path tmpDir = boost::filesystem::temp_directory_path();
+  const std::string csvFilename = (tmpDir / boost::filesystem::unique_path("%%%%-%%%%.csv")).string();
+  const std::string socketPath = (tmpDir / boost::filesystem::unique_path("%%%%-%%%%.sock")).string();
+  {
+    std::ofstream csv(csvFilename);
+    csv.precision(17);
+    for(size_t i = 0; i<taskData.holes.size(); ++i)
+    {
+      taskData.holes[i].name = "hole" + std::to_string(i);
+      for(size_t j = 0; j<taskData.holes[i].ts.size(); ++j)
+        csv<<j<<","<<taskData.holes[i].name<<","<<taskData.holes[i].ts[j]<<","<<taskData.holes[i].qOils[j]<<",1"<<std::endl;
+    }
+  }
+  Solver::SolverParams sp;
+  sp.matrixFree = true;
+  Solver solver(std::make_unique<RegressionModelLn1>(taskData));
+  solver.SolverInit(sp);
+  solver.Solve();
+  const Eigen::VectorXd res = solver.GetResult();
+  
+  auto query = [&socketPath](const std::string& request)
+  {
+    boost::property_tree::ptree pt;
+    std::istringstream ss(FitServer::Query(socketPath, request));
+    boost::property_tree::read_json(ss, pt);
+    return pt;
+  };
+  auto toVector = [](const boost::property_tree::ptree& pt)
+  {
+    std::vector<double> vals;
+    for(const auto& val: pt)
+      vals.push_back(val.second.get_value<double>());
+    return vals;
+  };
+  
+  // raw connection of client which may send anything
+  auto connectRaw = [this, &socketPath]()
+  {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, socketPath.c_str());
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    tassert(fd >= 0 && connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0);
+    return fd;
+  };
+  
+  FitServer server(socketPath);
+  server.maxRequestLength = 1000;
+  std::thread serverThread([&server](){server.Run();});
+  // idle client is left open until shutdown
+  int idleFd = -1;
+  try
+  {
+    idleFd = connectRaw();
+    // other clients are served while idle one waits
+    tassert(query("{\"command\": \"list\"}").get<std::string>("status") == "ok");
+    
+    const int longFd = connectRaw();
+    const std::string longLine = "{\"command\": \"" + std::string(5000, 'x') + "\"}\n";
+    tassert(send(longFd, longLine.data(), longLine.size(), MSG_NOSIGNAL) == ssize_t(longLine.size()));
+    std::string reply;
+    char c;
+    while(recv(longFd, &c, 1, 0) == 1 && c != '\n')
+      reply += c;
+    close(longFd);
+    std::cout<<reply<<std::endl;
+    tassert(reply.find("\"status\":\"error\"") != std::string::npos && reply.find("exceeds") != std::string::npos);
+    
+    tassert(query("{\"command\": \"load\", \"dataset\": \"d\", \"path\": \"" + csvFilename + "\"}").get<size_t>("rows") == 750);
+    tassert(query("{\"command\": \"fit\", \"dataset\": \"unknown\"}").get<std::string>("status") == "error");
+    
+    auto start = std::chrono::steady_clock::now();
+    const boost::property_tree::ptree fit = query("{\"command\": \"fit\", \"dataset\": \"d\", \"target\": \"oil\", \"function\": 1}");
+    const double fitTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    const boost::property_tree::ptree cached = query("{\"command\": \"fit\", \"dataset\": \"d\"}");
+    const double cachedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout<<"Fit: "<<fitTime<<" s, cached fit: "<<cachedTime<<" s"<<std::endl;
+    const std::vector<double> q0 = toVector(fit.get_child("q0"));
+    const std::vector<double> fitFuncParams = toVector(fit.get_child("funcParams"));
+    tassert(q0.size() == 3 && fitFuncParams.size() == 1);
+    for(size_t i = 0; i<q0.size(); ++i)
+      tassert(std::abs(q0[i] - res[i]) <= 1e-9*res[i]);
+    tassert(std::abs(fitFuncParams[0] - res[3]) <= 1e-9*res[3]);
+    tassert(toVector(cached.get_child("q0")) == q0);
+    
+    const boost::property_tree::ptree refit = query("{\"command\": \"refit\", \"dataset\": \"d\"}");
+    tassert(refit.get<bool>("converged"));
+    tassert(std::abs(toVector(refit.get_child("funcParams"))[0] - res[3]) <= 1e-9*res[3]);
+    
+    const std::vector<double> forecast = toVector(query("{\"command\": \"forecast\", \"dataset\": \"d\", \"hole\": \"hole1\", \"hours\": [500, 250]}").get_child("values"));
+    const Eigen::VectorXd fitFuncParamsVec = Eigen::Map<const Eigen::VectorXd>(fitFuncParams.data(), 1);
+    const double tEnd = 200*500.0;
+    tassert(forecast.size() == 2);
+    tassert(std::abs(forecast[0] - q0[1]*Function1::CalcFT(fitFuncParamsVec, tEnd + 250)*500) <= 1e-9*forecast[0]);
+    tassert(std::abs(forecast[1] - q0[1]*Function1::CalcFT(fitFuncParamsVec, tEnd + 625)*250) <= 1e-9*forecast[1]);
+    
+    tassert(query("{\"command\": \"fit\", \"dataset\": \"d\", \"target\": \"water\"}").get<std::string>("status") == "ok");
+    tassert(query("{\"command\": \"list\"}").get_child("datasets").front().second.get_child("fits").size() == 2);
+    query("{\"command\": \"shutdown\"}");
+  }
+  catch(...)
+  {
+    FitServer::Query(socketPath, "{\"command\": \"shutdown\"}");
+    serverThread.join();
+    close(idleFd);
+    throw;
+  }
+  serverThread.join();
+  close(idleFd);
+  boost::filesystem::remove(csvFilename);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testBootstrap()
+{
+  const std::vector<size_t> sizes{300, 200, 250};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<0.001;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  std::mt19937 gen(7);
+  std::normal_distribution<double> noise(0.0, 0.05);
+  for(HoleData& hole: taskData.holes)
+    for(double& q: hole.qOils)
+      q *= exp(noise(gen));
+  taskData.holes[1].qOils[4] = 0.0;
+  
+  Solver::SolverParams sp;
+  sp.matrixFree = true;
+  Solver solver(std::make_unique<RegressionModelLn1>(taskData));
+  solver.SolverInit(sp);
+  tassert(solver.Solve());
+  const Eigen::VectorXd res = solver.GetResult();
+  
+  Bootstrap::BootstrapParams bp;
+  bp.nReplicates = 100;
+  const auto start = std::chrono::steady_clock::now();
+  const Bootstrap::BootstrapResult bootstrap = Bootstrap::Run(solver, bp);
+  const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  std::cout<<"Bootstrap of "<<bp.nReplicates<<" replicates: "<<time.count()<<" s"<<std::endl;
+  std::cout<<"Lower: "<<bootstrap.lower.transpose()<<std::endl;
+  std::cout<<"Fit:   "<<res.transpose()<<std::endl;
+  std::cout<<"Upper: "<<bootstrap.upper.transpose()<<std::endl;
+  tassert(size_t(bootstrap.replicates.cols()) == bp.nReplicates);
+  tassert((bootstrap.lower.array() < res.array()).all() && (res.array() < bootstrap.upper.array()).all());
+  // 5% noise of hundreds of rows gives intervals well below 5% of params
+  tassert(((bootstrap.upper - bootstrap.lower).array() < 0.05*res.array()).all());
+  // original model is not changed, replicates do not depend on threads
+  tassert(solver.GetModel().GetTarget().cwiseEqual(RegressionModelLn1(taskData).GetTarget()).count() == 749);
+  tassert(Bootstrap::Run(solver, bp).replicates == bootstrap.replicates);
+  // error of replicate solve is rethrown by caller thread
+  bp.sp.checkpointInterval = 1;
+  bp.sp.checkpointFile = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%") / "checkpoint.bin").string();
+  bool isThrown = false;
+  try
+  {
+    Bootstrap::Run(solver, bp);
+  }
+  catch(const std::exception&)
+  {
+    isThrown = true;
+  }
+  tassert(isThrown);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testMixture()
+{
+  // mixtures like the ones of real world residuals
+  const size_t n = 68000;
+  std::mt19937 gen(11);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::normal_distribution<double> normal(0.0, 1.0);
+  Eigen::VectorXd xGauss(n);
+  Eigen::VectorXd xLogistic(n);
+  for(size_t i = 0; i<n; ++i)
+  {
+    const bool isWide = uniform(gen) < 0.25;
+    xGauss[i] = isWide ? -0.9 + 2.0*normal(gen) : 0.2 + 0.7*normal(gen);
+    const double u = uniform(gen);
+    xLogistic[i] = (isWide ? -0.9 : 0.2) + (isWide ? 1.0 : 0.4)*log(u/(1-u));
+  }
+  
+  const MixtureFitter fitter;
+  const auto start = std::chrono::steady_clock::now();
+  const Mixture gauss = fitter.Fit(xGauss, 2, Mixture::Gaussian);
+  const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  std::cout<<"EM of "<<n<<" points: "<<time.count()<<" s"<<std::endl;
+  gauss.Write(std::cout);
+  // component order follows start quantiles: wide one has lower mean
+  tassert(std::abs(gauss.weights[0] - 0.25) < 0.03);
+  tassert(std::abs(gauss.means[0] + 0.9) < 0.1 && std::abs(gauss.means[1] - 0.2) < 0.03);
+  tassert(std::abs(gauss.scales[0] - 2.0) < 0.1 && std::abs(gauss.scales[1] - 0.7) < 0.03);
+  // log likelihood is of reported params
+  double logLikelihood = 0.0;
+  for(size_t i = 0; i<n; ++i)
+  {
+    double p = 0.0;
+    for(size_t k = 0; k<2; ++k)
+      p += gauss.weights[k]/(gauss.scales[k]*std::sqrt(2*M_PI))*exp(-0.5*std::pow((xGauss[i] - gauss.means[k])/gauss.scales[k], 2));
+    logLikelihood += log(p);
+  }
+  tassert(std::abs(gauss.logLikelihood - logLikelihood) <= 1e-9*std::abs(logLikelihood));
+  // variance of far from zero sample has no cancellation
+  const double offset = 1e8;
+  const Mixture gaussOffset = fitter.Fit(xGauss.array() + offset, 2, Mixture::Gaussian);
+  tassert(std::abs(gaussOffset.means[1] - offset - gauss.means[1]) < 1e-3);
+  tassert(((gaussOffset.scales - gauss.scales).array().abs() < 1e-3).all());
+  
+  const Mixture logistic = fitter.Fit(xLogistic, 2, Mixture::Logistic);
+  logistic.Write(std::cout);
+  tassert(std::abs(logistic.weights[0] - 0.25) < 0.05);
+  tassert(std::abs(logistic.means[0] + 0.9) < 0.2 && std::abs(logistic.means[1] - 0.2) < 0.05);
+  tassert(std::abs(logistic.scales[0] - 1.0) < 0.15 && std::abs(logistic.scales[1] - 0.4) < 0.05);
+  // logistic sample is fitted better by logistic mixture
+  tassert(logistic.logLikelihood > fitter.Fit(xLogistic, 2, Mixture::Gaussian).logLikelihood);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testImportPipeline()
+{
+  const std::vector<size_t> sizes{30, 20, 25};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<0.001;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  taskData.holes[1].qOils[3] = 0.0;
+  const std::string csvFilename = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv")).string();
+  {
+    std::ofstream csv(csvFilename);
+    csv.precision(17);
+    for(size_t j = 0; j<sizes[0]; ++j)
+      for(size_t i = 0; i<taskData.holes.size(); ++i)
+        if(j<taskData.holes[i].ts.size())
+          csv<<j<<",hole"<<i<<","<<taskData.holes[i].ts[j]+j<<","<<taskData.holes[i].qOils[j]<<","<<j*i<<std::endl;
+  }
+  CSVDataImporter dataImporter;
+  const TaskData taskDataRead = dataImporter.read(csvFilename);
+  TaskData taskDataWater = taskDataRead;
+  TaskDataHelper::SwapOilWater(taskDataWater);
+  const OptimizedTaskData oil(taskDataRead);
+  const OptimizedTaskData water(taskDataWater);
+  
+  // small batches and queue make stages wait for each other
+  ImportPipeline pipeline;
+  pipeline.batchLines = 7;
+  pipeline.queueBatches = 2;
+  const ImportedData data = pipeline.Import(csvFilename);
+  tassert(data.taskData.holes.size() == taskDataRead.holes.size());
+  for(size_t i = 0; i<taskDataRead.holes.size(); ++i)
+  {
+    tassert(data.taskData.holes[i].name == taskDataRead.holes[i].name);
+    tassert(data.taskData.holes[i].ts == taskDataRead.holes[i].ts);
+    tassert(data.taskData.holes[i].qOils == taskDataRead.holes[i].qOils);
+    tassert(data.taskData.holes[i].qWaters == taskDataRead.holes[i].qWaters);
+    tassert(data.oil.holes[i].sumT == oil.holes[i].sumT && data.oil.holes[i].qDivT == oil.holes[i].qDivT);
+    tassert(data.water.holes[i].sumT == water.holes[i].sumT && data.water.holes[i].qDivT == water.holes[i].qDivT);
+  }
+  
+  RegressionModelLn1 rm(taskDataRead);
+  RegressionModelLn1 rmPipeline(data.taskData, data.oil);
+  const Eigen::VectorXd params = rm.GenParams0Vec();
+  tassert(params == rmPipeline.GenParams0Vec());
+  NormalEquations ne = rm.InitNormalEquations();
+  NormalEquations nePipeline = rmPipeline.InitNormalEquations();
+  rm.CalcNormalEquations(params, ne);
+  rmPipeline.CalcNormalEquations(params, nePipeline);
+  tassert(ne.fA == nePipeline.fA && ne.qCross == nePipeline.qCross);
+  boost::filesystem::remove(csvFilename);
+  
+  // error of model setup isn't lost as missing results
+  bool isSetupThrown = false;
+  try
+  {
+    Analyzer().Calc(data, {{"QOilUnknown", "Function9", false}});
+  }
+  catch(std::invalid_argument & e)
+  {
+    std::cout<<e.what()<<std::endl;
+    isSetupThrown = true;
+  }
+  tassert(isSetupThrown);
+  
+  bool isThrown = false;
+  try
+  {
+    pipeline.Import(csvFilename);
+  }
+  catch(std::invalid_argument&)
+  {
+    isThrown = true;
+  }
+  tassert(isThrown);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testMultiFileImport()
+{
+  const std::vector<size_t> sizes{30, 20, 25};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<0.001;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  const TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  // field A has holes 0 and 2, field B hole 1, every field is exported
+  // by even and odd months
+  const boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%");
+  boost::filesystem::create_directory(dir);
+  for(const std::string field: {"A", "B"})
+    for(size_t parity = 0; parity<2; ++parity)
+    {
+      std::ofstream csv((dir / (field + (parity == 0 ? "_even.csv" : "_odd.csv"))).string());
+      csv.precision(17);
+      for(size_t j = parity; j<sizes[0]; j += 2)
+        for(size_t i = 0; i<taskData.holes.size(); ++i)
+          if((i%2 == 1) == (field == "B") && j<taskData.holes[i].ts.size())
+            csv<<j<<",hole"<<i<<","<<taskData.holes[i].ts[j]<<","<<taskData.holes[i].qOils[j]<<","<<j*i<<std::endl;
+    }
+  std::ofstream((dir / "readme.txt").string())<<"not a csv file"<<std::endl;
+  
+  const std::vector<std::string> files = CSVDataImporter::ListFiles(dir.string());
+  tassert(files.size() == 4 && boost::filesystem::path(files[0]).filename() == "A_even.csv");
+  const std::vector<size_t> holeOrder{0, 2, 1};
+  for(size_t nThreads = 1; nThreads<=4; nThreads += 3)
+  {
+    const TaskData read = CSVDataImporter::ReadFiles(files, nThreads);
+    tassert(read.holes.size() == holeOrder.size());
+    for(size_t k = 0; k<holeOrder.size(); ++k)
+    {
+      const HoleData & hole = taskData.holes[holeOrder[k]];
+      tassert(read.holes[k].name == "hole" + std::to_string(holeOrder[k]));
+      tassert(read.holes[k].ts == hole.ts && read.holes[k].qOils == hole.qOils);
+      for(size_t j = 0; j<hole.ts.size(); ++j)
+        tassert(read.holes[k].qWaters[j] == double(j*holeOrder[k]));
+    }
+  }
+  const TaskData field = CSVDataImporter().read((dir / "B_*.csv").string());
+  tassert(field.holes.size() == 1 && field.holes[0].name == "hole1" && field.holes[0].ts == taskData.holes[1].ts);
+  tassert(CSVDataImporter().read(dir.string()).holes.size() == holeOrder.size());
+  // analyze imports by pipeline
+  for(const std::string & path: {dir.string(), (dir / "*.csv").string()})
+  {
+    const ImportedData data = ImportPipeline().Import(path);
+    const TaskData read = CSVDataImporter::ReadFiles(files);
+    tassert(data.taskData.holes.size() == holeOrder.size());
+    for(size_t k = 0; k<holeOrder.size(); ++k)
+    {
+      const HoleData & hole = read.holes[k];
+      tassert(data.taskData.holes[k].name == hole.name && data.taskData.holes[k].ts == hole.ts);
+      tassert(data.taskData.holes[k].qWaters == hole.qWaters);
+      const OptimizedHoleData oil(hole.ts, hole.qOils);
+      const OptimizedHoleData water(hole.ts, hole.qWaters);
+      tassert(data.oil.holes[k].sumT == oil.sumT && data.oil.holes[k].qDivT == oil.qDivT);
+      tassert(data.water.holes[k].qDivT == water.qDivT);
+    }
+  }
+  
+  // the same month of hole in two files
+  boost::filesystem::copy_file(dir / "B_odd.csv", dir / "B_odd_copy.csv");
+  for(const std::string & path: {dir.string(), (dir / "C_*.csv").string()})
+  {
+    bool isThrown = false;
+    try
+    {
+      CSVDataImporter().read(path);
+    }
+    catch(std::invalid_argument & e)
+    {
+      std::cout<<e.what()<<std::endl;
+      isThrown = true;
+    }
+    tassert(isThrown);
+  }
+  boost::filesystem::remove_all(dir);
+  std::cout<<"test passed"<<std::endl;
+}
+
+void Tester::testCheckpoint()
+{
+  const std::vector<size_t> sizes{300, 200, 250};
+  Eigen::VectorXd funcParams(1);
+  funcParams<<0.001;
+  Eigen::VectorXd q0iParams(sizes.size());
+  q0iParams<<2, 4, 3;
+  const TaskData taskData = generateTaskData<Function1>(sizes, q0iParams, funcParams);
+  const std::string checkpointFile = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.checkpoint")).string();
+  
+  Solver::SolverParams sp;
+  sp.matrixFree = true;
+  Solver solver(std::make_unique<RegressionModelLn1>(taskData));
+  solver.SolverInit(sp);
+  tassert(solver.Solve());
+  const Eigen::VectorXd res = solver.GetResult();
+  const size_t nIter = solver._nIter;
+  std::cout<<"Iterations: "<<nIter<<std::endl;
+  tassert(nIter > 2);
+  
+  // fit is interrupted after 2 iterations
+  sp.checkpointFile = checkpointFile;
+  sp.checkpointInterval = 1;
+  sp.nMaxIter = 2;
+  Solver solverInterrupted(std::make_unique<RegressionModelLn1>(taskData));
+  solverInterrupted.SolverInit(sp);
+  tassert(!solverInterrupted.Solve());
+  tassert(boost::filesystem::exists(checkpointFile));
+  
+  sp.nMaxIter = 1000;
+  Solver solverResumed(std::make_unique<RegressionModelLn1>(taskData));
+  tassert(solverResumed.SolverResume(sp));
+  tassert(solverResumed._nIter == 2);
+  tassert(solverResumed.Solve());
+  tassert(solverResumed._nIter == nIter);
+  tassert(((solverResumed.GetResult() - res).array().abs() <= 1e-12*res.array().abs()).all());
+  tassert(!boost::filesystem::exists(checkpointFile));
+  tassert(!solverResumed.SolverResume(sp));
+  
+  // checkpoint of other task is rejected
+  sp.nMaxIter = 1;
+  solverInterrupted.SolverInit(sp);
+  solverInterrupted.Solve();
+  TaskData taskDataOther = taskData;
+  taskDataOther.holes.pop_back();
+  Solver solverOther(std::make_unique<RegressionModelLn1>(taskDataOther));
+  bool isThrown = false;
+  try
+  {
+    solverOther.SolverResume(sp);
+  }
+  catch(std::invalid_argument&)
+  {
+    isThrown = true;
+  }
+  tassert(isThrown);
+  boost::filesystem::remove(checkpointFile);
+  
+  // saved result of analyze model is loaded by resume of the same task only
+  const std::string name = boost::filesystem::unique_path("QOil%%%%%%%%").string();
+  ImportedData data;
+  data.taskData = taskData;
+  data.oil = OptimizedTaskData(taskData);
+  const std::vector<AnalyzeSet> fitted = Analyzer().Calc(data, {{name, "F1", false}});
+  tassert(fitted.size() == 1 && boost::filesystem::exists(name + "_result.bin"));
+  const std::vector<AnalyzeSet> loaded = Analyzer().Calc(data, {{name, "F1", false}}, true);
+  tassert(loaded.size() == 1 && loaded[0].params == fitted[0].params);
+  data.taskData = taskDataOther;
+  data.oil = OptimizedTaskData(taskDataOther);
+  isThrown = false;
+  try
+  {
+    Analyzer().Calc(data, {{name, "F1", false}}, true);
+  }
+  catch(std::invalid_argument & e)
+  {
+    std::cout<<e.what()<<std::endl;
+    isThrown = true;
+  }
+  tassert(isThrown);
+  boost::filesystem::remove(name + "_result.bin");
+  std::cout<<"test passed"<<std::endl;
+}
+
 void Tester::testRealWorld()
 {
+  std::cout<<"testRealWorld"<<std::endl;
+  if(_dataFilename.empty() || !boost::filesystem::exists(_dataFilename))
+  {
+    std::cout<<"test skipped: no data file"<<std::endl;
+    return;
+  }
   CSVDataImporter dataImporter;
-  Solver solver(std::make_unique<RegressionModelLn1>(dataImporter.read("/mnt/windows/Users/user/Documents/projects/GPTestTask/taskData.csv")));
+  Solver solver(std::make_unique<RegressionModelLn1>(dataImporter.read(_dataFilename)));
   solver.SolverInit();
   if(!solver.Solve())
   {
@@ -54,7 +1375,7 @@ public:
   }
 };
 
-void Tester::Test()
+bool Tester::Test()
 {
   try
   {
@@ -62,13 +1383,216 @@ void Tester::Test()
     testExactSolution<Function2>(fhlp<Function2>::GetDefaultParams());
     testExactSolution<Function3>(fhlp<Function3>::GetDefaultParams());
     testExactSolution<Function4>(fhlp<Function4>::GetDefaultParams());
+    testAutoDiff<Function1>(fhlp<Function1>::GetDefaultParams());
+    testAutoDiff<Function2>(fhlp<Function2>::GetDefaultParams());
+    testAutoDiff<Function3>(fhlp<Function3>::GetDefaultParams());
+    testAutoDiff<Function4>(fhlp<Function4>::GetDefaultParams());
+    testForecast<Function1>(fhlp<Function1>::GetDefaultParams());
+    testForecast<Function2>(fhlp<Function2>::GetDefaultParams());
+    testForecast<Function3>(fhlp<Function3>::GetDefaultParams());
+    testForecast<Function4>(fhlp<Function4>::GetDefaultParams());
     testSolver();
+    testMultiStart();
+    testBreakpointSweep();
+    testMixedPrecision();
+    testMatrixFree();
+    testVariableProjection();
+    testDeterministicReductions();
+    testViews();
+    testBacktest();
+    testModelRegistry();
+    testGroupedFit();
+    testNoAllocations();
+    testMemoryAccounting();
+    testPerfCounters();
+    testOutOfCore();
+    testCompactTaskData();
+    testShardedSolver();
+    testFitServer();
+    testBootstrap();
+    testMixture();
+    testImportPipeline();
+    testMultiFileImport();
+    testCheckpoint();
     testRealWorld();
   }
+  catch(std::exception &e)
+  {
+    std::cout<<"Test error: "<<e.what()<<std::endl;
+    return false;
+  }
   catch(...)
   {
     std::cout<<"Test error"<<std::endl;
+    return false;
+  }
+  std::cout<<"all tests passed"<<std::endl;
+  return true;
+}
+
+namespace
+{
+/// Wall time and peak memory limits of golden test stage
+struct StageBudget
+{
+  std::string name;
+  double seconds;
+  double megabytes;
+};
+
+/// Budgets of import and of each analyzed model fit.
+/// Peak memory is of the whole process up to the end of stage
+const std::vector<StageBudget> goldenBudgets{
+  {"import" ,  10,   64},
+  {"QOil1"  , 600, 1024},
+  {"QOil2"  , 600, 1024},
+  {"QOil4"  , 600, 1024},
+  {"QWater1", 600, 1024},
+  {"QWater2", 600, 1024},
+};
+/// Results are written with 6 significant digits
+const double goldenParamsRelTol = 1e-4;
+const double goldenParamsAbsTol = 1e-10;
+const double goldenDeltaAbsTol = 1e-4;
+/// Function params of right branch by family, breakpoint is the last of them.
+/// Rows don't determine them while breakpoint is past the last row
+const std::map<std::string, std::vector<size_t>> goldenRightBranchParams{
+  {"F4", {0, BreakpointParam<Function4>::value}},
+};
+
+double peakMegabytes()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss/1024.0;
+}
+
+/// One value per line, trailing comma of delta csv is ignored
+std::vector<double> readGolden(const std::string & filename)
+{
+  std::ifstream f(filename);
+  if(!f)
+    throw std::invalid_argument("Can't open " + filename);
+  std::vector<double> values;
+  std::string lineStr;
+  while(std::getline(f, lineStr))
+    if(lineStr.find_first_not_of(" \t\r,") != std::string::npos)
+      values.push_back(std::stod(lineStr));
+  return values;
+}
+
+/// Working hours of the last row of all holes
+double lastRowT(const OptimizedTaskData & oTD)
+{
+  double t = 0.0;
+  for(const OptimizedHoleData & hole : oTD.holes)
+    if(!hole.sumT.empty())
+      t = std::max(t, hole.sumT.back());
+  return t;
+}
+
+/// Indices of params which rows don't determine: function params of right
+/// branch while fitted or golden breakpoint is past the last row
+std::vector<size_t> unidentifiedParams(const ModelSpec & spec, const Eigen::VectorXd & params, const std::vector<double> & golden, double lastT)
+{
+  std::vector<size_t> indices;
+  const auto itParams = goldenRightBranchParams.find(spec.family);
+  if(itParams == goldenRightBranchParams.end() || size_t(params.size()) != golden.size())
+    return indices;
+  const size_t nQParams = golden.size() - ModelRegistry::GetFamily(spec.family).nFuncParams;
+  const size_t iBreakpoint = nQParams + itParams->second.back();
+  if(params[iBreakpoint] <= lastT && golden[iBreakpoint] <= lastT)
+    return indices;
+  for(size_t iParam : itParams->second)
+    indices.push_back(nQParams + iParam);
+  return indices;
+}
+
+/// Prints max deviation, false if sizes differ or any value except skipped is out of tolerance
+bool compareGolden(const std::string & what, const Eigen::VectorXd & values, const std::vector<double> & golden, double relTol, double absTol,
+                   const std::vector<size_t> & skipped = {})
+{
+  if(size_t(values.size()) != golden.size())
+  {
+    std::cout<<"  "<<what<<": size "<<values.size()<<", expected "<<golden.size()<<std::endl;
+    return false;
+  }
+  double maxDiff = 0.0;
+  size_t nFailed = 0;
+  for(size_t i = 0; i<golden.size(); ++i)
+  {
+    if(std::find(skipped.begin(), skipped.end(), i) != skipped.end())
+      continue;
+    const double diff = std::abs(values[i] - golden[i]);
+    maxDiff = std::max(maxDiff, diff);
+    if(!(diff <= absTol + relTol*std::abs(golden[i])))
+      ++nFailed;
+  }
+  std::cout<<"  "<<what<<": max deviation "<<maxDiff<<", out of tolerance "<<nFailed;
+  if(!skipped.empty())
+    std::cout<<", skipped "<<skipped.size()<<" not determined by rows";
+  std::cout<<std::endl;
+  return nFailed == 0;
+}
+}
+
+bool Tester::TestGolden(const std::string & dataFilename, const std::string & resultsDir)
+{
+  std::cout<<"testGolden"<<std::endl;
+  bool isPassed = true;
+  try
+  {
+    size_t iStage = 0;
+    auto stageStart = std::chrono::steady_clock::now();
+    auto finishStage = [&iStage, &stageStart, &isPassed](const std::string & name)
+    {
+      const std::chrono::duration<double> time = std::chrono::steady_clock::now() - stageStart;
+      const double megabytes = peakMegabytes();
+      const StageBudget & budget = goldenBudgets.at(iStage++);
+      if(budget.name != name)
+        throw std::logic_error("Unexpected stage " + name);
+      const bool isInBudget = time.count() <= budget.seconds && megabytes <= budget.megabytes;
+      std::cout<<"  "<<name<<": "<<time.count()<<" s of "<<budget.seconds
+               <<", peak "<<megabytes<<" MB of "<<budget.megabytes<<(isInBudget ? "" : " - over budget")<<std::endl;
+      isPassed = isPassed && isInBudget;
+      stageStart = std::chrono::steady_clock::now();
+    };
+    
+    const ImportedData data = ImportPipeline().Import(dataFilename);
+    finishStage("import");
+    
+    const std::vector<ModelSpec> specs = ModelRegistry::GetDefaultModels();
+    const double lastOilT = lastRowT(data.oil);
+    const double lastWaterT = lastRowT(data.water);
+    auto onFitted = [&resultsDir, &finishStage, &stageStart, &isPassed, &specs, lastOilT, lastWaterT](const AnalyzeSet & result)
+    {
+      finishStage(result.name);
+      const auto itSpec = std::find_if(specs.begin(), specs.end(), [&result](const ModelSpec & spec){return spec.name == result.name;});
+      if(itSpec == specs.end())
+        throw std::logic_error("Unexpected model " + result.name);
+      const std::string paramsFilename = resultsDir + "/" + result.name + "_params.txt";
+      const std::string deltaFilename = resultsDir + "/delta_" + result.name + ".csv";
+      const std::vector<double> goldenParams = readGolden(paramsFilename);
+      const std::vector<size_t> skipped = unidentifiedParams(*itSpec, result.params, goldenParams, itSpec->isWater ? lastWaterT : lastOilT);
+      isPassed = compareGolden(result.name + " params", result.params, goldenParams, goldenParamsRelTol, goldenParamsAbsTol, skipped) && isPassed;
+      isPassed = compareGolden(result.name + " delta", result.delta, readGolden(deltaFilename), 0.0, goldenDeltaAbsTol) && isPassed;
+      // comparison isn't included in the next stage
+      stageStart = std::chrono::steady_clock::now();
+    };
+    const std::vector<AnalyzeSet> results = Analyzer().Calc(data, specs, false, onFitted);
+    if(results.size() + 1 != goldenBudgets.size())
+    {
+      std::cout<<"  "<<results.size()<<" of "<<goldenBudgets.size() - 1<<" models fitted"<<std::endl;
+      isPassed = false;
+    }
+  }
+  catch(std::exception &e)
+  {
+    std::cout<<"Test error: "<<e.what()<<std::endl;
+    return false;
   }
+  std::cout<<(isPassed ? "test passed" : "test failed")<<std::endl;
+  return isPassed;
 }
 void Tester::tassert(bool val)
   {
@@ -5,8 +5,11 @@
 #include <cstdlib>
 #include "solver.h"
 #include "dataimporter.h"
+#include "memorytracker.h"
+#include "forecast.h"
 #include <memory>
 #include <ostream>
+#include <chrono>
 
 /**
  * Overloaded output operator for vectors.
@@ -28,6 +31,9 @@ std::ostream &operator<<(std::ostream &ostr, const std::vector<T> &v) {
 
 class Tester
 {
+  /// Real data file of testRealWorld
+  std::string _dataFilename;
+
   void tassert(bool val);
 
   template<class TFunc>
@@ -76,17 +82,17 @@ class Tester
       std::cout<<"params:"<<params.transpose()<<std::endl<<std::endl;
     
     RegressionModelLn<TFunc> rm(generateTaskData<TFunc>(sizes, q0iParams, funcParams));
-    for(size_t i = 1; i<rm._oTD.holes[0].qDivT.size(); ++i)
+    for(size_t i = 1; i<rm._oTD->holes[0].qDivT.size(); ++i)
     {
       const double eps = 1e-8;
-      tassert(rm._oTD.holes[0].sumT[i] > rm._oTD.holes[0].sumT[i-1]);
-      tassert(rm._oTD.holes[0].qDivT[i] - eps<rm._oTD.holes[0].qDivT[i-1]);
-      tassert(rm._oTD.holes[0].qDivT[i] + eps>0);
+      tassert(rm._oTD->holes[0].sumT[i] > rm._oTD->holes[0].sumT[i-1]);
+      tassert(rm._oTD->holes[0].qDivT[i] - eps<rm._oTD->holes[0].qDivT[i-1]);
+      tassert(rm._oTD->holes[0].qDivT[i] + eps>0);
     }
     if(p)
     {
-      std::cout<<"sumT: "<<rm._oTD.holes[0].sumT<<std::endl<<std::endl;
-      std::cout<<"qDivT: "<<rm._oTD.holes[0].qDivT<<std::endl<<std::endl;
+      std::cout<<"sumT: "<<rm._oTD->holes[0].sumT<<std::endl<<std::endl;
+      std::cout<<"qDivT: "<<rm._oTD->holes[0].qDivT<<std::endl<<std::endl;
     }
     
     WorkingSet ws = rm.InitWorkingSet();
@@ -109,12 +115,135 @@ class Tester
     std::cout<<"test passed"<<std::endl;
   }
   
+  /// Compares AutoDiff gradient with hand-coded one for all params and
+  /// benchmarks both on the same points. Fails if autodiff is slower than
+  /// hand-coded derivatives by more than maxSlowdown
+  template<class TFunc>
+  void testAutoDiff(const Eigen::VectorXd & funcParamsIn, const double maxSlowdown = 2.0)
+  {
+    std::cout<<"testAutoDiff"<<std::endl;
+    const typename TFunc::VParams funcParams = funcParamsIn;
+    typename TFunc::VParams gradHand, gradAuto;
+    for(size_t i = 0; i<100; ++i)
+    {
+      const double t = i*137.0;
+      const double valHand = HandDiff<TFunc>::CalcFTGrad(funcParams, t, gradHand);
+      const double valAuto = AutoDiff<TFunc>::CalcFTGrad(funcParams, t, gradAuto);
+      tassert(valHand == valAuto);
+      for(size_t iParam = 0; iParam<TFunc::nParams; ++iParam)
+        tassert(std::abs(gradHand[iParam] - gradAuto[iParam]) <= 1e-9*(std::abs(gradAuto[iParam])+1e-300));
+    }
+    
+    auto bench = [&funcParams](auto calcFTGrad, double & checksum)
+    {
+      typename TFunc::VParams grad;
+      double sum = 0.0;
+      const auto start = std::chrono::steady_clock::now();
+      for(size_t i = 0; i<2000000; ++i)
+      {
+        sum += calcFTGrad(funcParams, i*0.37, grad);
+        sum += grad.sum();
+      }
+      const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+      // sum keeps the loop from being optimized out
+      checksum = sum;
+      return time.count();
+    };
+    // the best of a few runs is less sensitive to other load
+    double timeHand = std::numeric_limits<double>::max(), timeAuto = timeHand;
+    double sumHand = 0, sumAuto = 0;
+    for(size_t iRun = 0; iRun<3; ++iRun)
+    {
+      timeHand = std::min(timeHand, bench(HandDiff<TFunc>::CalcFTGrad, sumHand));
+      timeAuto = std::min(timeAuto, bench(AutoDiff<TFunc>::CalcFTGrad, sumAuto));
+    }
+    std::cout<<"  checksums: "<<sumHand<<", "<<sumAuto<<std::endl;
+    std::cout<<"  hand-coded: "<<timeHand<<" s, autodiff: "<<timeAuto<<" s"<<std::endl;
+    tassert(std::abs(sumHand - sumAuto) <= 1e-9*std::abs(sumHand));
+    tassert(timeAuto <= maxSlowdown*timeHand);
+    std::cout<<"test passed"<<std::endl;
+  }
+  
+  /// Compares vectorized forecast with scalar CalcFT and benchmarks it
+  template<class TFunc>
+  void testForecast(const Eigen::VectorXd & funcParamsIn)
+  {
+    std::cout<<"testForecast"<<std::endl;
+    const typename TFunc::VParams funcParams = funcParamsIn;
+    const Eigen::ArrayXd t = Eigen::ArrayXd::LinSpaced(1000, 0.0, 137.0*999);
+    Eigen::ArrayXd ft;
+    TFunc::CalcFTArray(funcParams, t, ft);
+    for(Eigen::Index i = 0; i<t.size(); ++i)
+      tassert(std::abs(ft[i] - TFunc::CalcFT(funcParams, t[i])) <= 1e-12*std::abs(ft[i]));
+    
+    const size_t nHoles = 10000;
+    Eigen::VectorXd params(nHoles + TFunc::nParams);
+    std::vector<double> tEnds(nHoles);
+    for(size_t i = 0; i<nHoles; ++i)
+    {
+      params[i] = 1.0 + i%7;
+      tEnds[i] = 500.0*(i%200);
+    }
+    params.tail(TFunc::nParams) = funcParamsIn;
+    const Eigen::VectorXd horizon = MonthlyHorizon(120);
+    Forecast forecast;
+    const auto start = std::chrono::steady_clock::now();
+    CalcForecast<TFunc>(params, tEnds, horizon, forecast);
+    const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    std::cout<<"  "<<forecast.rates.size()<<" points: "<<time.count()<<" s"<<std::endl;
+    for(size_t i = 0; i<nHoles; i += 997)
+    {
+      double cumulative = 0.0;
+      double tPrev = tEnds[i];
+      double ratePrev = params[i]*TFunc::CalcFT(funcParams, tPrev);
+      for(Eigen::Index k = 0; k<horizon.size(); ++k)
+      {
+        const double rate = params[i]*TFunc::CalcFT(funcParams, tEnds[i] + horizon[k]);
+        cumulative += (rate + ratePrev)/2*(tEnds[i] + horizon[k] - tPrev);
+        tassert(std::abs(forecast.rates(k, i) - rate) <= 1e-12*rate);
+        tassert(std::abs(forecast.cumulative(k, i) - cumulative) <= 1e-12*cumulative);
+        tPrev = tEnds[i] + horizon[k];
+        ratePrev = rate;
+      }
+    }
+    std::cout<<"test passed"<<std::endl;
+  }
+  
   void testExactSolutionPrint();
   void testSolver();
+  void testMultiStart();
+  void testBreakpointSweep();
+  void testMixedPrecision();
+  void testMatrixFree();
+  void testVariableProjection();
+  void testDeterministicReductions();
+  void testViews();
+  void testBacktest();
+  void testModelRegistry();
+  void testGroupedFit();
+  void testNoAllocations();
+  void testMemoryAccounting();
+  void testPerfCounters();
+  void testOutOfCore();
+  void testCompactTaskData();
+  void testShardedSolver();
+  void testFitServer();
+  void testBootstrap();
+  void testMixture();
+  void testImportPipeline();
+  void testMultiFileImport();
+  void testCheckpoint();
   void testRealWorldIterative();
   void testRealWorld();
 public:
-  void Test();
+  /// dataFilename - real data, testRealWorld is skipped if it doesn't exist
+  explicit Tester(const std::string & dataFilename = "");
+  /// Runs all tests, false if any of them failed
+  bool Test();
+  /// Reruns analysis of dataFilename and compares fitted params and deltas
+  /// with <name>_params.txt and delta_<name>.csv of resultsDir.
+  /// Each stage must also fit its wall time and peak memory budget
+  bool TestGolden(const std::string & dataFilename, const std::string & resultsDir);
 };
 
 
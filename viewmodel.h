@@ -0,0 +1,170 @@
+#ifndef VIEWMODEL_H
+#define VIEWMODEL_H
+
+#include "regressionmodels.h"
+#include "taskdataview.h"
+#include <memory>
+#include <stdexcept>
+
+/// Regression model over view of shared task data: subset of holes and
+/// window of their rows. Rows are read in place, so models of many
+/// overlapping windows share one copy of data. Works with matrixFree
+/// solver mode only
+template<class TFunc, class TDiff = HandDiff<TFunc>>
+class ViewRegressionModelLn: public IRegressionModel
+{
+private:
+  typedef HoleKernels<TFunc, TDiff> Kernels;
+  
+  TaskDataView _view;
+  /// First row of every hole in y-f
+  std::vector<size_t> _offsets;
+  size_t _taskSize;
+  size_t _nQParams;
+  size_t _nFuncParams;
+  size_t _nParams;
+
+public:
+  ViewRegressionModelLn() = delete;
+  
+  explicit ViewRegressionModelLn(const TaskDataView& view)
+  : _view(view)
+  , _offsets(view.GetHolesCount())
+  , _taskSize(0)
+  , _nQParams(view.GetHolesCount())
+  , _nFuncParams(TFunc::nParams)
+  , _nParams(_nQParams + _nFuncParams)
+  {
+    for(size_t i = 0; i<_nQParams; ++i)
+    {
+      _offsets[i] = _taskSize;
+      _taskSize += _view.GetHole(i).sumT.size();
+    }
+  }
+  
+  bool IsReady() const
+  {
+    return _taskSize > 0;
+  }
+  
+  size_t GetTaskSize() const
+  {
+    return _taskSize;
+  }
+  
+  size_t GetParamsCount() const
+  {
+    return _nParams;
+  }
+  
+  size_t GetFuncParamsCount() const
+  {
+    return _nFuncParams;
+  }
+  
+  /// q0i of holes without rows in window are 1
+  Eigen::VectorXd GenParams0Vec()
+  {
+    Eigen::VectorXd params(_nParams);
+    for(size_t i = 0; i<_nQParams; ++i)
+    {
+      const HoleView hole = _view.GetHole(i);
+      params[i] = hole.qDivT.empty() ? 1.0 : hole.qDivT[0];
+    }
+    for(size_t i = 0; i<_nFuncParams; ++i)
+      params[_nQParams + i] = TFunc::GetDefaultParam(i);
+    return params;
+  }
+  
+  WorkingSet InitWorkingSet()
+  {
+    throw std::logic_error("View model supports matrix-free mode only");
+  }
+  
+  WorkingSetF InitWorkingSetF()
+  {
+    throw std::logic_error("View model supports matrix-free mode only");
+  }
+  
+  void CalcValue(const Eigen::VectorXd&, WorkingSet&) const
+  {
+    throw std::logic_error("View model supports matrix-free mode only");
+  }
+  
+  void CalcValue(const Eigen::VectorXd&, WorkingSetF&) const
+  {
+    throw std::logic_error("View model supports matrix-free mode only");
+  }
+  
+  NormalEquations InitNormalEquations()
+  {
+    return NormalEquations(_nQParams, _nFuncParams);
+  }
+  
+  void CalcNormalEquations(const Eigen::VectorXd& params, NormalEquations& ne) const
+  {
+    const typename TFunc::VParams funcParams = params.segment(_nQParams, _nFuncParams);
+    typedef typename Kernels::Accumulator Accumulator;
+    const Accumulator acc = ReduceHoles<Accumulator>(_nQParams, [&](Accumulator& accBlock, size_t i)
+    {
+      accBlock.AddHole(_view.GetHole(i), params[i], funcParams, i, ne);
+    });
+    acc.Store(ne);
+  }
+  
+  void CalcResidual(const Eigen::VectorXd& params, Eigen::VectorXd& yMinusF) const
+  {
+    const typename TFunc::VParams funcParams = params.segment(_nQParams, _nFuncParams);
+    yMinusF.resize(_taskSize);
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(size_t i = 0; i<_nQParams; ++i)
+      Kernels::CalcResidual(_view.GetHole(i), params[i], funcParams, yMinusF.data() + _offsets[i]);
+  }
+  
+  size_t NormalizeParams(Eigen::VectorXd& params) const
+  {
+    return Kernels::NormalizeParams(params, _nQParams);
+  }
+  
+  Eigen::MatrixXd GenStartCandidates(size_t nCandidates, unsigned int seed)
+  {
+    return Kernels::GenStartCandidates(GenParams0Vec(), _nQParams, nCandidates, seed);
+  }
+  
+  double CalcProjectedObjective(Eigen::VectorXd& params) const
+  {
+    const typename TFunc::VParams funcParams = params.segment(_nQParams, _nFuncParams);
+    return ReduceHoles<HolesSum>(_nQParams, [&](HolesSum& sumSq, size_t i)
+    {
+      sumSq.sum += Kernels::ProjectHole(_view.GetHole(i), funcParams, params[i]);
+    }).sum;
+  }
+  
+  bool SweepBreakpoint(Eigen::VectorXd& params, size_t nCandidates) const
+  {
+    return Kernels::SweepBreakpoint(params, _nQParams, nCandidates, [this](size_t i){return _view.GetHole(i);});
+  }
+  
+  double CalcFT(const Eigen::VectorXd& params, double t) const
+  {
+    const typename TFunc::VParams funcParams = params.tail(_nFuncParams);
+    return TFunc::CalcFT(funcParams, t);
+  }
+  
+  std::unique_ptr<IRegressionModel> Clone() const
+  {
+    return std::make_unique<ViewRegressionModelLn>(*this);
+  }
+  
+  Eigen::VectorXd GetTarget() const
+  {
+    throw std::logic_error("View model targets are shared and read only");
+  }
+  
+  void SetTarget(const Eigen::VectorXd&)
+  {
+    throw std::logic_error("View model targets are shared and read only");
+  }
+};
+
+#endif // VIEWMODEL_H